@@ -0,0 +1,330 @@
+﻿#include "LegacyVMFParser.h"
+#include "MapGenerator.h"
+#include "ThreadPool.h"
+#include "VMFParser.h"
+#include "Visibility.h"
+#include "Writer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Parsers print their stats on std::cout; keep the benchmark output readable
+    class MuteCout {
+    public:
+        MuteCout() : saved(std::cout.rdbuf(sink.rdbuf())) {}
+        ~MuteCout() { std::cout.rdbuf(saved); }
+    private:
+        std::ostringstream sink;
+        std::streambuf* saved;
+    };
+
+    size_t FileSize(const std::string& path) {
+        std::ifstream f(path, std::ios::binary | std::ios::ate);
+        return f.is_open() ? static_cast<size_t>(f.tellg()) : 0;
+    }
+
+    template<typename Fn>
+    double BestOf(int repeat, Fn&& fn) {
+        double best = 1e300;
+        for (int i = 0; i < repeat; ++i) {
+            auto t0 = Clock::now();
+            fn();
+            double s = std::chrono::duration<double>(Clock::now() - t0).count();
+            if (s < best) best = s;
+        }
+        return best;
+    }
+
+    bool SameVec(const Vec3& a, const Vec3& b) {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+
+    // Both parsers must produce the same brushes, faces, planes and materials
+    bool SameResult(const std::vector<Brush>& a, const MaterialTable& ma, const std::vector<Brush>& b, const MaterialTable& mb) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].faces.size() != b[i].faces.size()) return false;
+            for (size_t k = 0; k < a[i].faces.size(); ++k) {
+                const Face& fa = a[i].faces[k];
+                const Face& fb = b[i].faces[k];
+                if (!SameVec(fa.p1, fb.p1) || !SameVec(fa.p2, fb.p2) || !SameVec(fa.p3, fb.p3)) return false;
+                if (ma.Name(fa.material) != mb.Name(fb.material)) return false;
+            }
+        }
+        return true;
+    }
+
+    int RunParse(const std::string& path, int repeat) {
+        const double mb = FileSize(path) / (1024.0 * 1024.0);
+        std::vector<Brush> legacy, mapped, parallel;
+        MaterialTable legacyMaterials, mappedMaterials, parallelMaterials;
+        const unsigned threads = ThreadPool::DefaultThreadCount();
+
+        double tLegacy, tMapped, tArena, tParallel;
+        {
+            MuteCout mute;
+            tLegacy = BestOf(repeat, [&] {
+                legacyMaterials = MaterialTable();
+                legacy = LegacyVMFParser::ParseVMF(path, legacyMaterials);
+            });
+            tMapped = BestOf(repeat, [&] { mapped = VMFParser::ParseVMF(path, nullptr, &mappedMaterials); });
+            tArena = BestOf(repeat, [&] { ParsedMap map = VMFParser::Parse(path); });
+            tParallel = BestOf(repeat, [&] { parallel = VMFParser::ParseVMF(path, nullptr, &parallelMaterials, threads); });
+        }
+
+        size_t faces = 0;
+        for (const auto& b : mapped) faces += b.faces.size();
+
+        std::cout << "File: " << path << " (" << mb << " MB, " << mapped.size() << " brushes, " << faces << " faces)\n";
+        std::cout << "  legacy getline/regex : " << tLegacy * 1000.0 << " ms, " << mb / tLegacy << " MB/s\n";
+        std::cout << "  mmap tokenizer       : " << tMapped * 1000.0 << " ms, " << mb / tMapped << " MB/s\n";
+        std::cout << "  arena only           : " << tArena * 1000.0 << " ms, " << mb / tArena << " MB/s"
+            << " (" << mappedMaterials.Size() << " materials)\n";
+        std::cout << "  parallel (" << threads << " threads) : " << tParallel * 1000.0 << " ms, " << mb / tParallel << " MB/s\n";
+        std::cout << "  speedup              : " << tLegacy / tMapped << "x (parallel " << tLegacy / tParallel << "x)\n";
+
+        if (!SameResult(legacy, legacyMaterials, mapped, mappedMaterials)) {
+            std::cerr << "Mismatch between legacy and mmap parser output!\n";
+            return 1;
+        }
+        if (!SameResult(mapped, mappedMaterials, parallel, parallelMaterials)) {
+            std::cerr << "Mismatch between serial and parallel parser output!\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    struct ScaleOptions {
+        std::vector<int> sizes{ 16, 32, 64, 128 };
+        int floors = 2;
+        int repeat = 3;
+        unsigned threads = ThreadPool::DefaultThreadCount();
+        std::string dir;            // default: system temp directory
+        std::string csv;
+        bool keep = false;
+    };
+
+    // One size of the scaling run
+    struct ScaleRow {
+        int size = 0;
+        size_t sides = 0;
+        double mb = 0.0;
+        double parse = 0.0, visibility = 0.0, write = 0.0;   // seconds
+        size_t hidden = 0, expected = 0;
+    };
+
+    int RunGenerate(const std::string& path, const MapGenerator::Options& options) {
+        const auto t0 = Clock::now();
+        const MapGenerator::Stats stats = MapGenerator::WriteFile(path, options);
+        const double s = std::chrono::duration<double>(Clock::now() - t0).count();
+        std::cout << "Generated " << path << ": " << stats.brushes << " brushes, " << stats.sides << " sides, "
+            << FileSize(path) / (1024.0 * 1024.0) << " MB in " << s * 1000.0 << " ms\n";
+        std::cout << "Expected hidden faces: " << stats.expectedHidden << "\n";
+        return 0;
+    }
+
+    // Growth exponent between two rows: t ~ sides^e
+    double Exponent(double t0, double t1, size_t n0, size_t n1) {
+        if (t0 <= 0.0 || t1 <= 0.0 || n1 <= n0) return 0.0;
+        return std::log(t1 / t0) / std::log(static_cast<double>(n1) / n0);
+    }
+
+    int RunScale(const ScaleOptions& options) {
+        namespace fs = std::filesystem;
+        const fs::path dir = options.dir.empty() ? fs::temp_directory_path() : fs::path(options.dir);
+
+        std::cout << "Threads: " << options.threads << ", floors: " << options.floors
+            << ", best of " << options.repeat << "\n";
+        std::cout << std::setw(6) << "size" << std::setw(10) << "sides" << std::setw(9) << "MB"
+            << std::setw(11) << "parse ms" << std::setw(9) << "MB/s"
+            << std::setw(11) << "vis ms" << std::setw(12) << "sides/s"
+            << std::setw(11) << "write ms" << std::setw(9) << "MB/s"
+            << std::setw(18) << "exp parse/vis/wr" << "  hidden\n";
+
+        std::vector<ScaleRow> rows;
+        int failures = 0;
+        for (int size : options.sizes) {
+            MapGenerator::Options gen;
+            gen.size = size;
+            gen.floors = options.floors;
+            const std::string input = (dir / ("vmfbench_" + std::to_string(size) + ".vmf")).string();
+            const std::string output = (dir / ("vmfbench_" + std::to_string(size) + "_out.vmf")).string();
+            const MapGenerator::Stats stats = MapGenerator::WriteFile(input, gen);
+
+            ScaleRow row;
+            row.size = size;
+            row.mb = FileSize(input) / (1024.0 * 1024.0);
+            row.expected = stats.expectedHidden;
+
+            std::vector<Brush> brushes;
+            {
+                MuteCout mute;
+                row.parse = BestOf(options.repeat, [&] { brushes = VMFParser::ParseVMF(input); });
+                row.visibility = BestOf(options.repeat, [&] { Visibility::DetectHiddenFaces(brushes, options.threads); });
+                row.write = BestOf(options.repeat, [&] { Writer::ApplyNodraw(input, output, brushes); });
+            }
+            for (const Brush& b : brushes) {
+                row.sides += b.faces.size();
+                for (const Face& f : b.faces) row.hidden += f.hidden ? 1 : 0;
+            }
+
+            std::ostringstream exp;
+            if (!rows.empty()) {
+                const ScaleRow& prev = rows.back();
+                exp << std::fixed << std::setprecision(2)
+                    << Exponent(prev.parse, row.parse, prev.sides, row.sides) << "/"
+                    << Exponent(prev.visibility, row.visibility, prev.sides, row.sides) << "/"
+                    << Exponent(prev.write, row.write, prev.sides, row.sides);
+            }
+
+            const bool ok = row.hidden == row.expected && row.sides == stats.sides;
+            std::cout << std::fixed << std::setprecision(1)
+                << std::setw(6) << size << std::setw(10) << row.sides << std::setw(9) << row.mb
+                << std::setw(11) << row.parse * 1000.0 << std::setw(9) << row.mb / row.parse
+                << std::setw(11) << row.visibility * 1000.0 << std::setw(12) << std::setprecision(0) << row.sides / row.visibility
+                << std::setprecision(1) << std::setw(11) << row.write * 1000.0 << std::setw(9) << row.mb / row.write
+                << std::setw(18) << exp.str() << "  " << row.hidden << (ok ? "" : " MISMATCH, expected ")
+                << (ok ? "" : std::to_string(row.expected)) << "\n";
+            std::cout.unsetf(std::ios::fixed);
+            if (!ok) ++failures;
+
+            rows.push_back(row);
+            if (!options.keep) {
+                std::error_code ec;
+                fs::remove(input, ec);
+                fs::remove(output, ec);
+            }
+        }
+
+        if (!options.csv.empty()) {
+            std::ofstream csv(options.csv, std::ios::trunc);
+            csv << "size,sides,mb,parse_s,visibility_s,write_s,hidden,expected\n";
+            for (const ScaleRow& r : rows) {
+                csv << r.size << "," << r.sides << "," << r.mb << "," << r.parse << "," << r.visibility << ","
+                    << r.write << "," << r.hidden << "," << r.expected << "\n";
+            }
+        }
+
+        if (failures) std::cerr << failures << " size(s) did not match the expected hidden-face count!\n";
+        return failures ? 1 : 0;
+    }
+
+    // Indexed visibility pass against the O(F²) reference: every face must
+    // get the same flag. Without a map, one is generated from gen.
+    int RunCompare(const std::string& mapPath, const MapGenerator::Options& gen, unsigned threads) {
+        namespace fs = std::filesystem;
+        std::string path = mapPath;
+        if (path.empty()) {
+            path = (fs::temp_directory_path() / ("vmfbench_compare_" + std::to_string(gen.seed) + ".vmf")).string();
+            MapGenerator::WriteFile(path, gen);
+        }
+
+        std::vector<Brush> indexed, reference;
+        double tIndexed, tReference;
+        {
+            MuteCout mute;
+            indexed = VMFParser::ParseVMF(path);
+            reference = indexed;
+            tIndexed = BestOf(1, [&] { Visibility::DetectHiddenFaces(indexed, threads); });
+            tReference = BestOf(1, [&] { Visibility::DetectHiddenFacesBruteForce(reference); });
+        }
+        if (mapPath.empty()) {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+
+        size_t faces = 0, hidden = 0, differ = 0;
+        for (size_t i = 0; i < indexed.size(); ++i) {
+            for (size_t k = 0; k < indexed[i].faces.size(); ++k) {
+                const Face& a = indexed[i].faces[k];
+                const Face& b = reference[i].faces[k];
+                ++faces;
+                hidden += a.hidden ? 1 : 0;
+                if (a.hidden == b.hidden) continue;
+                if (++differ <= 20) {
+                    std::cout << "  brush " << indexed[i].id << " side " << a.sideId << ": indexed "
+                        << (a.hidden ? "hidden" : "visible") << ", brute force " << (b.hidden ? "hidden" : "visible") << "\n";
+                }
+            }
+        }
+        std::cout << "Compare " << (mapPath.empty() ? "generated map (seed " + std::to_string(gen.seed) + ")" : mapPath)
+            << ": " << faces << " faces, " << hidden << " hidden, indexed " << tIndexed * 1000.0 << " ms, brute force "
+            << tReference * 1000.0 << " ms\n";
+        if (differ) {
+            std::cerr << differ << " face(s) differ between the indexed pass and brute force!\n";
+            return 1;
+        }
+        std::cout << "Same hidden faces.\n";
+        return 0;
+    }
+
+    std::vector<int> ParseSizes(const std::string& text) {
+        std::vector<int> sizes;
+        std::stringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            int n = std::atoi(item.c_str());
+            if (n > 0) sizes.push_back(n);
+        }
+        return sizes;
+    }
+
+    void Usage() {
+        std::cout << "Usage: VMFBench.exe parse <map.vmf> [-repeat N]\n"
+            << "       VMFBench.exe generate <out.vmf> [-size N] [-floors N] [-pairs N] [-seed N]\n"
+            << "       VMFBench.exe scale [-sizes 16,32,64,128] [-floors N] [-threads N] [-repeat N]\n"
+            << "                          [-dir <tmp>] [-csv <file>] [-keep]\n"
+            << "       VMFBench.exe compare [<map.vmf>] [-size N] [-floors N] [-pairs N] [-seed N] [-threads N]\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        Usage();
+        return 1;
+    }
+
+    std::string command = argv[1];
+    int repeat = 3;
+    MapGenerator::Options gen;
+    ScaleOptions scale;
+    for (int i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-repeat" && hasValue) repeat = scale.repeat = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-size" && hasValue) gen.size = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-floors" && hasValue) gen.floors = scale.floors = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-pairs" && hasValue) gen.rotatedPairs = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "-seed" && hasValue) gen.seed = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (arg == "-sizes" && hasValue) scale.sizes = ParseSizes(argv[++i]);
+        else if (arg == "-threads" && hasValue) scale.threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "-dir" && hasValue) scale.dir = argv[++i];
+        else if (arg == "-csv" && hasValue) scale.csv = argv[++i];
+        else if (arg == "-keep") scale.keep = true;
+    }
+
+    try {
+        if (command == "parse" && argc >= 3) return RunParse(argv[2], repeat);
+        if (command == "generate" && argc >= 3) return RunGenerate(argv[2], gen);
+        if (command == "scale") return RunScale(scale);
+        if (command == "compare") return RunCompare(argc >= 3 && argv[2][0] != '-' ? argv[2] : "", gen, scale.threads);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Fatal: " << e.what() << "\n";
+        return 1;
+    }
+
+    Usage();
+    return 1;
+}
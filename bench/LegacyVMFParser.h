@@ -0,0 +1,11 @@
+﻿#pragma once
+#include "Geometry.h"
+#include "ParsedMap.h"
+#include <string>
+#include <vector>
+
+namespace LegacyVMFParser {
+    // Previous VMFParser::ParseVMF (std::getline + std::regex), benchmark baseline only.
+    // Material names are interned in materials.
+    std::vector<Brush> ParseVMF(const std::string& path, MaterialTable& materials);
+}
@@ -0,0 +1,141 @@
+﻿#include "MapGenerator.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    const double CELL = 128.0;
+    const double HEIGHT = 64.0;
+    const double OVERLAP = 0.25;
+    const double PAIR_SIZE = 64.0;
+    const double PAIR_SPACING = 512.0;
+
+    struct Point {
+        double x, y, z;
+    };
+
+    // Rotation around z (yaw), then around x (pitch), about a pivot
+    struct Transform {
+        Point pivot{ 0, 0, 0 };
+        Point offset{ 0, 0, 0 };
+        double yaw = 0.0;
+        double pitch = 0.0;
+
+        Point Apply(const Point& p) const {
+            double x = p.x - pivot.x, y = p.y - pivot.y, z = p.z - pivot.z;
+            const double cy = std::cos(yaw), sy = std::sin(yaw);
+            const double rx = x * cy - y * sy, ry = x * sy + y * cy;
+            const double cp = std::cos(pitch), sp = std::sin(pitch);
+            const double ry2 = ry * cp - z * sp, rz = ry * sp + z * cp;
+            return { rx + pivot.x + offset.x, ry2 + pivot.y + offset.y, rz + pivot.z + offset.z };
+        }
+    };
+
+    class Writer {
+    public:
+        explicit Writer(std::ostream& out_) : out(out_) {}
+
+        void Raw(const char* text) { out << text; }
+
+        // Same side order and plane point winding as Hammer's box tool
+        void Box(double x0, double y0, double z0, double x1, double y1, double z1, const Transform* t = nullptr) {
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "\tsolid\n\t{\n\t\t\"id\" \"%d\"\n", nextId++);
+            out << buf;
+            const Point planes[6][3] = {
+                { { x0, y1, z1 }, { x1, y1, z1 }, { x1, y0, z1 } },
+                { { x0, y0, z0 }, { x1, y0, z0 }, { x1, y1, z0 } },
+                { { x0, y1, z1 }, { x0, y0, z1 }, { x0, y0, z0 } },
+                { { x1, y1, z0 }, { x1, y0, z0 }, { x1, y0, z1 } },
+                { { x1, y1, z1 }, { x0, y1, z1 }, { x0, y1, z0 } },
+                { { x1, y0, z0 }, { x0, y0, z0 }, { x0, y0, z1 } },
+            };
+            for (const auto& plane : planes) {
+                Point p[3];
+                for (int k = 0; k < 3; ++k) p[k] = t ? t->Apply(plane[k]) : plane[k];
+                Side(p);
+            }
+            out << "\t\teditor\n\t\t{\n\t\t\t\"color\" \"0 180 0\"\n\t\t}\n\t}\n";
+        }
+
+    private:
+        void Side(const Point p[3]) {
+            char buf[512];
+            int n = std::snprintf(buf, sizeof(buf),
+                "\t\tside\n\t\t{\n\t\t\t\"id\" \"%d\"\n"
+                "\t\t\t\"plane\" \"(%.10g %.10g %.10g) (%.10g %.10g %.10g) (%.10g %.10g %.10g)\"\n"
+                "\t\t\t\"material\" \"DEV/DEV_MEASUREGENERIC01B\"\n"
+                "\t\t\t\"uaxis\" \"[1 0 0 0] 0.25\"\n\t\t\t\"vaxis\" \"[0 -1 0 0] 0.25\"\n"
+                "\t\t\t\"rotation\" \"0\"\n\t\t\t\"lightmapscale\" \"16\"\n\t\t\t\"smoothing_groups\" \"0\"\n\t\t}\n",
+                nextId++, p[0].x, p[0].y, p[0].z, p[1].x, p[1].y, p[1].z, p[2].x, p[2].y, p[2].z);
+            out.write(buf, n);
+        }
+
+        std::ostream& out;
+        int nextId = 3;
+    };
+}
+
+MapGenerator::Stats MapGenerator::Write(std::ostream& out, const Options& options)
+{
+    const int size = options.size < 1 ? 1 : options.size;
+    const int floors = options.floors < 1 ? 1 : options.floors;
+    const int pairs = options.rotatedPairs < 0 ? size : options.rotatedPairs;
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> angle(0.05, 1.5);
+
+    Writer w(out);
+    w.Raw("versioninfo\n{\n\t\"editorversion\" \"400\"\n\t\"mapversion\" \"1\"\n}\n"
+          "world\n{\n\t\"id\" \"1\"\n\t\"mapversion\" \"1\"\n\t\"classname\" \"worldspawn\"\n");
+
+    Stats stats;
+    for (int k = 0; k < floors; ++k) {
+        for (int j = 0; j < size; ++j) {
+            for (int i = 0; i < size; ++i) {
+                w.Box(i * CELL, j * CELL, k * HEIGHT,
+                    i * CELL + CELL + OVERLAP, j * CELL + CELL + OVERLAP, k * HEIGHT + HEIGHT + OVERLAP);
+            }
+        }
+    }
+    stats.brushes += static_cast<size_t>(floors) * size * size;
+    // Two hidden faces per contact: x and y neighbours on each floor, z neighbours between floors
+    stats.expectedHidden += 2 * (static_cast<size_t>(floors) * 2 * size * (size - 1)
+        + static_cast<size_t>(size) * size * (floors - 1));
+
+    const int perRow = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(pairs))));
+    const double top = floors * HEIGHT + PAIR_SPACING;
+    for (int p = 0; p < pairs; ++p) {
+        Transform t;
+        t.pivot = { PAIR_SIZE, PAIR_SIZE * 0.5, PAIR_SIZE * 0.5 };
+        t.offset = { (p % perRow) * PAIR_SPACING, (p / perRow) * PAIR_SPACING, top };
+        t.yaw = angle(rng);
+        t.pitch = (p % 2) ? angle(rng) : 0.0;
+        w.Box(0, 0, 0, PAIR_SIZE + OVERLAP, PAIR_SIZE, PAIR_SIZE, &t);
+        w.Box(PAIR_SIZE, 0, 0, 2 * PAIR_SIZE, PAIR_SIZE, PAIR_SIZE, &t);
+    }
+    stats.brushes += 2 * static_cast<size_t>(pairs);
+    stats.expectedHidden += 2 * static_cast<size_t>(pairs);
+    stats.sides = stats.brushes * 6;
+
+    w.Raw("}\nentity\n{\n\t\"id\" \"2\"\n\t\"classname\" \"info_player_start\"\n"
+          "\t\"angles\" \"0 0 0\"\n\t\"origin\" \"64 64 512\"\n}\ncameras\n{\n\t\"activecamera\" \"-1\"\n}\n"
+          "cordons\n{\n\t\"active\" \"0\"\n}\n");
+    return stats;
+}
+
+MapGenerator::Stats MapGenerator::WriteFile(const std::string& path, const Options& options)
+{
+    // The buffer must be installed before the file is opened to be used
+    std::vector<char> buffer(1 << 20);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Cannot write " + path);
+    Stats stats = Write(out, options);
+    out.close();
+    if (out.fail()) throw std::runtime_error("Cannot write " + path);
+    return stats;
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Synthetic VMF generator for the scaling benchmarks.
+//
+// Layout (all faces of a layout have a known visibility):
+//   - floors x size x size grid of touching 128x128x64 boxes; every box
+//     overlaps its +x, +y and +z neighbours by 0.25 unit, so both faces of
+//     each contact are hidden
+//   - pairs of touching boxes above the grid, rotated around z (and for
+//     every other pair tilted around x): the two faces of the contact are
+//     hidden, the pairs are far enough apart not to interact
+namespace MapGenerator {
+    struct Options {
+        int size = 32;              // boxes per row and per column
+        int floors = 2;
+        int rotatedPairs = -1;      // -1: one per row (size)
+        uint32_t seed = 1;
+    };
+
+    struct Stats {
+        size_t brushes = 0;
+        size_t sides = 0;
+        size_t expectedHidden = 0;  // ground truth for Visibility::DetectHiddenFaces
+    };
+
+    Stats Write(std::ostream& out, const Options& options);
+
+    // Throws std::runtime_error if the file cannot be written
+    Stats WriteFile(const std::string& path, const Options& options);
+}
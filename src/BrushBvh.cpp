@@ -0,0 +1,271 @@
+﻿#include "BrushBvh.h"
+#include "Winding.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+    const int BINS = 12;
+    const int MAX_DEPTH = 60;           // fits the traversal stack
+    const uint32_t MAX_LEAF = 4;        // a leaf may hold more only if no split helps
+    const double TRAVERSAL_COST = 1.0;  // relative to one brush test
+    const uint32_t NO_FACE = 0xFFFFFFFFu;
+
+    struct Box {
+        Vec3 min{ std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+        Vec3 max{ -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max() };
+
+        void Grow(const Vec3& lo, const Vec3& hi) {
+            min = { std::min(min.x, lo.x), std::min(min.y, lo.y), std::min(min.z, lo.z) };
+            max = { std::max(max.x, hi.x), std::max(max.y, hi.y), std::max(max.z, hi.z) };
+        }
+        double Area() const {
+            if (max.x < min.x) return 0.0;
+            const Vec3 d = max - min;
+            return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+    };
+
+    double Axis(const Vec3& v, int a) { return a == 0 ? v.x : (a == 1 ? v.y : v.z); }
+
+    int Bin(double centroid, double lo, double scale) {
+        return std::min(BINS - 1, static_cast<int>((centroid - lo) * scale));
+    }
+
+    // Does the ray cross the box between 0 and tMax (slab test)?
+    bool HitBox(const Vec3& min, const Vec3& max, const Vec3& origin, const Vec3& inv, double tMax) {
+        const double x1 = (min.x - origin.x) * inv.x, x2 = (max.x - origin.x) * inv.x;
+        const double y1 = (min.y - origin.y) * inv.y, y2 = (max.y - origin.y) * inv.y;
+        const double z1 = (min.z - origin.z) * inv.z, z2 = (max.z - origin.z) * inv.z;
+        const double tNear = std::max({ std::min(x1, x2), std::min(y1, y2), std::min(z1, z2), 0.0 });
+        const double tFar = std::min({ std::max(x1, x2), std::max(y1, y2), std::max(z1, z2), tMax });
+        return tNear <= tFar;
+    }
+}
+
+void BrushBvh::Build(const std::vector<Brush>& brushes)
+{
+    nodes.clear();
+    hulls.clear();
+    planes.clear();
+
+    for (size_t bi = 0; bi < brushes.size(); ++bi) {
+        const Brush& b = brushes[bi];
+        if (!(b.roles & ROLE_OCCLUDER) || b.faces.empty()) continue;
+        const double outward = -Winding::InwardSign(b);
+        Hull h;
+        h.min = b.min;
+        h.max = b.max;
+        h.brush = static_cast<uint32_t>(bi);
+        h.firstPlane = static_cast<uint32_t>(planes.size());
+        for (size_t fi = 0; fi < b.faces.size(); ++fi) {
+            const Face& f = b.faces[fi];
+            if (Length(f.normal) < 1e-4) continue;
+            const Vec3 n = f.normal * outward;
+            planes.push_back({ n, Dot(n, f.p1), static_cast<uint32_t>(fi) });
+        }
+        h.planeCount = static_cast<uint32_t>(planes.size()) - h.firstPlane;
+        if (h.planeCount < 4) {         // not a closed solid
+            planes.resize(h.firstPlane);
+            continue;
+        }
+        hulls.push_back(h);
+    }
+    if (hulls.empty()) return;
+
+    nodes.reserve(2 * hulls.size());
+    BuildNode(0, static_cast<uint32_t>(hulls.size()), 0);
+}
+
+uint32_t BrushBvh::BuildNode(uint32_t begin, uint32_t end, int depth)
+{
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    Box bounds, centroids;
+    for (uint32_t i = begin; i < end; ++i) {
+        const Hull& h = hulls[i];
+        bounds.Grow(h.min, h.max);
+        const Vec3 c = (h.min + h.max) * 0.5;
+        centroids.Grow(c, c);
+    }
+    nodes[index].min = bounds.min;
+    nodes[index].max = bounds.max;
+
+    const uint32_t count = end - begin;
+    auto makeLeaf = [&] {
+        nodes[index].index = begin;
+        nodes[index].count = static_cast<uint16_t>(count);
+        return index;
+    };
+    if (count <= 1 || (depth >= MAX_DEPTH && count <= 0xFFFF)) return makeLeaf();
+
+    // Binned SAH: cost of splitting after each bucket, on each axis
+    int bestAxis = -1, bestSplit = 0;
+    double bestCost = std::numeric_limits<double>::max();
+    for (int a = 0; a < 3; ++a) {
+        const double lo = Axis(centroids.min, a), extent = Axis(centroids.max, a) - lo;
+        if (extent <= 0.0) continue;
+        const double scale = BINS / extent;
+
+        Box binBox[BINS];
+        uint32_t binCount[BINS] = {};
+        for (uint32_t i = begin; i < end; ++i) {
+            const Hull& h = hulls[i];
+            const int bin = Bin((Axis(h.min, a) + Axis(h.max, a)) * 0.5, lo, scale);
+            binBox[bin].Grow(h.min, h.max);
+            ++binCount[bin];
+        }
+
+        double rightArea[BINS];
+        uint32_t rightCount[BINS];
+        Box right;
+        uint32_t n = 0;
+        for (int i = BINS - 1; i > 0; --i) {
+            right.Grow(binBox[i].min, binBox[i].max);
+            n += binCount[i];
+            rightArea[i] = right.Area();
+            rightCount[i] = n;
+        }
+        Box left;
+        n = 0;
+        for (int i = 0; i < BINS - 1; ++i) {
+            left.Grow(binBox[i].min, binBox[i].max);
+            n += binCount[i];
+            if (n == 0 || rightCount[i + 1] == 0) continue;
+            const double cost = left.Area() * n + rightArea[i + 1] * rightCount[i + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = a;
+                bestSplit = i;
+            }
+        }
+    }
+
+    const double area = bounds.Area();
+    const double splitCost = area > 0.0 ? TRAVERSAL_COST + bestCost / area : TRAVERSAL_COST;
+    if (count <= MAX_LEAF && (bestAxis < 0 || splitCost >= count)) return makeLeaf();
+
+    uint32_t mid = begin;
+    if (bestAxis >= 0) {
+        const double lo = Axis(centroids.min, bestAxis);
+        const double scale = BINS / (Axis(centroids.max, bestAxis) - lo);
+        auto it = std::partition(hulls.begin() + begin, hulls.begin() + end, [&](const Hull& h) {
+            return Bin((Axis(h.min, bestAxis) + Axis(h.max, bestAxis)) * 0.5, lo, scale) <= bestSplit;
+        });
+        mid = static_cast<uint32_t>(it - hulls.begin());
+    }
+    if (mid == begin || mid == end) {
+        // Same centroid everywhere (duplicated brushes): split by count
+        mid = begin + count / 2;
+        bestAxis = 0;
+    }
+
+    nodes[index].axis = static_cast<uint8_t>(bestAxis);
+    BuildNode(begin, mid, depth + 1);
+    const uint32_t rightChild = BuildNode(mid, end, depth + 1);
+    nodes[index].index = rightChild;
+    return index;
+}
+
+bool BrushBvh::CastHull(const Hull& h, const Vec3& origin, const Vec3& dir, double tMax, Hit& hit) const
+{
+    double tEnter = -std::numeric_limits<double>::max(), tExit = tMax;
+    uint32_t face = NO_FACE;
+    const Plane* p = planes.data() + h.firstPlane;
+    for (uint32_t i = 0; i < h.planeCount; ++i) {
+        const double dist = Dot(p[i].n, origin) - p[i].d;
+        const double denom = Dot(p[i].n, dir);
+        if (denom == 0.0) {
+            if (dist > 0.0) return false;   // parallel, outside
+            continue;
+        }
+        const double t = -dist / denom;
+        if (denom < 0.0) {
+            if (t > tEnter) { tEnter = t; face = p[i].face; }
+        }
+        else if (t < tExit) tExit = t;
+        if (tEnter > tExit) return false;
+    }
+    if (face == NO_FACE || tEnter <= 0.0) return false;   // origin inside or brush behind
+    hit.brush = h.brush;
+    hit.face = face;
+    hit.t = tEnter;
+    return true;
+}
+
+bool BrushBvh::Cast(const Vec3& origin, const Vec3& dir, double tMax, Hit& hit) const
+{
+    if (hulls.empty()) return false;
+    // Finite for axis-aligned rays: 0 * inf would be NaN on a slab boundary
+    const double big = 1e300;
+    const Vec3 inv(dir.x != 0.0 ? 1.0 / dir.x : big, dir.y != 0.0 ? 1.0 / dir.y : big, dir.z != 0.0 ? 1.0 / dir.z : big);
+    const bool negative[3] = { dir.x < 0.0, dir.y < 0.0, dir.z < 0.0 };
+
+    uint32_t stack[MAX_DEPTH + 4];
+    int top = 0;
+    uint32_t node = 0;
+    double best = tMax;
+    bool found = false;
+    for (;;) {
+        const Node& n = nodes[node];
+        if (HitBox(n.min, n.max, origin, inv, best)) {
+            if (n.count) {
+                for (uint32_t i = n.index; i < n.index + n.count; ++i) {
+                    if (CastHull(hulls[i], origin, dir, best, hit)) {
+                        best = hit.t;
+                        found = true;
+                    }
+                }
+            }
+            else {
+                // Near child first: the far one is often culled by then
+                const uint32_t left = node + 1, right = n.index;
+                if (negative[n.axis]) {
+                    stack[top++] = left;
+                    node = right;
+                }
+                else {
+                    stack[top++] = right;
+                    node = left;
+                }
+                continue;
+            }
+        }
+        if (top == 0) break;
+        node = stack[--top];
+    }
+    // Each accepted brush is closer than the previous one: hit is the closest
+    return found;
+}
+
+bool BrushBvh::Inside(const Vec3& p, double eps) const
+{
+    if (hulls.empty()) return false;
+    uint32_t stack[MAX_DEPTH + 4];
+    int top = 0;
+    uint32_t node = 0;
+    for (;;) {
+        const Node& n = nodes[node];
+        const bool in = p.x >= n.min.x && p.x <= n.max.x && p.y >= n.min.y && p.y <= n.max.y
+            && p.z >= n.min.z && p.z <= n.max.z;
+        if (in) {
+            if (n.count) {
+                for (uint32_t i = n.index; i < n.index + n.count; ++i) {
+                    const Hull& h = hulls[i];
+                    const Plane* pl = planes.data() + h.firstPlane;
+                    uint32_t k = 0;
+                    while (k < h.planeCount && Dot(pl[k].n, p) - pl[k].d < -eps) ++k;
+                    if (k == h.planeCount) return true;
+                }
+            }
+            else {
+                stack[top++] = n.index;
+                node = node + 1;
+                continue;
+            }
+        }
+        if (top == 0) break;
+        node = stack[--top];
+    }
+    return false;
+}
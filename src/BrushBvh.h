@@ -0,0 +1,67 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <cstdint>
+#include <vector>
+
+// Bounding-volume hierarchy over convex brushes, for ray casts.
+//
+// Built top-down with the surface area heuristic evaluated on a few buckets
+// of brush centroids per axis (binned SAH), which is O(n log n) and close to
+// a full sweep in quality. Nodes are stored depth-first, the left child right
+// after its parent, and traversed with a fixed-size stack, near child first.
+// A ray hits a brush where it enters the intersection of its half-spaces, so
+// no polygon is needed: the entry side is the visible one.
+class BrushBvh {
+public:
+    struct Hit {
+        uint32_t brush = 0;     // index in the vector given to Build
+        uint32_t face = 0;      // side of that brush the ray enters through
+        double t = 0.0;         // distance along dir
+    };
+
+    // Brushes with ROLE_OCCLUDER, bounded by Brush::min/max. Those must be the
+    // exact bounds (Brush::ComputeAABB with windings): face center bounds
+    // leave the corners of every brush out.
+    void Build(const std::vector<Brush>& brushes);
+
+    // Closest side hit by origin + t * dir, 0 < t <= tMax (dir need not be
+    // unit length). A brush that contains the origin is not hit.
+    bool Cast(const Vec3& origin, const Vec3& dir, double tMax, Hit& hit) const;
+
+    // True if p lies inside a brush, more than eps from its sides
+    bool Inside(const Vec3& p, double eps = 1e-3) const;
+
+    bool Empty() const { return hulls.empty(); }
+    size_t NodeCount() const { return nodes.size(); }
+    const Vec3& Min() const { return nodes[0].min; }   // root bounds, !Empty()
+    const Vec3& Max() const { return nodes[0].max; }
+
+private:
+    struct Node {
+        Vec3 min, max;
+        uint32_t index = 0;     // leaf: first hull; inner: right child (left child is next)
+        uint16_t count = 0;     // hulls of a leaf, 0 for an inner node
+        uint8_t axis = 0;       // split axis of an inner node
+    };
+
+    // Outward plane: the brush is where Dot(n, p) <= d for all its planes
+    struct Plane {
+        Vec3 n;
+        double d;
+        uint32_t face;
+    };
+
+    struct Hull {
+        Vec3 min, max;
+        uint32_t brush = 0;
+        uint32_t firstPlane = 0;
+        uint32_t planeCount = 0;
+    };
+
+    uint32_t BuildNode(uint32_t begin, uint32_t end, int depth);
+    bool CastHull(const Hull& h, const Vec3& origin, const Vec3& dir, double tMax, Hit& hit) const;
+
+    std::vector<Node> nodes;
+    std::vector<Hull> hulls;        // leaves own contiguous ranges
+    std::vector<Plane> planes;
+};
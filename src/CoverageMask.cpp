@@ -0,0 +1,85 @@
+﻿#include "CoverageMask.h"
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+
+namespace {
+    uint32_t PopCount(uint64_t w) {
+        return static_cast<uint32_t>(std::bitset<64>(w).count());
+    }
+
+    // Bits i0..i1 of a row (0 <= i0 <= i1 < 64)
+    uint64_t Span(int i0, int i1) {
+        return (~0ull >> (63 - (i1 - i0))) << i0;
+    }
+}
+
+bool CoverageMask::Rasterize(const Winding::Point2* poly, size_t n, uint64_t* rows, int& first, int& last) const
+{
+    if (n < 3) return false;
+    double vLo = poly[0].v, vHi = poly[0].v;
+    for (size_t k = 1; k < n; ++k) {
+        vLo = std::min(vLo, poly[k].v);
+        vHi = std::max(vHi, poly[k].v);
+    }
+
+    // Rows whose center line crosses the polygon: v0 + (j + 0.5) dv in [vLo, vHi]
+    const double jLo = std::ceil((vLo - v0) / dv - 0.5), jHi = std::floor((vHi - v0) / dv - 0.5);
+    if (!(jLo <= jHi) || jHi < 0.0 || jLo > SIZE - 1) return false;
+    first = static_cast<int>(std::max(0.0, jLo));
+    last = static_cast<int>(std::min(SIZE - 1.0, jHi));
+
+    for (int j = first; j <= last; ++j) {
+        const double y = v0 + (j + 0.5) * dv;
+        double uLo = HUGE_VAL, uHi = -HUGE_VAL;
+        for (size_t k = 0; k < n; ++k) {
+            const Winding::Point2& a = poly[k];
+            const Winding::Point2& b = poly[k + 1 < n ? k + 1 : 0];
+            if ((y < a.v && y < b.v) || (y > a.v && y > b.v)) continue;
+            if (a.v == b.v) {
+                uLo = std::min(uLo, std::min(a.u, b.u));
+                uHi = std::max(uHi, std::max(a.u, b.u));
+                continue;
+            }
+            const double x = a.u + (y - a.v) * (b.u - a.u) / (b.v - a.v);
+            uLo = std::min(uLo, x);
+            uHi = std::max(uHi, x);
+        }
+
+        rows[j] = 0;
+        const double iLo = std::ceil((uLo - u0) / du - 0.5), iHi = std::floor((uHi - u0) / du - 0.5);
+        if (!(iLo <= iHi) || iHi < 0.0 || iLo > SIZE - 1) continue;
+        rows[j] = Span(static_cast<int>(std::max(0.0, iLo)), static_cast<int>(std::min(SIZE - 1.0, iHi)));
+    }
+    return true;
+}
+
+uint32_t CoverageMask::Reset(const Winding::Point2* poly, uint32_t n, double uMin, double uMax, double vMin, double vMax)
+{
+    u0 = uMin;
+    v0 = vMin;
+    du = (uMax - uMin) / SIZE;
+    dv = (vMax - vMin) / SIZE;
+    std::fill(face, face + SIZE, 0ull);
+    std::fill(covered, covered + SIZE, 0ull);
+    faceCells = coveredCells = 0;
+    if (!(du > 0.0) || !(dv > 0.0)) return 0;
+
+    int first, last;
+    if (!Rasterize(poly, n, face, first, last)) return 0;
+    for (int j = first; j <= last; ++j) faceCells += PopCount(face[j]);
+    return faceCells;
+}
+
+void CoverageMask::Add(const Winding::Point2* poly, size_t n)
+{
+    if (faceCells == 0) return;
+    uint64_t rows[SIZE];
+    int first, last;
+    if (!Rasterize(poly, n, rows, first, last)) return;
+    for (int j = first; j <= last; ++j) {
+        const uint64_t added = rows[j] & face[j] & ~covered[j];
+        covered[j] |= added;
+        coveredCells += PopCount(added);
+    }
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+#include "Winding.h"
+#include <cstdint>
+
+// Occupancy of one face by several occluders: a SIZE x SIZE grid over the
+// face's rectangle in its own (u, v) basis, one 64-bit word per row. A cell
+// belongs to a polygon when its center is inside it (edges included), so a
+// seam shared by two occluders leaves no gap. Occluders are OR-ed in a row
+// at a time and the covered cells are counted as they are added.
+class CoverageMask {
+public:
+    static constexpr int SIZE = 64;
+
+    // Rasterizes the face (convex, counter-clockwise) over its rectangle and
+    // clears the coverage. Returns the number of cells of the face.
+    uint32_t Reset(const Winding::Point2* face, uint32_t n, double uMin, double uMax, double vMin, double vMax);
+
+    // Adds a convex occluder, given in the face's basis
+    void Add(const Winding::Point2* poly, size_t n);
+
+    uint32_t FaceCells() const { return faceCells; }
+    uint32_t CoveredCells() const { return coveredCells; }
+
+    // At least ratio of the face's cells are covered
+    bool Covers(double ratio) const { return faceCells > 0 && coveredCells >= ratio * faceCells; }
+
+private:
+    // Cells whose center is inside the polygon; rows outside [first, last]
+    // are left untouched. False if no row is crossed.
+    bool Rasterize(const Winding::Point2* poly, size_t n, uint64_t* rows, int& first, int& last) const;
+
+    double u0 = 0, v0 = 0, du = 1, dv = 1;
+    uint64_t face[SIZE] = {};
+    uint64_t covered[SIZE] = {};
+    uint32_t faceCells = 0;
+    uint32_t coveredCells = 0;
+};
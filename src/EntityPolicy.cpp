@@ -0,0 +1,139 @@
+﻿#include "EntityPolicy.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    std::string Lower(std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return s;
+    }
+
+    // name must be lowercase
+    bool Matches(const std::string& pattern, const std::string& name) {
+        if (!pattern.empty() && pattern.back() == '*')
+            return name.compare(0, pattern.size() - 1, pattern, 0, pattern.size() - 1) == 0;
+        return pattern == name;
+    }
+
+    bool ParseRole(const std::string& word, uint8_t& roles) {
+        if (word == "occlude") roles |= ROLE_OCCLUDER;
+        else if (word == "receive") roles |= ROLE_RECEIVER;
+        else if (word == "both") roles |= ROLE_OCCLUDER | ROLE_RECEIVER;
+        else if (word != "ignore") return false;
+        return true;
+    }
+}
+
+EntityPolicy::Policy EntityPolicy::Default()
+{
+    Policy p;
+    p.classes.push_back({ "worldspawn", ROLE_OCCLUDER | ROLE_RECEIVER });
+    p.classes.push_back({ "func_detail", ROLE_OCCLUDER | ROLE_RECEIVER });
+    p.otherRoles = 0;
+    p.materials = {
+        "tools/toolsclip", "tools/toolsplayerclip", "tools/toolsnpcclip", "tools/toolsgrenadeclip",
+        "tools/toolstrigger", "tools/toolsinvisible*", "tools/toolshint", "tools/toolsskip",
+        "tools/toolsareaportal*", "tools/toolsoccluder", "tools/toolsblock*", "tools/toolsfog",
+    };
+    return p;
+}
+
+EntityPolicy::Policy EntityPolicy::Load(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in.is_open()) throw std::runtime_error("Failed to open policy file: " + path);
+
+    Policy loaded;
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream words(Lower(line));
+        std::string name, word;
+        if (!(words >> name)) continue;
+
+        if (name == "material") {
+            if (!(words >> word)) throw std::runtime_error(path + ":" + std::to_string(number) + ": material name expected");
+            loaded.materials.push_back(word);
+            continue;
+        }
+        Rule rule{ name, 0 };
+        bool any = false;
+        while (words >> word) {
+            if (!ParseRole(word, rule.roles))
+                throw std::runtime_error(path + ":" + std::to_string(number) + ": unknown role '" + word + "'");
+            any = true;
+        }
+        if (!any) throw std::runtime_error(path + ":" + std::to_string(number) + ": role expected after " + name);
+        loaded.classes.push_back(rule);
+    }
+
+    Policy p = Default();
+    p.classes.insert(p.classes.begin(), loaded.classes.begin(), loaded.classes.end());
+    p.materials.insert(p.materials.end(), loaded.materials.begin(), loaded.materials.end());
+    return p;
+}
+
+uint8_t EntityPolicy::RolesFor(const Policy& policy, const std::string& classname)
+{
+    const std::string name = Lower(classname);
+    for (const Rule& r : policy.classes) {
+        if (Matches(r.pattern, name)) return r.roles;
+    }
+    return policy.otherRoles;
+}
+
+std::vector<uint8_t> EntityPolicy::IgnoredMaterials(const Policy& policy, const MaterialTable& materials)
+{
+    std::vector<uint8_t> ignored(materials.Size(), 0);
+    for (uint32_t id = 1; id < materials.Size(); ++id) {
+        const std::string name = Lower(materials.Name(id));
+        for (const std::string& pattern : policy.materials) {
+            if (Matches(pattern, name)) {
+                ignored[id] = 1;
+                break;
+            }
+        }
+    }
+    return ignored;
+}
+
+size_t EntityPolicy::Apply(const Policy& policy, std::vector<Brush>& brushes, const std::vector<Entity>& entities,
+    const MaterialTable& materials)
+{
+    // One lookup per entity and per material, not per brush
+    const uint8_t worldRoles = RolesFor(policy, "worldspawn");
+    std::vector<uint8_t> entityRoles(entities.size());
+    for (size_t i = 0; i < entities.size(); ++i) entityRoles[i] = RolesFor(policy, entities[i].classname);
+
+    const std::vector<uint8_t> ignoredMaterial = IgnoredMaterials(policy, materials);
+
+    size_t ignored = 0, ignoredSides = 0, occluderOnly = 0, receiverOnly = 0;
+    for (Brush& b : brushes) {
+        uint8_t roles = (b.entity >= 0 && static_cast<size_t>(b.entity) < entities.size()) ? entityRoles[b.entity] : worldRoles;
+        const bool toolsOnly = !b.faces.empty() && std::all_of(b.faces.begin(), b.faces.end(), [&](const Face& f) {
+            return f.material < ignoredMaterial.size() && ignoredMaterial[f.material];
+        });
+        if (toolsOnly) roles = 0;
+        b.roles = roles;
+
+        if (roles == 0) {
+            ++ignored;
+            ignoredSides += b.faces.size();
+        }
+        else if (roles == ROLE_OCCLUDER) ++occluderOnly;
+        else if (roles == ROLE_RECEIVER) ++receiverOnly;
+    }
+
+    std::cout << "Entity policy: " << ignored << " brushes ignored (" << ignoredSides << " sides)";
+    if (occluderOnly || receiverOnly) std::cout << ", " << occluderOnly << " occlude only, " << receiverOnly << " receive only";
+    std::cout << ".\n";
+    Profiler::Add("policy_ignored_brushes", ignored);
+    Profiler::Add("policy_ignored_sides", ignoredSides);
+    return ignored;
+}
@@ -0,0 +1,46 @@
+﻿#pragma once
+#include "Geometry.h"
+#include "ParsedMap.h"
+#include <string>
+#include <vector>
+
+// Which brushes take part in the visibility pass, by owning entity class.
+//
+// A brush may occlude (its faces hide others), receive (its faces may get
+// nodraw), both, or neither: ignored brushes are left out of the pass. The
+// classname of world brushes is "worldspawn". Brushes whose sides all use
+// an "ignored material" (clips, triggers, hints...) are ignored whatever
+// their entity: they are not drawn and do not hide anything.
+namespace EntityPolicy {
+    struct Rule {
+        std::string pattern;    // lowercase; exact name, or prefix ending with '*'
+        uint8_t roles = 0;      // BrushRole bits
+    };
+
+    struct Policy {
+        std::vector<Rule> classes;              // first match wins
+        std::vector<std::string> materials;     // ignored materials (patterns)
+        uint8_t otherRoles = 0;                 // classes matching no rule
+    };
+
+    // worldspawn and func_detail occlude and receive; every other brush
+    // entity (doors, func_brush, triggers...) may move, vanish or be
+    // invisible, so it is ignored. Tool textures are ignored materials.
+    Policy Default();
+
+    // Default() with the rules of a text file in front of it, one per line:
+    //   <class|prefix*> occlude|receive|both|ignore [occlude|receive]
+    //   material <name|prefix*>
+    // '#' starts a comment. Throws std::runtime_error on a bad line.
+    Policy Load(const std::string& path);
+
+    uint8_t RolesFor(const Policy& policy, const std::string& classname);
+
+    // 1 for every material id of the table that is an ignored material
+    std::vector<uint8_t> IgnoredMaterials(const Policy& policy, const MaterialTable& materials);
+
+    // Sets Brush::roles from the owning entity (entities[b.entity]) and the
+    // side materials. Returns the number of ignored brushes.
+    size_t Apply(const Policy& policy, std::vector<Brush>& brushes, const std::vector<Entity>& entities,
+        const MaterialTable& materials);
+}
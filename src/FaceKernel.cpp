@@ -0,0 +1,484 @@
+﻿#include "FaceKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VMF_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts AVX2 intrinsics anywhere; GCC/Clang need the function to be
+// compiled for that target. Nothing here may use FMA: the results must match
+// the scalar pass bit for bit.
+#if defined(VMF_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VMF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define VMF_TARGET_AVX2
+#endif
+
+namespace {
+    using FaceKernel::Query;
+
+    // A side without a polygon, or of a brush that does not occlude, never
+    // covers anything
+    const uint8_t USABLE = FaceTable::VALID_NORMAL | FaceTable::HAS_WINDING | FaceTable::OCCLUDER;
+
+    // Same predicates, in the same order, as covers() in Visibility.cpp; the
+    // coverage is only bounded by the overlap of the winding rectangles
+    uint32_t TestScalar(const FaceTable& t, const Query& q, const uint32_t* rows, int count, uint32_t& needScalar,
+        uint32_t& partial, FaceKernel::Stats& stats)
+    {
+        uint32_t hit = 0;
+        stats.tested += static_cast<uint64_t>(count);
+        for (int k = 0; k < count; ++k) {
+            const uint32_t r = rows[k];
+            if ((t.flags[r] & USABLE) != USABLE || t.brushId[r] == q.brushId) {
+                stats.rejectedUnusable++;
+                continue;
+            }
+
+            double normalDot = q.nx * t.nx[r] + q.ny * t.ny[r] + q.nz * t.nz[r];
+            if (normalDot > q.normalLimit) { stats.rejectedNormal++; continue; }
+
+            double dx = t.cx[r] - q.cx, dy = t.cy[r] - q.cy, dz = t.cz[r] - q.cz;
+            double dd = dx * q.nx + dy * q.ny + dz * q.nz;
+            if (std::abs(dd) > q.planeEps) { stats.rejectedPlane++; continue; }
+            if (dd <= 0.0) { stats.rejectedFront++; continue; }
+
+            double planePosB = q.nx * t.cx[r] + q.ny * t.cy[r] + q.nz * t.cz[r];
+            if (std::abs(planePosB - q.planeA) > q.planeEps) { stats.rejectedPlanePos++; continue; }
+
+            const bool exact = (t.flags[r] & FaceTable::HAS_BASIS)
+                && t.nx[r] == -q.nx && t.ny[r] == -q.ny && t.nz[r] == -q.nz;
+            if (!exact) {
+                needScalar |= 1u << k;
+                continue;
+            }
+
+            double BuMin = -t.uMax[r], BuMax = -t.uMin[r];
+            double overlapU = std::max(0.0, std::min(q.AuMax, BuMax) - std::max(q.AuMin, BuMin));
+            double overlapV = std::max(0.0, std::min(q.AvMax, t.vMax[r]) - std::max(q.AvMin, t.vMin[r]));
+            if (overlapU > 0.0 && overlapV > 0.0 && (overlapU * overlapV) / q.areaA >= q.coverRatio) {
+                hit |= 1u << k;
+                continue;
+            }
+            stats.rejectedRect++;
+            if (overlapU > 0.0 && overlapV > 0.0) partial |= 1u << k;
+        }
+        return hit;
+    }
+
+    // Prefilter in the precision of T (Fixed32, or float without AVX2). The
+    // rectangle overlap is taken in double from the stored extents: only
+    // their rounding needs a slack there.
+    template<typename T>
+    uint32_t PrefilterScalar(const FaceTable& t, const CompactFaceRows<T>& c, const Query& q,
+        const uint32_t* rows, int count, uint32_t& partial, FaceKernel::Stats& stats)
+    {
+        using Traits = ScalarTraits<T>;
+        const BasicVec3<T> n(T(q.nx), T(q.ny), T(q.nz));
+        const BasicVec3<T> center(T(q.cx), T(q.cy), T(q.cz));
+        const double normalLimit = q.normalLimit + q.slackNormal;
+        const uint32_t opposite = c.oppositeId[q.row];
+
+        // A rejected row is counted as TestBatch would count it
+        auto reject = [&](uint64_t& predicate) {
+            stats.tested++;
+            predicate++;
+        };
+
+        uint32_t keep = 0;
+        for (int k = 0; k < count; ++k) {
+            const uint32_t r = rows[k];
+            if (c.normalId[r] == CompactFaceRows<T>::NO_ID) {
+                keep |= 1u << k;
+                continue;
+            }
+            if ((t.flags[r] & USABLE) != USABLE || t.brushId[r] == q.brushId) { reject(stats.rejectedUnusable); continue; }
+
+            const BasicVec3<T> b(c.nx[r], c.ny[r], c.nz[r]);
+            if (Traits::ToDouble(Dot(n, b)) > normalLimit) { reject(stats.rejectedNormal); continue; }
+
+            const BasicVec3<T> d = BasicVec3<T>(c.cx[r], c.cy[r], c.cz[r]) - center;
+            const double dd = Traits::ToDouble(Dot(d, n));
+            const double slack = q.slackPlane + q.slackPlanePerUnit
+                * (std::abs(Traits::ToDouble(d.x)) + std::abs(Traits::ToDouble(d.y)) + std::abs(Traits::ToDouble(d.z)));
+            if (std::abs(dd) > q.planeEps + slack) { reject(stats.rejectedPlane); continue; }
+            if (dd <= -slack) { reject(stats.rejectedFront); continue; }
+
+            if ((t.flags[r] & FaceTable::HAS_BASIS) && opposite != CompactFaceRows<T>::NO_ID && c.normalId[r] == opposite) {
+                const double overlapU = std::min(q.AuMax, -Traits::ToDouble(c.uMin[r]))
+                    - std::max(q.AuMin, -Traits::ToDouble(c.uMax[r])) + q.slackRect;
+                const double overlapV = std::min(q.AvMax, Traits::ToDouble(c.vMax[r]))
+                    - std::max(q.AvMin, Traits::ToDouble(c.vMin[r])) + q.slackRect;
+                if (overlapU <= 0.0 || overlapV <= 0.0 || (overlapU * overlapV) / q.areaA * (1.0 + 1e-12) < q.coverRatio) {
+                    reject(stats.rejectedRect);
+                    if (overlapU > 0.0 && overlapV > 0.0) partial |= 1u << k;
+                    continue;
+                }
+            }
+            // Passed, or not an exact opposite: TestBatch decides
+            keep |= 1u << k;
+        }
+        return keep;
+    }
+
+#ifdef VMF_X86
+    int PopCount(uint32_t m)
+    {
+        int n = 0;
+        for (; m; m &= m - 1) ++n;
+        return n;
+    }
+
+    // Counts each lane at the first predicate mask that rejects it (same
+    // order as the scalar test); returns the lanes that pass them all
+    uint32_t CountRejections(uint32_t live, uint32_t normal, uint32_t plane, uint32_t front, uint32_t planePos,
+        FaceKernel::Stats& stats)
+    {
+        stats.rejectedNormal += PopCount(live & normal);     live &= ~normal;
+        stats.rejectedPlane += PopCount(live & plane);       live &= ~plane;
+        stats.rejectedFront += PopCount(live & front);       live &= ~front;
+        stats.rejectedPlanePos += PopCount(live & planePos); live &= ~planePos;
+        return live;
+    }
+
+    // Lanes that are not filtered by the arithmetic predicates
+    void LaneFlags(const FaceTable& t, const Query& q, const uint32_t* rows, int lanes,
+        uint32_t& usable, uint32_t& withBasis)
+    {
+        usable = withBasis = 0;
+        for (int k = 0; k < lanes; ++k) {
+            const uint32_t r = rows[k];
+            if ((t.flags[r] & USABLE) == USABLE && t.brushId[r] != q.brushId) usable |= 1u << k;
+            if (t.flags[r] & FaceTable::HAS_BASIS) withBasis |= 1u << k;
+        }
+    }
+
+    uint32_t TestSse2(const FaceTable& t, const Query& q, const uint32_t* rows, int count, uint32_t& needScalar,
+        uint32_t& partial, FaceKernel::Stats& stats)
+    {
+        const __m128d nx = _mm_set1_pd(q.nx), ny = _mm_set1_pd(q.ny), nz = _mm_set1_pd(q.nz);
+        const __m128d cx = _mm_set1_pd(q.cx), cy = _mm_set1_pd(q.cy), cz = _mm_set1_pd(q.cz);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d signBit = _mm_set1_pd(-0.0);
+        const __m128d limit = _mm_set1_pd(q.normalLimit);
+        const __m128d eps = _mm_set1_pd(q.planeEps);
+        const __m128d planeA = _mm_set1_pd(q.planeA);
+        const __m128d auMin = _mm_set1_pd(q.AuMin), auMax = _mm_set1_pd(q.AuMax);
+        const __m128d avMin = _mm_set1_pd(q.AvMin), avMax = _mm_set1_pd(q.AvMax);
+        const __m128d area = _mm_set1_pd(q.areaA), ratio = _mm_set1_pd(q.coverRatio);
+
+        uint32_t hit = 0;
+        for (int base = 0; base < count; base += 2) {
+            const int lanes = std::min(2, count - base);
+            const uint32_t r0 = rows[base];
+            const uint32_t r1 = rows[base + lanes - 1];
+            auto load = [&](const std::vector<double>& a) { return _mm_set_pd(a[r1], a[r0]); };
+
+            uint32_t usable, withBasis;
+            LaneFlags(t, q, rows + base, lanes, usable, withBasis);
+            stats.tested += lanes;
+            stats.rejectedUnusable += lanes - PopCount(usable);
+            if (!usable) continue;
+
+            const __m128d bx = load(t.nx), by = load(t.ny), bz = load(t.nz);
+            const __m128d px = load(t.cx), py = load(t.cy), pz = load(t.cz);
+
+            __m128d normalDot = _mm_add_pd(_mm_add_pd(_mm_mul_pd(nx, bx), _mm_mul_pd(ny, by)), _mm_mul_pd(nz, bz));
+            const uint32_t rejectNormal = _mm_movemask_pd(_mm_cmpgt_pd(normalDot, limit));
+
+            __m128d dd = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_sub_pd(px, cx), nx), _mm_mul_pd(_mm_sub_pd(py, cy), ny)),
+                _mm_mul_pd(_mm_sub_pd(pz, cz), nz));
+            const uint32_t rejectPlane = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(signBit, dd), eps));
+            const uint32_t rejectFront = _mm_movemask_pd(_mm_cmple_pd(dd, zero));
+
+            __m128d planePosB = _mm_add_pd(_mm_add_pd(_mm_mul_pd(nx, px), _mm_mul_pd(ny, py)), _mm_mul_pd(nz, pz));
+            const uint32_t rejectPlanePos = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(signBit, _mm_sub_pd(planePosB, planeA)), eps));
+
+            const uint32_t pass = CountRejections(usable, rejectNormal, rejectPlane, rejectFront, rejectPlanePos, stats);
+            if (!pass) continue;
+
+            __m128d exactMask = _mm_and_pd(_mm_cmpeq_pd(bx, _mm_xor_pd(nx, signBit)),
+                _mm_and_pd(_mm_cmpeq_pd(by, _mm_xor_pd(ny, signBit)), _mm_cmpeq_pd(bz, _mm_xor_pd(nz, signBit))));
+            const uint32_t exact = static_cast<uint32_t>(_mm_movemask_pd(exactMask)) & withBasis & pass;
+            needScalar |= (pass & ~exact) << base;
+            if (!exact) continue;
+
+            const __m128d buMin = _mm_xor_pd(load(t.uMax), signBit);
+            const __m128d buMax = _mm_xor_pd(load(t.uMin), signBit);
+            const __m128d bvMin = load(t.vMin), bvMax = load(t.vMax);
+            __m128d overlapU = _mm_max_pd(_mm_sub_pd(_mm_min_pd(buMax, auMax), _mm_max_pd(buMin, auMin)), zero);
+            __m128d overlapV = _mm_max_pd(_mm_sub_pd(_mm_min_pd(bvMax, avMax), _mm_max_pd(bvMin, avMin)), zero);
+            __m128d covered = _mm_cmpge_pd(_mm_div_pd(_mm_mul_pd(overlapU, overlapV), area), ratio);
+            covered = _mm_andnot_pd(_mm_or_pd(_mm_cmple_pd(overlapU, zero), _mm_cmple_pd(overlapV, zero)), covered);
+
+            const uint32_t covering = static_cast<uint32_t>(_mm_movemask_pd(covered)) & exact;
+            const uint32_t overlapping = static_cast<uint32_t>(_mm_movemask_pd(
+                _mm_and_pd(_mm_cmpgt_pd(overlapU, zero), _mm_cmpgt_pd(overlapV, zero))));
+            stats.rejectedRect += PopCount(exact & ~covering);
+            hit |= covering << base;
+            partial |= (exact & ~covering & overlapping) << base;
+        }
+        return hit;
+    }
+
+    // Masked form with every lane on: same loads, but GCC's header for the
+    // plain gather reads an undefined source register (-Wmaybe-uninitialized)
+    VMF_TARGET_AVX2
+    inline __m256d Gather4(const std::vector<double>& a, __m128i rows)
+    {
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), a.data(), rows,
+            _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+    }
+
+    VMF_TARGET_AVX2
+    uint32_t TestAvx2(const FaceTable& t, const Query& q, const uint32_t* rows, int count, uint32_t& needScalar,
+        uint32_t& partial, FaceKernel::Stats& stats)
+    {
+        const __m256d nx = _mm256_set1_pd(q.nx), ny = _mm256_set1_pd(q.ny), nz = _mm256_set1_pd(q.nz);
+        const __m256d cx = _mm256_set1_pd(q.cx), cy = _mm256_set1_pd(q.cy), cz = _mm256_set1_pd(q.cz);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d signBit = _mm256_set1_pd(-0.0);
+        const __m256d limit = _mm256_set1_pd(q.normalLimit);
+        const __m256d eps = _mm256_set1_pd(q.planeEps);
+        const __m256d planeA = _mm256_set1_pd(q.planeA);
+        const __m256d auMin = _mm256_set1_pd(q.AuMin), auMax = _mm256_set1_pd(q.AuMax);
+        const __m256d avMin = _mm256_set1_pd(q.AvMin), avMax = _mm256_set1_pd(q.AvMax);
+        const __m256d area = _mm256_set1_pd(q.areaA), ratio = _mm256_set1_pd(q.coverRatio);
+
+        uint32_t hit = 0;
+        for (int base = 0; base < count; base += 4) {
+            const int lanes = std::min(4, count - base);
+            alignas(16) int32_t idx[4];
+            for (int k = 0; k < 4; ++k) idx[k] = static_cast<int32_t>(rows[base + std::min(k, lanes - 1)]);
+            const __m128i vi = _mm_load_si128(reinterpret_cast<const __m128i*>(idx));
+
+            uint32_t usable, withBasis;
+            LaneFlags(t, q, rows + base, lanes, usable, withBasis);
+            stats.tested += lanes;
+            stats.rejectedUnusable += lanes - PopCount(usable);
+            if (!usable) continue;
+
+            const __m256d bx = Gather4(t.nx, vi), by = Gather4(t.ny, vi), bz = Gather4(t.nz, vi);
+            const __m256d px = Gather4(t.cx, vi), py = Gather4(t.cy, vi), pz = Gather4(t.cz, vi);
+
+            __m256d normalDot = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, bx), _mm256_mul_pd(ny, by)), _mm256_mul_pd(nz, bz));
+            const uint32_t rejectNormal = _mm256_movemask_pd(_mm256_cmp_pd(normalDot, limit, _CMP_GT_OQ));
+
+            __m256d dd = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(px, cx), nx), _mm256_mul_pd(_mm256_sub_pd(py, cy), ny)),
+                _mm256_mul_pd(_mm256_sub_pd(pz, cz), nz));
+            const uint32_t rejectPlane = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(signBit, dd), eps, _CMP_GT_OQ));
+            const uint32_t rejectFront = _mm256_movemask_pd(_mm256_cmp_pd(dd, zero, _CMP_LE_OQ));
+
+            __m256d planePosB = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, px), _mm256_mul_pd(ny, py)), _mm256_mul_pd(nz, pz));
+            const uint32_t rejectPlanePos = _mm256_movemask_pd(
+                _mm256_cmp_pd(_mm256_andnot_pd(signBit, _mm256_sub_pd(planePosB, planeA)), eps, _CMP_GT_OQ));
+
+            const uint32_t pass = CountRejections(usable, rejectNormal, rejectPlane, rejectFront, rejectPlanePos, stats);
+            if (!pass) continue;
+
+            __m256d exactMask = _mm256_and_pd(_mm256_cmp_pd(bx, _mm256_xor_pd(nx, signBit), _CMP_EQ_OQ),
+                _mm256_and_pd(_mm256_cmp_pd(by, _mm256_xor_pd(ny, signBit), _CMP_EQ_OQ),
+                    _mm256_cmp_pd(bz, _mm256_xor_pd(nz, signBit), _CMP_EQ_OQ)));
+            const uint32_t exact = static_cast<uint32_t>(_mm256_movemask_pd(exactMask)) & withBasis & pass;
+            needScalar |= (pass & ~exact) << base;
+            if (!exact) continue;
+
+            const __m256d buMin = _mm256_xor_pd(Gather4(t.uMax, vi), signBit);
+            const __m256d buMax = _mm256_xor_pd(Gather4(t.uMin, vi), signBit);
+            const __m256d bvMin = Gather4(t.vMin, vi), bvMax = Gather4(t.vMax, vi);
+            __m256d overlapU = _mm256_max_pd(_mm256_sub_pd(_mm256_min_pd(buMax, auMax), _mm256_max_pd(buMin, auMin)), zero);
+            __m256d overlapV = _mm256_max_pd(_mm256_sub_pd(_mm256_min_pd(bvMax, avMax), _mm256_max_pd(bvMin, avMin)), zero);
+            __m256d covered = _mm256_cmp_pd(_mm256_div_pd(_mm256_mul_pd(overlapU, overlapV), area), ratio, _CMP_GE_OQ);
+            covered = _mm256_andnot_pd(_mm256_or_pd(_mm256_cmp_pd(overlapU, zero, _CMP_LE_OQ),
+                _mm256_cmp_pd(overlapV, zero, _CMP_LE_OQ)), covered);
+
+            const uint32_t covering = static_cast<uint32_t>(_mm256_movemask_pd(covered)) & exact;
+            const uint32_t overlapping = static_cast<uint32_t>(_mm256_movemask_pd(
+                _mm256_and_pd(_mm256_cmp_pd(overlapU, zero, _CMP_GT_OQ), _mm256_cmp_pd(overlapV, zero, _CMP_GT_OQ))));
+            stats.rejectedRect += PopCount(exact & ~covering);
+            hit |= covering << base;
+            partial |= (exact & ~covering & overlapping) << base;
+        }
+        return hit;
+    }
+
+    VMF_TARGET_AVX2
+    inline __m256 Gather8(const std::vector<float>& a, __m256i rows)
+    {
+        return _mm256_i32gather_ps(a.data(), rows, 4);
+    }
+
+    // Float prefilter, the 8 candidates of a batch in one op
+    VMF_TARGET_AVX2
+    uint32_t PrefilterAvx2(const FaceTable& t, const CompactFaceRows<float>& c, const Query& q,
+        const uint32_t* rows, int count, uint32_t& partial, FaceKernel::Stats& stats)
+    {
+        const uint32_t opposite = c.oppositeId[q.row];
+        alignas(32) int32_t idx[8];
+        uint32_t passthrough = 0, usable = 0, exactCandidate = 0;
+        for (int k = 0; k < 8; ++k) idx[k] = static_cast<int32_t>(rows[std::min(k, count - 1)]);
+        for (int k = 0; k < count; ++k) {
+            const uint32_t r = rows[k];
+            if (c.normalId[r] == CompactFaceRows<float>::NO_ID) { passthrough |= 1u << k; continue; }
+            if ((t.flags[r] & USABLE) == USABLE && t.brushId[r] != q.brushId) usable |= 1u << k;
+            if ((t.flags[r] & FaceTable::HAS_BASIS) && opposite != CompactFaceRows<float>::NO_ID && c.normalId[r] == opposite)
+                exactCandidate |= 1u << k;
+        }
+        const uint32_t checked = ((1u << count) - 1) & ~passthrough;
+        stats.tested += PopCount(checked & ~usable);
+        stats.rejectedUnusable += PopCount(checked & ~usable);
+        if (!usable) return passthrough;
+
+        const __m256i vi = _mm256_load_si256(reinterpret_cast<const __m256i*>(idx));
+        const __m256 signBit = _mm256_set1_ps(-0.0f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 nx = _mm256_set1_ps(static_cast<float>(q.nx));
+        const __m256 ny = _mm256_set1_ps(static_cast<float>(q.ny));
+        const __m256 nz = _mm256_set1_ps(static_cast<float>(q.nz));
+
+        const __m256 bx = Gather8(c.nx, vi), by = Gather8(c.ny, vi), bz = Gather8(c.nz, vi);
+        const __m256 normalDot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, bx), _mm256_mul_ps(ny, by)), _mm256_mul_ps(nz, bz));
+        const uint32_t rejectNormal = _mm256_movemask_ps(_mm256_cmp_ps(normalDot,
+            _mm256_set1_ps(static_cast<float>(q.normalLimit + q.slackNormal)), _CMP_GT_OQ));
+
+        const __m256 dx = _mm256_sub_ps(Gather8(c.cx, vi), _mm256_set1_ps(static_cast<float>(q.cx)));
+        const __m256 dy = _mm256_sub_ps(Gather8(c.cy, vi), _mm256_set1_ps(static_cast<float>(q.cy)));
+        const __m256 dz = _mm256_sub_ps(Gather8(c.cz, vi), _mm256_set1_ps(static_cast<float>(q.cz)));
+        const __m256 dd = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, nx), _mm256_mul_ps(dy, ny)), _mm256_mul_ps(dz, nz));
+        const __m256 l1 = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(signBit, dx), _mm256_andnot_ps(signBit, dy)),
+            _mm256_andnot_ps(signBit, dz));
+        const __m256 slack = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(q.slackPlane)),
+            _mm256_mul_ps(_mm256_set1_ps(static_cast<float>(q.slackPlanePerUnit)), l1));
+        const uint32_t rejectPlane = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(signBit, dd),
+            _mm256_add_ps(_mm256_set1_ps(static_cast<float>(q.planeEps)), slack), _CMP_GT_OQ));
+        const uint32_t rejectFront = _mm256_movemask_ps(_mm256_cmp_ps(dd, _mm256_xor_ps(slack, signBit), _CMP_LE_OQ));
+
+        uint32_t live = usable;
+        stats.tested += PopCount(usable);
+        stats.rejectedNormal += PopCount(live & rejectNormal); live &= ~rejectNormal;
+        stats.rejectedPlane += PopCount(live & rejectPlane);   live &= ~rejectPlane;
+        stats.rejectedFront += PopCount(live & rejectFront);   live &= ~rejectFront;
+
+        const uint32_t exact = live & exactCandidate;
+        if (exact) {
+            const __m256 rect = _mm256_set1_ps(static_cast<float>(q.slackRect));
+            const __m256 buMin = _mm256_xor_ps(Gather8(c.uMax, vi), signBit);
+            const __m256 buMax = _mm256_xor_ps(Gather8(c.uMin, vi), signBit);
+            const __m256 overlapU = _mm256_add_ps(_mm256_sub_ps(_mm256_min_ps(buMax, _mm256_set1_ps(static_cast<float>(q.AuMax))),
+                _mm256_max_ps(buMin, _mm256_set1_ps(static_cast<float>(q.AuMin)))), rect);
+            const __m256 overlapV = _mm256_add_ps(_mm256_sub_ps(_mm256_min_ps(Gather8(c.vMax, vi), _mm256_set1_ps(static_cast<float>(q.AvMax))),
+                _mm256_max_ps(Gather8(c.vMin, vi), _mm256_set1_ps(static_cast<float>(q.AvMin)))), rect);
+            // Products and the limit rounded in float: 1e-5 covers both
+            const __m256 limit = _mm256_set1_ps(static_cast<float>(q.coverRatio * q.areaA * (1.0 - 1e-5)));
+            const __m256 tooSmall = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(overlapU, zero, _CMP_LE_OQ), _mm256_cmp_ps(overlapV, zero, _CMP_LE_OQ)),
+                _mm256_cmp_ps(_mm256_mul_ps(overlapU, overlapV), limit, _CMP_LT_OQ));
+            const uint32_t rejectRect = static_cast<uint32_t>(_mm256_movemask_ps(tooSmall)) & exact;
+            const uint32_t apart = static_cast<uint32_t>(_mm256_movemask_ps(
+                _mm256_or_ps(_mm256_cmp_ps(overlapU, zero, _CMP_LE_OQ), _mm256_cmp_ps(overlapV, zero, _CMP_LE_OQ))));
+            stats.rejectedRect += PopCount(rejectRect);
+            partial |= rejectRect & ~apart;
+            live &= ~rejectRect;
+        }
+
+        // Left for TestBatch, which counts them
+        stats.tested -= PopCount(live);
+        return live | passthrough;
+    }
+
+    bool CpuHasAvx2()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx) return false;
+        if ((_xgetbv(0) & 6) != 6) return false;    // OS saves the YMM registers
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+}
+
+FaceKernel::Stats& FaceKernel::Stats::operator+=(const Stats& o)
+{
+    tested += o.tested;
+    rejectedUnusable += o.rejectedUnusable;
+    rejectedNormal += o.rejectedNormal;
+    rejectedPlane += o.rejectedPlane;
+    rejectedFront += o.rejectedFront;
+    rejectedPlanePos += o.rejectedPlanePos;
+    rejectedRect += o.rejectedRect;
+    return *this;
+}
+
+FaceKernel::Isa FaceKernel::Detect()
+{
+    static const Isa isa = [] {
+        Isa best = Isa::Scalar;
+#ifdef VMF_X86
+        best = CpuHasAvx2() ? Isa::AVX2 : Isa::SSE2;
+#endif
+        // VMFOPT_SIMD=scalar|sse2 forces a lower level (comparisons, debugging)
+        if (const char* env = std::getenv("VMFOPT_SIMD")) {
+            if (std::strcmp(env, "scalar") == 0) best = Isa::Scalar;
+            else if (std::strcmp(env, "sse2") == 0 && best == Isa::AVX2) best = Isa::SSE2;
+        }
+        return best;
+    }();
+    return isa;
+}
+
+const char* FaceKernel::Name(Isa isa)
+{
+    switch (isa) {
+    case Isa::AVX2: return "AVX2";
+    case Isa::SSE2: return "SSE2";
+    default: return "scalar";
+    }
+}
+
+uint32_t FaceKernel::TestBatch(Isa isa, const FaceTable& table, const Query& q,
+    const uint32_t* rows, int count, uint32_t& needScalar, uint32_t& partial, Stats& stats)
+{
+    needScalar = partial = 0;
+    if (count <= 0) return 0;
+#ifdef VMF_X86
+    if (isa == Isa::AVX2) return TestAvx2(table, q, rows, count, needScalar, partial, stats);
+    if (isa == Isa::SSE2) return TestSse2(table, q, rows, count, needScalar, partial, stats);
+#endif
+    return TestScalar(table, q, rows, count, needScalar, partial, stats);
+}
+
+template<typename T>
+uint32_t FaceKernel::Prefilter(Isa isa, const FaceTable& table, const CompactFaceRows<T>& compact, const Query& q,
+    const uint32_t* rows, int count, uint32_t& partial, Stats& stats)
+{
+    partial = 0;
+    if (count <= 0) return 0;
+#ifdef VMF_X86
+    if constexpr (std::is_same_v<T, float>) {
+        if (isa == Isa::AVX2) return PrefilterAvx2(table, compact, q, rows, count, partial, stats);
+    }
+#endif
+    return PrefilterScalar(table, compact, q, rows, count, partial, stats);
+}
+
+template uint32_t FaceKernel::Prefilter<float>(Isa, const FaceTable&, const CompactFaceRows<float>&, const Query&,
+    const uint32_t*, int, uint32_t&, Stats&);
+template uint32_t FaceKernel::Prefilter<Fixed32>(Isa, const FaceTable&, const CompactFaceRows<Fixed32>&, const Query&,
+    const uint32_t*, int, uint32_t&, Stats&);
@@ -0,0 +1,79 @@
+﻿#pragma once
+#include "FaceTable.h"
+#include <cstdint>
+
+// Batched "does fB cover fA" test over FaceTable rows.
+//
+// Runs the normal, plane, front and brush predicates of the visibility pass
+// on up to MAX_BATCH candidates at once (AVX2: 4 doubles per op, SSE2: 2).
+// For candidates whose normal is exactly -nA, the same pass bounds the coverage
+// with the overlap of the winding rectangles: their extents in fA's basis are
+// their own extents mirrored on u, bit for bit. Polygons overlap no more than
+// their rectangles, so a lane that fails this bound can never cover fA; the
+// ones that pass still need the exact polygon test. Other candidates that
+// pass every predicate are returned in a separate mask for the caller's
+// scalar test. Exact opposites whose rectangle overlaps fA's but is too small
+// to cover it alone are reported too (partial occluders, see CoverageMask).
+namespace FaceKernel {
+    enum class Isa { Scalar, SSE2, AVX2 };
+
+    constexpr int MAX_BATCH = 8;
+
+    // fA, prepared like the scalar pass does
+    struct Query {
+        double nx, ny, nz;              // unit normal
+        double cx, cy, cz;              // center
+        double planeA;                  // Dot(n, center)
+        double AuMin, AuMax, AvMin, AvMax;  // winding rectangle
+        double areaA;                   // winding area
+        int32_t brushId;
+
+        double normalLimit;             // -(1 - NORMAL_EPS)
+        double planeEps;
+        double coverRatio;              // bound on the rectangle overlap
+
+        // Prefilter only: fA's row in the compact rows, and how far its
+        // rounding can move each predicate (see Visibility.cpp)
+        uint32_t row;
+        double slackNormal;             // on the normal dot product
+        double slackPlane;              // on the plane distance: slackPlane + slackPlanePerUnit * |delta|_1
+        double slackPlanePerUnit;
+        double slackRect;               // on each side of the rectangle overlap
+    };
+
+    // Candidates seen by TestBatch and the first predicate that rejected them
+    struct Stats {
+        uint64_t tested = 0;
+        uint64_t rejectedUnusable = 0;  // same brush, not an occluder, no normal or no winding
+        uint64_t rejectedNormal = 0;
+        uint64_t rejectedPlane = 0;
+        uint64_t rejectedFront = 0;
+        uint64_t rejectedPlanePos = 0;
+        uint64_t rejectedRect = 0;      // rectangle overlap below the ratio
+
+        Stats& operator+=(const Stats& o);
+    };
+
+    // Best instruction set supported by this CPU (cached)
+    Isa Detect();
+    const char* Name(Isa isa);
+
+    // Tests rows[0..count) (count <= MAX_BATCH). Returns a bitmask of the
+    // candidates that may cover fA and need the polygon test; candidates that
+    // need the whole scalar test are set in needScalar, partial occluders in
+    // partial.
+    uint32_t TestBatch(Isa isa, const FaceTable& table, const Query& q,
+        const uint32_t* rows, int count, uint32_t& needScalar, uint32_t& partial, Stats& stats);
+
+    // Reduced-precision pass in front of TestBatch: the same predicates on
+    // the compact rows (the plane position one excepted, it repeats the plane
+    // test), each widened by the query's slack so that a candidate is only
+    // rejected if TestBatch would reject it too. Rejections are counted in
+    // stats like TestBatch does. Returns the bitmask of rows[0..count) left
+    // for TestBatch; rows rejected on the rectangle that may still overlap
+    // fA are set in partial (to check in double). AVX2 for float (8 lanes
+    // per op), scalar otherwise.
+    template<typename T>
+    uint32_t Prefilter(Isa isa, const FaceTable& table, const CompactFaceRows<T>& compact, const Query& q,
+        const uint32_t* rows, int count, uint32_t& partial, Stats& stats);
+}
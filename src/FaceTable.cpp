@@ -0,0 +1,142 @@
+﻿#include "FaceTable.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+void FaceTable::Build(const std::vector<Brush>& brushes)
+{
+    count = 0;
+    for (const Brush& b : brushes) count += b.faces.size();
+
+    for (auto* a : { &nx, &ny, &nz, &cx, &cy, &cz, &plane, &uMin, &uMax, &vMin, &vMax, &radius, &area }) {
+        a->assign(count, 0.0);
+    }
+    u.assign(count, Vec3());
+    v.assign(count, Vec3());
+    centroid.assign(count, Vec3());
+    brushId.assign(count, -1);
+    brush.assign(count, -1);
+    face.assign(count, -1);
+    flags.assign(count, 0);
+    brushFirstRow.assign(brushes.size() + 1, 0);
+    // Brushes without any role are never read: no polygon, no flag
+    windings = WindingPool();
+    for (const Brush& b : brushes) {
+        if (b.roles) windings.AddBrush(b);
+        else windings.AddEmpty(b.faces.size());
+    }
+    projected.assign(windings.vertices.size(), Winding::Point2{ 0.0, 0.0 });
+
+    uint32_t row = 0;
+    for (size_t bi = 0; bi < brushes.size(); ++bi) {
+        brushFirstRow[bi] = row;
+        const Brush& b = brushes[bi];
+        for (size_t fi = 0; fi < b.faces.size(); ++fi, ++row) {
+            const Face& f = b.faces[fi];
+            nx[row] = f.normal.x; ny[row] = f.normal.y; nz[row] = f.normal.z;
+            cx[row] = f.center.x; cy[row] = f.center.y; cz[row] = f.center.z;
+            plane[row] = Dot(f.normal, f.center);
+            brushId[row] = b.id;
+            brush[row] = static_cast<int32_t>(bi);
+            face[row] = static_cast<int32_t>(fi);
+
+            uint8_t fl = 0;
+            if (b.roles & ROLE_OCCLUDER) fl |= OCCLUDER;
+            if (b.roles & ROLE_RECEIVER) fl |= RECEIVER;
+            if (Length(f.normal) >= 1e-4) fl |= VALID_NORMAL;
+            if ((fl & VALID_NORMAL) && BuildBasis(f.normal, u[row], v[row])) fl |= HAS_BASIS;
+
+            const uint32_t n = windings.count[row];
+            if ((fl & HAS_BASIS) && n >= 3) {
+                const Vec3* poly = windings.Polygon(row);
+                ProjectExtents(poly, n, u[row], v[row], uMin[row], uMax[row], vMin[row], vMax[row]);
+                for (uint32_t i = 0; i < n; ++i) radius[row] = std::max(radius[row], Length(poly[i] - f.center));
+
+                Winding::Point2* flat = projected.data() + windings.first[row];
+                Winding::Project(poly, n, u[row], v[row], flat);
+
+                // Area (same sum as Winding::Area) and centroid of the 2D
+                // polygon, brought back onto the plane
+                double gu = 0.0, gv = 0.0, twice = 0.0;
+                for (uint32_t i = 0; i < n; ++i) {
+                    const Winding::Point2& a = flat[i];
+                    const Winding::Point2& b = flat[i + 1 < n ? i + 1 : 0];
+                    double cross = a.u * b.v - b.u * a.v;
+                    gu += (a.u + b.u) * cross;
+                    gv += (a.v + b.v) * cross;
+                    twice += cross;
+                }
+                area[row] = std::abs(twice) * 0.5;
+                centroid[row] = u[row] * (gu / (3.0 * twice)) + v[row] * (gv / (3.0 * twice)) + f.normal * plane[row];
+                fl |= HAS_WINDING;
+            }
+            flags[row] = fl;
+        }
+    }
+    brushFirstRow[brushes.size()] = row;
+}
+
+namespace {
+    // Bits of a double normal, -0.0 folded into 0.0 (they compare equal)
+    struct NormalKey {
+        uint64_t bits[3];
+        bool operator==(const NormalKey& o) const {
+            return bits[0] == o.bits[0] && bits[1] == o.bits[1] && bits[2] == o.bits[2];
+        }
+    };
+
+    struct NormalKeyHash {
+        size_t operator()(const NormalKey& k) const {
+            uint64_t h = k.bits[0] * 0x9E3779B97F4A7C15ull;
+            h = (h ^ k.bits[1]) * 0xFF51AFD7ED558CCDull;
+            h = (h ^ k.bits[2]) * 0xC4CEB9FE1A85EC53ull;
+            return static_cast<size_t>(h ^ (h >> 32));
+        }
+    };
+
+    NormalKey KeyOf(double x, double y, double z) {
+        const double v[3] = { x + 0.0, y + 0.0, z + 0.0 };
+        NormalKey k;
+        std::memcpy(k.bits, v, sizeof(v));
+        return k;
+    }
+}
+
+template<typename T>
+void CompactFaceRows<T>::Build(const FaceTable& table)
+{
+    const size_t n = table.count;
+    for (auto* a : { &nx, &ny, &nz, &cx, &cy, &cz, &uMin, &uMax, &vMin, &vMax }) a->assign(n, T());
+    normalId.assign(n, NO_ID);
+    oppositeId.assign(n, NO_ID);
+    magnitude = 0.0;
+
+    std::unordered_map<NormalKey, uint32_t, NormalKeyHash> ids;
+    for (size_t r = 0; r < n; ++r) {
+        const double values[] = { table.nx[r], table.ny[r], table.nz[r], table.cx[r], table.cy[r], table.cz[r],
+                                  table.uMin[r], table.uMax[r], table.vMin[r], table.vMax[r] };
+        double largest = 0.0;
+        bool finite = true;
+        for (double v : values) {
+            finite = finite && std::isfinite(v);
+            largest = std::max(largest, std::abs(v));
+        }
+        if (!finite || largest > ScalarTraits<T>::safeMagnitude) continue;
+        magnitude = std::max(magnitude, largest);
+
+        nx[r] = T(table.nx[r]); ny[r] = T(table.ny[r]); nz[r] = T(table.nz[r]);
+        cx[r] = T(table.cx[r]); cy[r] = T(table.cy[r]); cz[r] = T(table.cz[r]);
+        uMin[r] = T(table.uMin[r]); uMax[r] = T(table.uMax[r]);
+        vMin[r] = T(table.vMin[r]); vMax[r] = T(table.vMax[r]);
+        normalId[r] = ids.emplace(KeyOf(table.nx[r], table.ny[r], table.nz[r]), static_cast<uint32_t>(ids.size())).first->second;
+    }
+    for (size_t r = 0; r < n; ++r) {
+        if (normalId[r] == NO_ID) continue;
+        auto it = ids.find(KeyOf(-table.nx[r], -table.ny[r], -table.nz[r]));
+        if (it != ids.end()) oppositeId[r] = it->second;
+    }
+}
+
+template struct CompactFaceRows<float>;
+template struct CompactFaceRows<Fixed32>;
@@ -0,0 +1,72 @@
+﻿#pragma once
+#include "Geometry.h"
+#include "Scalar.h"
+#include "Winding.h"
+#include <cstdint>
+#include <vector>
+
+// Flat structure-of-arrays copy of every face of a map, in brush/face order.
+// The visibility kernels read the hot fields (normal, center, plane, own-basis
+// extents) as contiguous arrays instead of striding over Face records.
+// Everything the pass derives from one face alone (basis, projected winding,
+// area, centroid) is computed here once, not per target or per pair.
+struct FaceTable {
+    enum Flags : uint8_t {
+        VALID_NORMAL = 1,   // Length(normal) >= 1e-4
+        HAS_BASIS = 2,      // BuildBasis succeeded
+        HAS_WINDING = 4,    // the side has a polygon, extents are meaningful
+        OCCLUDER = 8,       // ROLE_OCCLUDER of the brush
+        RECEIVER = 16,      // ROLE_RECEIVER of the brush
+    };
+
+    size_t count = 0;
+
+    std::vector<double> nx, ny, nz;          // unit normal
+    std::vector<double> cx, cy, cz;          // center
+    std::vector<double> plane;               // Dot(normal, center)
+    std::vector<double> uMin, uMax, vMin, vMax;  // winding extents in the face's own basis
+    std::vector<double> radius;              // max |p - center| over the winding
+    std::vector<Vec3> u, v;                  // own basis (BuildBasis), if HAS_BASIS
+    std::vector<double> area;                // area of the winding, if HAS_WINDING
+    std::vector<Vec3> centroid;              // centroid of the winding, on the plane
+    std::vector<int32_t> brushId;            // Brush::id
+    std::vector<int32_t> brush;              // index into the brushes vector
+    std::vector<int32_t> face;               // index into Brush::faces
+    std::vector<uint8_t> flags;
+
+    std::vector<uint32_t> brushFirstRow;     // first row of each brush, plus a final sentinel
+
+    WindingPool windings;                    // polygon of every row (none for ignored brushes)
+    std::vector<Winding::Point2> projected;  // the same polygons in their own (u, v), counter-clockwise
+
+    void Build(const std::vector<Brush>& brushes);
+
+    uint32_t Row(int brushIndex, int faceIndex) const {
+        return brushFirstRow[brushIndex] + static_cast<uint32_t>(faceIndex);
+    }
+    Vec3 Normal(uint32_t r) const { return { nx[r], ny[r], nz[r] }; }
+    Vec3 Center(uint32_t r) const { return { cx[r], cy[r], cz[r] }; }
+    const Winding::Point2* Projected(uint32_t r) const { return projected.data() + windings.first[r]; }
+};
+
+// The fields read by the kernel predicates, in a smaller scalar type (float
+// or Fixed32) for the reduced-precision prefilter (FaceKernel::Prefilter):
+// 40 bytes of coordinates per row instead of 80. The exact-normal test of
+// the kernel compares doubles bit for bit, so it is kept exact through ids:
+// rows with the same double normal share a normal id.
+template<typename T>
+struct CompactFaceRows {
+    static constexpr uint32_t NO_ID = 0xFFFFFFFFu;
+
+    std::vector<T> nx, ny, nz;                  // unit normal
+    std::vector<T> cx, cy, cz;                  // center
+    std::vector<T> uMin, uMax, vMin, vMax;      // winding extents in the face's own basis
+    std::vector<uint32_t> normalId;             // NO_ID: not representable, left to the double test
+    std::vector<uint32_t> oppositeId;           // normalId of -normal, NO_ID if no row has it
+    double magnitude = 0;                       // largest |value| stored (rows with an id)
+
+    void Build(const FaceTable& table);
+};
+
+extern template struct CompactFaceRows<float>;
+extern template struct CompactFaceRows<Fixed32>;
@@ -0,0 +1,96 @@
+﻿#include "FileWatcher.h"
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::string DirectoryOf(const std::string& path) {
+        const std::string dir = std::filesystem::path(path).parent_path().string();
+        return dir.empty() ? "." : dir;
+    }
+}
+
+#ifdef _WIN32
+
+FileWatcher::FileWatcher(const std::string& path)
+    : name(std::filesystem::path(path).filename().string())
+{
+    const std::string dir = DirectoryOf(path);
+    HANDLE h = FindFirstChangeNotificationA(dir.c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("Failed to watch directory: " + dir);
+    handle = h;
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (handle) FindCloseChangeNotification(static_cast<HANDLE>(handle));
+}
+
+bool FileWatcher::Wait(unsigned settleMs)
+{
+    // The notification does not say which file changed
+    HANDLE h = static_cast<HANDLE>(handle);
+    if (WaitForSingleObject(h, INFINITE) != WAIT_OBJECT_0) return false;
+    for (;;) {
+        if (!FindNextChangeNotification(h)) return false;
+        const DWORD r = WaitForSingleObject(h, settleMs);
+        if (r == WAIT_TIMEOUT) return true;
+        if (r != WAIT_OBJECT_0) return false;
+    }
+}
+
+#else
+
+FileWatcher::FileWatcher(const std::string& path)
+    : name(std::filesystem::path(path).filename().string())
+{
+    const std::string dir = DirectoryOf(path);
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("Failed to create inotify instance");
+    // Written and closed in place, or renamed over
+    if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        fd = -1;
+        throw std::runtime_error("Failed to watch directory: " + dir);
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (fd >= 0) close(fd);
+}
+
+bool FileWatcher::Wait(unsigned settleMs)
+{
+    // Events of other files (the output is often in the same directory) are
+    // read and dropped
+    alignas(inotify_event) char buffer[4096];
+    bool changed = false;
+    for (;;) {
+        pollfd p{ fd, POLLIN, 0 };
+        const int ready = poll(&p, 1, changed ? static_cast<int>(settleMs) : -1);
+        if (ready < 0) return false;
+        if (ready == 0) return true;
+
+        const ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) return false;
+        for (ssize_t at = 0; at < n;) {
+            const inotify_event* e = reinterpret_cast<const inotify_event*>(buffer + at);
+            if (e->len > 0 && name == e->name) changed = true;
+            at += static_cast<ssize_t>(sizeof(inotify_event) + e->len);
+        }
+    }
+}
+
+#endif
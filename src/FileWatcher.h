@@ -0,0 +1,29 @@
+﻿#pragma once
+#include <string>
+
+// Blocks until a file may have changed: inotify on Linux, directory change
+// notifications on Windows. The directory of the file is watched, not the
+// file itself, so editors saving through a temporary file and a rename are
+// seen too. Wakeups can be spurious (Windows reports any change of the
+// directory): callers compare the file's size and time before reloading.
+// Throws std::runtime_error if the directory cannot be watched.
+class FileWatcher {
+public:
+    explicit FileWatcher(const std::string& path);
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Waits for a change, then for settleMs without further changes (a save
+    // often comes as several writes). False if the watch broke.
+    bool Wait(unsigned settleMs = 50);
+
+private:
+    std::string name;       // file name within the watched directory
+#ifdef _WIN32
+    void* handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -0,0 +1,21 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a, used to key the on-disk caches
+struct Fnv1a {
+    uint64_t h = 1469598103934665603ull;
+    void Add(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= p[i];
+            h *= 1099511628211ull;
+        }
+    }
+    void Add(const Vec3& v) {
+        Add(&v.x, sizeof(double));
+        Add(&v.y, sizeof(double));
+        Add(&v.z, sizeof(double));
+    }
+};
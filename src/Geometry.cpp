@@ -0,0 +1,20 @@
+﻿#include "Geometry.h"
+#include "Winding.h"
+#include <algorithm>
+
+bool Brush::ComputeAABB(const WindingPool& windings, uint32_t firstRow)
+{
+    bool hasVertex = false;
+    for (size_t fi = 0; fi < faces.size(); ++fi) {
+        const uint32_t r = firstRow + static_cast<uint32_t>(fi);
+        const Vec3* poly = windings.Polygon(r);
+        for (uint32_t k = 0; k < windings.count[r]; ++k) {
+            const Vec3& p = poly[k];
+            if (!hasVertex) { min = max = p; hasVertex = true; }
+            min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+            max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+        }
+    }
+    if (!hasVertex) ComputeAABB();
+    return hasVertex;
+}
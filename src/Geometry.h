@@ -2,45 +2,63 @@
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cstdint>
 
-struct Vec3 {
-    double x = 0;
-    double y = 0;
-    double z = 0;
-    Vec3() = default;
-    Vec3(double X, double Y, double Z) : x(X), y(Y), z(Z) {}
+// 3D vector over a scalar type. The parsed geometry (Face, Brush) is in
+// double; the visibility prefilter keeps float or Fixed32 copies of its hot
+// fields (Scalar.h, CompactFaceRows).
+template<typename T>
+struct BasicVec3 {
+    T x{};
+    T y{};
+    T z{};
+    BasicVec3() = default;
+    BasicVec3(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
 
-    Vec3 operator-(const Vec3& o) const { return { x - o.x, y - o.y, z - o.z }; }
-    Vec3 operator+(const Vec3& o) const { return { x + o.x, y + o.y, z + o.z }; }
-    Vec3 operator*(double s) const { return { x * s, y * s, z * s }; }
+    BasicVec3 operator-(const BasicVec3& o) const { return { x - o.x, y - o.y, z - o.z }; }
+    BasicVec3 operator+(const BasicVec3& o) const { return { x + o.x, y + o.y, z + o.z }; }
+    BasicVec3 operator*(T s) const { return { x * s, y * s, z * s }; }
 };
 
-inline double Dot(const Vec3& a, const Vec3& b) {
+using Vec3 = BasicVec3<double>;
+
+template<typename T>
+inline T Dot(const BasicVec3<T>& a, const BasicVec3<T>& b) {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
-inline Vec3 Cross(const Vec3& a, const Vec3& b) {
+template<typename T>
+inline BasicVec3<T> Cross(const BasicVec3<T>& a, const BasicVec3<T>& b) {
     return { a.y * b.z - a.z * b.y,
              a.z * b.x - a.x * b.z,
              a.x * b.y - a.y * b.x };
 }
-inline double Length(const Vec3& a) {
-    return std::sqrt(Dot(a, a));
+template<typename T>
+inline T Length(const BasicVec3<T>& a) {
+    using std::sqrt;
+    return sqrt(Dot(a, a));
 }
-inline Vec3 Normalize(const Vec3& a) {
-    double L = Length(a);
-    if (L == 0) return { 0,0,0 };
+template<typename T>
+inline BasicVec3<T> Normalize(const BasicVec3<T>& a) {
+    T L = Length(a);
+    if (L == T(0)) return { T(0), T(0), T(0) };
     return { a.x / L, a.y / L, a.z / L };
 }
 
 struct Face {
     int id = -1;            // unique face id (sequence)
     int brushID = -1;       // parent brush id
+    int sideId = -1;        // "id" key of the side in the VMF
     Vec3 p1, p2, p3;        // three points defining the face (plane)
     Vec3 center;            // computed center
     Vec3 normal = { 0,0,0 };  // unit normal pointing outwards (computed)
-    std::string material;   // texture name
+    uint32_t material = 0;  // texture name, id in the map's MaterialTable (0 = none)
     bool hidden = false;    // set by visibility pass
 
+    // byte spans in the source VMF, recorded by the parser for the writer
+    int64_t materialOffset = -1;   // first byte of the material value (inside the quotes)
+    int32_t materialLength = 0;    // length of the material value
+    int64_t sideEndOffset = -1;    // the side's closing '}'
+
     // compute center and normal (call after p1,p2,p3 are set)
     void ComputeDerived() {
         center.x = (p1.x + p2.x + p3.x) / 3.0;
@@ -52,23 +70,87 @@ struct Face {
     }
 };
 
+// Bounds of the face centers of a brush (n >= 1). Cheap, but smaller than
+// the solid: the corners of a box are outside.
+inline void FaceBounds(const Face* faces, size_t n, Vec3& min, Vec3& max) {
+    min = max = faces[0].center;
+    for (size_t i = 1; i < n; ++i) {
+        const Vec3& c = faces[i].center;
+        if (c.x < min.x) min.x = c.x;
+        if (c.y < min.y) min.y = c.y;
+        if (c.z < min.z) min.z = c.z;
+
+        if (c.x > max.x) max.x = c.x;
+        if (c.y > max.y) max.y = c.y;
+        if (c.z > max.z) max.z = c.z;
+    }
+}
+
+struct WindingPool;
+
+// What the visibility pass may do with a brush (see EntityPolicy)
+enum BrushRole : uint8_t {
+    ROLE_OCCLUDER = 1,      // its faces may hide other faces
+    ROLE_RECEIVER = 2,      // its faces may be hidden
+};
+
 struct Brush {
     int id = -1;
+    int entity = -1;        // owning entity (index in the parsed entity list), -1 = world
+    int instance = -1;      // instance file it was expanded from (Instances), -1 = the map itself
+    uint8_t roles = ROLE_OCCLUDER | ROLE_RECEIVER;   // 0 = left out of the visibility pass
     std::vector<Face> faces;
     Vec3 min;
     Vec3 max;
 
+    // Face center bounds (FaceBounds), what the parser records
     void ComputeAABB() {
-        if (faces.empty()) return;
-        min = max = faces[0].center;
-        for (const auto& f : faces) {
-            if (f.center.x < min.x) min.x = f.center.x;
-            if (f.center.y < min.y) min.y = f.center.y;
-            if (f.center.z < min.z) min.z = f.center.z;
-
-            if (f.center.x > max.x) max.x = f.center.x;
-            if (f.center.y > max.y) max.y = f.center.y;
-            if (f.center.z > max.z) max.z = f.center.z;
-        }
+        if (!faces.empty()) FaceBounds(faces.data(), faces.size(), min, max);
     }
+
+    // Exact bounds of the solid: every vertex of its side polygons, rows
+    // firstRow.. of windings. Falls back to ComputeAABB() and returns false
+    // when no side has a polygon.
+    bool ComputeAABB(const WindingPool& windings, uint32_t firstRow);
+};
+
+// Top-level "entity" block of the VMF (point or brush entity)
+struct Entity {
+    std::string classname;
+    Vec3 origin;
+    bool hasOrigin = false;
+    Vec3 angles;            // "angles": pitch yaw roll in degrees, 0 0 0 when missing
+    std::string file;       // "file" of a func_instance: the instance VMF, as written
 };
+
+// Orthonormal basis (u, v) of the plane with the given unit normal.
+// False if the normal is degenerate.
+inline bool BuildBasis(const Vec3& normal, Vec3& u, Vec3& v) {
+    Vec3 ref = { 0.0, 0.0, 1.0 };
+    Vec3 tangent = Cross(normal, ref);
+    if (Length(tangent) < 1e-4) {
+        ref = { 0.0, 1.0, 0.0 };
+        tangent = Cross(normal, ref);
+    }
+    double lenT = Length(tangent);
+    if (lenT < 1e-4) return false;
+    u = tangent * (1.0 / lenT);
+    v = Normalize(Cross(normal, u));
+    return Length(v) >= 1e-4;
+}
+
+// 2D bounding rectangle of a polygon (n >= 1 points) in the (u, v) basis
+inline void ProjectExtents(const Vec3* poly, size_t n, const Vec3& u, const Vec3& v,
+    double& uMin, double& uMax, double& vMin, double& vMax)
+{
+    uMin = uMax = Dot(poly[0], u);
+    vMin = vMax = Dot(poly[0], v);
+    for (size_t i = 1; i < n; ++i) {
+        double pu = Dot(poly[i], u);
+        double pv = Dot(poly[i], v);
+        if (pu < uMin) uMin = pu;
+        if (pu > uMax) uMax = pu;
+        if (pv < vMin) vMin = pv;
+        if (pv > vMax) vMax = pv;
+    }
+}
@@ -0,0 +1,320 @@
+﻿#include "GeometryCache.h"
+#include "Fnv1a.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const char GEOMETRY_MAGIC[8] = { 'V', 'M', 'F', 'G', 'E', 'O', 'M', 'C' };
+    const uint32_t GEOMETRY_VERSION = 2;
+    const size_t SAMPLE_BYTES = 64 * 1024;     // hashed at each end of the source
+
+    // File layout (native endianness, every section a multiple of 8 bytes):
+    //   header
+    //   brushCount  x BrushRecord
+    //   faceCount   x FaceRecord
+    //   entityCount x EntityRecord
+    //   stringCount x StringRecord   (materials by id, then entity classnames and files)
+    //   stringBytes bytes of text, zero-padded to a multiple of 8
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+        uint64_t brushCount;
+        uint64_t faceCount;
+        uint64_t entityCount;
+        uint64_t materialCount;
+        uint64_t stringCount;
+        uint64_t stringBytes;
+    };
+
+    struct BrushRecord {
+        int32_t id;
+        int32_t entity;
+        uint32_t firstFace;
+        uint32_t faceCount;
+        double min[3];
+        double max[3];
+    };
+
+    // Center and normal are derived from the points again on load
+    struct FaceRecord {
+        int32_t id;
+        int32_t brushId;
+        int32_t sideId;
+        uint32_t material;
+        double points[9];
+        int64_t materialOffset;
+        int64_t sideEndOffset;
+        int32_t materialLength;
+        int32_t reserved;
+    };
+
+    struct EntityRecord {
+        uint32_t classname;     // string index
+        uint32_t hasOrigin;
+        uint32_t file;          // string index
+        uint32_t reserved;
+        double origin[3];
+        double angles[3];
+    };
+
+    struct StringRecord {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    struct SourceStamp {
+        uint64_t size = 0;
+        int64_t time = 0;
+        uint64_t hash = 0;
+    };
+
+    uint64_t Pad8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+    bool StampOf(const std::string& path, SourceStamp& out) {
+        std::error_code ec;
+        const uintmax_t size = fs::file_size(path, ec);
+        if (ec) return false;
+        const auto time = fs::last_write_time(path, ec);
+        if (ec) return false;
+
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) return false;
+        std::vector<char> buffer(static_cast<size_t>(std::min<uintmax_t>(size, SAMPLE_BYTES)));
+        Fnv1a h;
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        h.Add(buffer.data(), static_cast<size_t>(in.gcount()));
+        if (size > SAMPLE_BYTES) {
+            in.seekg(static_cast<std::streamoff>(size - std::min<uintmax_t>(size - SAMPLE_BYTES, SAMPLE_BYTES)));
+            in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            h.Add(buffer.data(), static_cast<size_t>(in.gcount()));
+        }
+
+        out.size = static_cast<uint64_t>(size);
+        out.time = static_cast<int64_t>(time.time_since_epoch().count());
+        out.hash = h.h;
+        return true;
+    }
+
+    template<typename T>
+    void WriteRecord(std::ofstream& out, const T& r) {
+        out.write(reinterpret_cast<const char*>(&r), sizeof(T));
+    }
+}
+
+std::string GeometryCache::CachePathFor(const std::string& outputPath)
+{
+    return outputPath + ".vgeo";
+}
+
+bool GeometryCache::Load(const std::string& cachePath, const std::string& sourcePath, ParsedMap& map)
+{
+    Profiler::Timer timer("geocache.load");
+    map = ParsedMap();
+
+    SourceStamp stamp;
+    if (!StampOf(sourcePath, stamp)) return false;
+
+    MappedFile file;
+    try {
+        file.Open(cachePath);
+    }
+    catch (const std::runtime_error&) {
+        return false;
+    }
+    if (file.Size() < sizeof(Header)) return false;
+
+    Header h;
+    std::memcpy(&h, file.Data(), sizeof(h));
+    if (std::memcmp(h.magic, GEOMETRY_MAGIC, sizeof(GEOMETRY_MAGIC)) != 0 || h.version != GEOMETRY_VERSION) return false;
+    if (h.sourceSize != stamp.size || h.sourceTime != stamp.time || h.sourceHash != stamp.hash) return false;
+
+    const uint64_t limit = 1ull << 32;
+    if (h.brushCount >= limit || h.faceCount >= limit || h.entityCount >= limit || h.stringCount >= limit
+        || h.materialCount == 0 || h.materialCount > h.stringCount || h.stringBytes >= limit) return false;
+    const uint64_t expected = sizeof(Header) + h.brushCount * sizeof(BrushRecord) + h.faceCount * sizeof(FaceRecord)
+        + h.entityCount * sizeof(EntityRecord) + h.stringCount * sizeof(StringRecord) + Pad8(h.stringBytes);
+    if (expected != file.Size()) return false;
+
+    // The mapping is page-aligned and every section keeps 8-byte alignment
+    const char* p = file.Data() + sizeof(Header);
+    const BrushRecord* brushes = reinterpret_cast<const BrushRecord*>(p);
+    p += h.brushCount * sizeof(BrushRecord);
+    const FaceRecord* faces = reinterpret_cast<const FaceRecord*>(p);
+    p += h.faceCount * sizeof(FaceRecord);
+    const EntityRecord* entities = reinterpret_cast<const EntityRecord*>(p);
+    p += h.entityCount * sizeof(EntityRecord);
+    const StringRecord* strings = reinterpret_cast<const StringRecord*>(p);
+    p += h.stringCount * sizeof(StringRecord);
+    const char* text = p;
+
+    for (uint64_t i = 0; i < h.stringCount; ++i) {
+        if (strings[i].offset > h.stringBytes || strings[i].length > h.stringBytes - strings[i].offset) return false;
+    }
+    auto stringAt = [&](uint64_t i) {
+        return std::string_view(text + strings[i].offset, static_cast<size_t>(strings[i].length));
+    };
+
+    // Interning in id order gives the same ids back
+    if (!stringAt(0).empty()) return false;
+    for (uint64_t i = 1; i < h.materialCount; ++i) {
+        if (map.materials.Intern(stringAt(i)) != i) {
+            map = ParsedMap();
+            return false;
+        }
+    }
+
+    map.brushes.resize(static_cast<size_t>(h.brushCount));
+    for (size_t i = 0; i < map.brushes.size(); ++i) {
+        const BrushRecord& r = brushes[i];
+        if (r.firstFace > h.faceCount || r.faceCount > h.faceCount - r.firstFace
+            || r.entity < -1 || r.entity >= static_cast<int64_t>(h.entityCount)) {
+            map = ParsedMap();
+            return false;
+        }
+        ParsedMap::BrushRange& b = map.brushes[i];
+        b.id = r.id;
+        b.entity = r.entity;
+        b.firstFace = r.firstFace;
+        b.faceCount = r.faceCount;
+        b.min = { r.min[0], r.min[1], r.min[2] };
+        b.max = { r.max[0], r.max[1], r.max[2] };
+    }
+
+    map.faces.resize(static_cast<size_t>(h.faceCount));
+    for (size_t i = 0; i < map.faces.size(); ++i) {
+        const FaceRecord& r = faces[i];
+        if (r.material >= h.materialCount) {
+            map = ParsedMap();
+            return false;
+        }
+        Face& f = map.faces[i];
+        f.id = r.id;
+        f.brushID = r.brushId;
+        f.sideId = r.sideId;
+        f.material = r.material;
+        f.p1 = { r.points[0], r.points[1], r.points[2] };
+        f.p2 = { r.points[3], r.points[4], r.points[5] };
+        f.p3 = { r.points[6], r.points[7], r.points[8] };
+        f.ComputeDerived();
+        f.materialOffset = r.materialOffset;
+        f.materialLength = r.materialLength;
+        f.sideEndOffset = r.sideEndOffset;
+    }
+
+    map.entities.resize(static_cast<size_t>(h.entityCount));
+    for (size_t i = 0; i < map.entities.size(); ++i) {
+        const EntityRecord& r = entities[i];
+        if (r.classname >= h.stringCount || r.file >= h.stringCount) {
+            map = ParsedMap();
+            return false;
+        }
+        Entity& e = map.entities[i];
+        e.classname = std::string(stringAt(r.classname));
+        e.hasOrigin = r.hasOrigin != 0;
+        e.origin = { r.origin[0], r.origin[1], r.origin[2] };
+        e.angles = { r.angles[0], r.angles[1], r.angles[2] };
+        e.file = std::string(stringAt(r.file));
+    }
+
+    Profiler::Add("bytes_read", file.Size());
+    Profiler::Add("brushes", map.brushes.size());
+    Profiler::Add("sides", map.faces.size());
+    Profiler::Add("entities", map.entities.size());
+    Profiler::Add("materials", map.materials.Size());
+    return true;
+}
+
+bool GeometryCache::Save(const std::string& cachePath, const std::string& sourcePath, const ParsedMap& map)
+{
+    Profiler::Timer timer("geocache.save");
+    SourceStamp stamp;
+    if (!StampOf(sourcePath, stamp)) return false;
+
+    // Strings: materials by id, then a classname and a file per entity
+    std::vector<StringRecord> strings;
+    std::string text;
+    auto addString = [&](const std::string& s) {
+        strings.push_back({ text.size(), s.size() });
+        text += s;
+        return static_cast<uint32_t>(strings.size() - 1);
+    };
+    for (uint32_t id = 0; id < map.materials.Size(); ++id) addString(map.materials.Name(id));
+
+    std::vector<EntityRecord> entities(map.entities.size());
+    for (size_t i = 0; i < map.entities.size(); ++i) {
+        const Entity& e = map.entities[i];
+        EntityRecord& r = entities[i];
+        r.classname = addString(e.classname);
+        r.hasOrigin = e.hasOrigin ? 1 : 0;
+        r.file = addString(e.file);
+        r.origin[0] = e.origin.x; r.origin[1] = e.origin.y; r.origin[2] = e.origin.z;
+        r.angles[0] = e.angles.x; r.angles[1] = e.angles.y; r.angles[2] = e.angles.z;
+    }
+    text.resize(static_cast<size_t>(Pad8(text.size())), '\0');
+
+    Header h{};
+    std::memcpy(h.magic, GEOMETRY_MAGIC, sizeof(GEOMETRY_MAGIC));
+    h.version = GEOMETRY_VERSION;
+    h.sourceSize = stamp.size;
+    h.sourceTime = stamp.time;
+    h.sourceHash = stamp.hash;
+    h.brushCount = map.brushes.size();
+    h.faceCount = map.faces.size();
+    h.entityCount = map.entities.size();
+    h.materialCount = map.materials.Size();
+    h.stringCount = strings.size();
+    h.stringBytes = text.size();
+
+    std::vector<char> buffer(1 << 20);
+    std::ofstream out;
+    out.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.open(cachePath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return false;
+
+    WriteRecord(out, h);
+    for (const ParsedMap::BrushRange& b : map.brushes) {
+        BrushRecord r{};
+        r.id = b.id;
+        r.entity = b.entity;
+        r.firstFace = b.firstFace;
+        r.faceCount = b.faceCount;
+        r.min[0] = b.min.x; r.min[1] = b.min.y; r.min[2] = b.min.z;
+        r.max[0] = b.max.x; r.max[1] = b.max.y; r.max[2] = b.max.z;
+        WriteRecord(out, r);
+    }
+    for (const Face& f : map.faces) {
+        FaceRecord r{};
+        r.id = f.id;
+        r.brushId = f.brushID;
+        r.sideId = f.sideId;
+        r.material = f.material;
+        const Vec3* points[3] = { &f.p1, &f.p2, &f.p3 };
+        for (int k = 0; k < 3; ++k) {
+            r.points[k * 3 + 0] = points[k]->x;
+            r.points[k * 3 + 1] = points[k]->y;
+            r.points[k * 3 + 2] = points[k]->z;
+        }
+        r.materialOffset = f.materialOffset;
+        r.sideEndOffset = f.sideEndOffset;
+        r.materialLength = f.materialLength;
+        WriteRecord(out, r);
+    }
+    out.write(reinterpret_cast<const char*>(entities.data()), static_cast<std::streamsize>(entities.size() * sizeof(EntityRecord)));
+    out.write(reinterpret_cast<const char*>(strings.data()), static_cast<std::streamsize>(strings.size() * sizeof(StringRecord)));
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+
+    out.close();
+    return !out.fail();
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+#include "ParsedMap.h"
+#include <string>
+
+// On-disk copy of a parsed map, stored next to the output VMF, so that
+// re-runs (e.g. while tuning the visibility thresholds) skip the text parse.
+//
+// The file belongs to one source VMF: its size, modification time and a
+// hash of its first and last 64 KB are kept in the header and checked on
+// load. Brushes, faces (plane points, material id, source byte offsets),
+// entities and the string table are flat arrays read straight from the
+// memory-mapped file.
+class GeometryCache {
+public:
+    // Fills map from the cache if it still matches sourcePath. A missing,
+    // stale or corrupted cache returns false and leaves map empty.
+    static bool Load(const std::string& cachePath, const std::string& sourcePath, ParsedMap& map);
+
+    // Writes map, parsed from sourcePath. False if the file cannot be written.
+    static bool Save(const std::string& cachePath, const std::string& sourcePath, const ParsedMap& map);
+
+    // "<output>.vgeo"
+    static std::string CachePathFor(const std::string& outputPath);
+};
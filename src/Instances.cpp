@@ -0,0 +1,283 @@
+﻿#include "Instances.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "TextHash.h"
+#include "VMFParser.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const int MAX_DEPTH = 16;       // nested placements, past that the file is skipped
+
+    // p -> m p + t
+    struct Transform {
+        double m[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+        Vec3 t;
+
+        Vec3 Apply(const Vec3& p) const {
+            return { m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + t.x,
+                     m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + t.y,
+                     m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + t.z };
+        }
+
+        // This transform applied after local
+        Transform Then(const Transform& local) const {
+            Transform r;
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) r.m[i][j] = m[i][0] * local.m[0][j] + m[i][1] * local.m[1][j] + m[i][2] * local.m[2][j];
+            }
+            r.t = Apply(local.t);
+            return r;
+        }
+    };
+
+    // Placement of a func_instance: rotation by its angles (pitch yaw roll,
+    // the engine's AngleMatrix), then translation to its origin. Entries
+    // within 1e-12 of an integer are snapped, so that multiples of 90
+    // degrees keep integer plane points integer.
+    Transform PlacementOf(const Entity& e) {
+        const double toRadians = 3.14159265358979323846 / 180.0;
+        const double sp = std::sin(e.angles.x * toRadians), cp = std::cos(e.angles.x * toRadians);
+        const double sy = std::sin(e.angles.y * toRadians), cy = std::cos(e.angles.y * toRadians);
+        const double sr = std::sin(e.angles.z * toRadians), cr = std::cos(e.angles.z * toRadians);
+
+        Transform t;
+        t.m[0][0] = cp * cy;
+        t.m[1][0] = cp * sy;
+        t.m[2][0] = -sp;
+        t.m[0][1] = sr * sp * cy - cr * sy;
+        t.m[1][1] = sr * sp * sy + cr * cy;
+        t.m[2][1] = sr * cp;
+        t.m[0][2] = cr * sp * cy + sr * sy;
+        t.m[1][2] = cr * sp * sy - sr * cy;
+        t.m[2][2] = cr * cp;
+        for (auto& row : t.m) {
+            for (double& v : row) {
+                const double r = std::round(v);
+                if (std::abs(v - r) < 1e-12) v = r;
+            }
+        }
+        if (e.hasOrigin) t.t = e.origin;
+        return t;
+    }
+
+    // Instance file named by a "file" key, looked up from dir then from each
+    // of its parents (Hammer writes it relative to the placing VMF or to a
+    // maps/ directory above it). Empty if not found.
+    std::string Resolve(std::string file, const fs::path& dir) {
+        std::replace(file.begin(), file.end(), '\\', '/');
+        const fs::path relative(file);
+        std::error_code error;
+        if (relative.is_absolute()) return fs::is_regular_file(relative, error) ? relative.lexically_normal().string() : "";
+
+        for (fs::path d = dir;; d = d.parent_path()) {
+            const fs::path candidate = (d / relative).lexically_normal();
+            if (fs::is_regular_file(candidate, error)) return candidate.string();
+            if (d.parent_path() == d || d.empty()) break;
+        }
+        return "";
+    }
+
+    class Expander {
+    public:
+        Expander(std::vector<Brush>& brushes, std::vector<Entity>& entities, MaterialTable& materials,
+            Instances::Cache& cache, unsigned threads)
+            : brushes(brushes), entities(entities), materials(materials), cache(cache), threads(threads) {
+            for (const Brush& b : brushes) {
+                for (const Face& f : b.faces) nextFaceId = std::max(nextFaceId, f.id + 1);
+            }
+        }
+
+        // Expands the func_instance entity e of the VMF in dir
+        void Place(const Entity& e, const fs::path& dir, const Transform& parent) {
+            if (e.file.empty()) return;
+            const std::string path = Resolve(e.file, dir);
+            if (path.empty()) {
+                if (missing.insert(e.file).second) std::cerr << "Instances: " << e.file << " not found, skipped.\n";
+                return;
+            }
+            if (std::find(open.begin(), open.end(), path) != open.end() || open.size() >= static_cast<size_t>(MAX_DEPTH)) {
+                if (missing.insert(path).second) std::cerr << "Instances: " << path << " places itself or is nested too deep, skipped.\n";
+                return;
+            }
+            const Loaded* loaded = Load(path);
+            if (!loaded) return;
+
+            const ParsedMap& map = *loaded->map;
+            const Transform transform = parent.Then(PlacementOf(e));
+            out.placements[loaded->file]++;
+
+            // Entities first (brush entities are referenced by index), then
+            // the instances placed inside this one. Angles are left as they
+            // are: the passes only use origins.
+            std::vector<int> entityIndex(map.entities.size(), -1);
+            open.push_back(path);
+            for (size_t i = 0; i < map.entities.size(); ++i) {
+                const Entity& inner = map.entities[i];
+                if (inner.classname == "func_instance") {
+                    Place(inner, fs::path(path).parent_path(), transform);
+                    continue;
+                }
+                entityIndex[i] = static_cast<int>(entities.size());
+                entities.push_back(inner);
+                if (inner.hasOrigin) entities.back().origin = transform.Apply(inner.origin);
+            }
+            open.pop_back();
+
+            for (size_t i = 0; i < map.brushes.size(); ++i) {
+                const ParsedMap::BrushRange& r = map.brushes[i];
+                Brush b;
+                b.id = static_cast<int>(brushes.size());
+                b.entity = r.entity >= 0 ? entityIndex[r.entity] : -1;
+                b.instance = static_cast<int>(loaded->file);
+                b.faces.assign(map.FacesOf(i), map.FacesOf(i) + r.faceCount);
+                for (Face& f : b.faces) {
+                    f.id = nextFaceId++;
+                    f.brushID = b.id;
+                    f.sideId = -1;
+                    f.p1 = transform.Apply(f.p1);
+                    f.p2 = transform.Apply(f.p2);
+                    f.p3 = transform.Apply(f.p3);
+                    f.ComputeDerived();
+                    f.material = loaded->materials[f.material];
+                    // Not in the source text: the writer skips the face
+                    f.materialOffset = -1;
+                    f.materialLength = 0;
+                    f.sideEndOffset = -1;
+                }
+                b.ComputeAABB();
+                brushes.push_back(std::move(b));
+                ++brushCount;
+            }
+        }
+
+        Instances::Expansion out;
+        uint64_t brushCount = 0;
+
+    private:
+        struct Loaded {
+            std::shared_ptr<const ParsedMap> map;
+            uint32_t file = 0;                  // index in out.files
+            std::vector<uint32_t> materials;    // template material id -> id in the map's table
+        };
+
+        // Template of path, read once per map (the file is hashed once too)
+        const Loaded* Load(const std::string& path) {
+            auto it = loaded.find(path);
+            if (it != loaded.end()) return it->second.map ? &it->second : nullptr;
+
+            Loaded& l = loaded[path];
+            l.map = cache.Get(path, threads);
+            if (!l.map) return nullptr;
+            l.file = static_cast<uint32_t>(out.files.size());
+            out.files.push_back(path);
+            out.placements.push_back(0);
+            l.materials.resize(l.map->materials.Size());
+            for (uint32_t id = 0; id < l.materials.size(); ++id) l.materials[id] = materials.Intern(l.map->materials.Name(id));
+            return &l;
+        }
+
+        std::vector<Brush>& brushes;
+        std::vector<Entity>& entities;
+        MaterialTable& materials;
+        Instances::Cache& cache;
+        unsigned threads;
+        int nextFaceId = 0;
+        std::unordered_map<std::string, Loaded> loaded;
+        std::vector<std::string> open;              // files being expanded, outermost first
+        std::unordered_set<std::string> missing;    // already reported
+    };
+}
+
+std::shared_ptr<const ParsedMap> Instances::Cache::Get(const std::string& path, unsigned threads)
+{
+    MappedFile file;
+    try {
+        file.Open(path);
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Instances: " << e.what() << "\n";
+        return nullptr;
+    }
+    const std::string_view text = file.View();
+    const uint64_t hash = TextHash::Of(text);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = entries[path];
+    if (entry.map && entry.size == text.size() && entry.hash == hash) {
+        Profiler::Add("instance_cache_hits", 1);
+        return entry.map;
+    }
+
+    Profiler::Timer timer("instances.parse");
+    std::cout << "Instances: parsing " << path << "\n";
+    try {
+        // The counters of the map report are the map's own
+        Profiler::Bind unbound(nullptr);
+        entry.map = std::make_shared<const ParsedMap>(VMFParser::ParseText(text, threads));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Instances: " << path << ": " << e.what() << "\n";
+        entries.erase(path);
+        return nullptr;
+    }
+    entry.size = text.size();
+    entry.hash = hash;
+    Profiler::Add("instance_bytes_read", text.size());
+    return entry.map;
+}
+
+Instances::Expansion Instances::Expand(const std::string& mapPath, std::vector<Brush>& brushes,
+    std::vector<Entity>& entities, MaterialTable& materials, Cache& cache, unsigned threads)
+{
+    Profiler::Timer timer("instances");
+    std::error_code error;
+    fs::path dir = fs::absolute(mapPath, error).parent_path();
+    if (error) dir = fs::path(mapPath).parent_path();
+
+    Expander expander(brushes, entities, materials, cache, threads);
+    // Only the placements of the map: Place appends none of its own
+    const size_t count = entities.size();
+    for (size_t i = 0; i < count; ++i) {
+        if (entities[i].classname == "func_instance") expander.Place(Entity(entities[i]), dir, Transform());
+    }
+
+    Expansion& out = expander.out;
+    uint64_t placements = 0;
+    for (uint32_t n : out.placements) placements += n;
+    if (!out.files.empty()) {
+        std::cout << "Instances: " << placements << " placements of " << out.files.size() << " files, "
+            << expander.brushCount << " brushes added.\n";
+    }
+    Profiler::Add("instance_files", out.files.size());
+    Profiler::Add("instance_placements", placements);
+    Profiler::Add("instance_brushes", expander.brushCount);
+    return std::move(out);
+}
+
+void Instances::Report(const std::vector<Brush>& brushes, const Expansion& expansion)
+{
+    if (expansion.files.empty()) return;
+    std::vector<uint64_t> faces(expansion.files.size(), 0), hidden(expansion.files.size(), 0);
+    for (const Brush& b : brushes) {
+        if (b.instance < 0) continue;
+        faces[b.instance] += b.faces.size();
+        for (const Face& f : b.faces) hidden[b.instance] += f.hidden ? 1 : 0;
+    }
+
+    uint64_t totalFaces = 0, totalHidden = 0;
+    for (size_t i = 0; i < expansion.files.size(); ++i) {
+        std::cout << "Instance " << expansion.files[i] << ": " << hidden[i] << " of " << faces[i] << " faces hidden ("
+            << expansion.placements[i] << " placement(s)).\n";
+        totalFaces += faces[i];
+        totalHidden += hidden[i];
+    }
+    Profiler::Set("instance_faces", totalFaces);
+    Profiler::Set("instance_hidden", totalHidden);
+}
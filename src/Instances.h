@@ -0,0 +1,59 @@
+﻿#pragma once
+#include "Geometry.h"
+#include "ParsedMap.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// func_instance expansion (-instances).
+//
+// Every func_instance of a map places another VMF (its "file" key) at its
+// origin, rotated by its angles. The instance files are parsed once into
+// templates; each placement copies the brushes of its template into the
+// map, with the plane points moved by the placement transform, so the
+// visibility pass sees the combined geometry. Instances placed inside an
+// instance are expanded the same way, transforms composed.
+//
+// Expanded brushes keep Brush::instance (an index in Expansion::files) and
+// have no span in the source text: the writer leaves them alone, their
+// hidden faces are only reported per instance file.
+namespace Instances {
+    // Parsed instance files, shared by every placement and every map of a
+    // run. An entry is keyed by the resolved path and checked against the
+    // size and hash of the file: a file saved again is parsed again.
+    class Cache {
+    public:
+        // Template of the VMF at path, nullptr if it cannot be read or parsed
+        std::shared_ptr<const ParsedMap> Get(const std::string& path, unsigned threads);
+
+    private:
+        struct Entry {
+            uint64_t size = 0;
+            uint64_t hash = 0;
+            std::shared_ptr<const ParsedMap> map;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    struct Expansion {
+        std::vector<std::string> files;         // resolved paths, indexed by Brush::instance
+        std::vector<uint32_t> placements;       // placements of each file
+    };
+
+    // Appends the brushes and entities of every func_instance of the map at
+    // mapPath (entities, brushes and materials as parsed from it). Instance
+    // files are looked up relative to the VMF that places them, then to each
+    // of its parent directories. The func_instance entities themselves stay
+    // in entities.
+    Expansion Expand(const std::string& mapPath, std::vector<Brush>& brushes, std::vector<Entity>& entities,
+        MaterialTable& materials, Cache& cache, unsigned threads = 1);
+
+    // Prints the hidden and total faces of each instance file after the
+    // visibility pass (counters instance_faces and instance_hidden)
+    void Report(const std::vector<Brush>& brushes, const Expansion& expansion);
+}
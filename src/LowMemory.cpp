@@ -0,0 +1,262 @@
+﻿#include "LowMemory.h"
+#include "Profiler.h"
+#include "VMFParser.h"
+#include "Visibility.h"
+#include "Writer.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+    // One side, as the parser saw it (88 bytes): the plane points give back
+    // the exact Face, the span is where the writer puts the nodraw material
+    struct SideRecord {
+        Vec3 p1, p2, p3;
+        int64_t spanOffset = -1;        // material value, or the side's '}' if materialLength < 0
+        int32_t materialLength = -1;
+        uint32_t material = 0;
+    };
+
+    struct BrushRecord {
+        uint32_t firstSide = 0;
+        uint32_t sideCount = 0;
+        int32_t entity = -1;
+        uint8_t roles = 0;
+    };
+
+    struct CompactMap {
+        std::vector<SideRecord> sides;
+        std::vector<BrushRecord> brushes;
+        ParsedMap rest;                 // entities and materials
+    };
+
+    struct Bounds {
+        Vec3 min, max;
+    };
+
+    bool Overlaps(const Bounds& a, const Bounds& b) {
+        return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y
+            && a.min.z <= b.max.z && b.min.z <= a.max.z;
+    }
+
+    double Centre(const Bounds& b, int axis) {
+        return axis == 0 ? b.min.x + b.max.x : (axis == 1 ? b.min.y + b.max.y : b.min.z + b.max.z);
+    }
+
+    Face MakeFace(const CompactMap& map, uint32_t side, int brushId) {
+        const SideRecord& s = map.sides[side];
+        Face f;
+        f.id = static_cast<int>(side);
+        f.brushID = brushId;
+        f.p1 = s.p1;
+        f.p2 = s.p2;
+        f.p3 = s.p3;
+        f.ComputeDerived();
+        f.material = s.material;
+        if (s.materialLength >= 0) {
+            f.materialOffset = s.spanOffset;
+            f.materialLength = s.materialLength;
+        }
+        else {
+            f.sideEndOffset = s.spanOffset;
+        }
+        return f;
+    }
+
+    Brush MakeBrush(const CompactMap& map, uint32_t index) {
+        const BrushRecord& r = map.brushes[index];
+        Brush b;
+        b.id = static_cast<int>(index);
+        b.entity = r.entity;
+        b.roles = r.roles;
+        b.faces.reserve(r.sideCount);
+        for (uint32_t k = 0; k < r.sideCount; ++k) b.faces.push_back(MakeFace(map, r.firstSide + k, b.id));
+        return b;
+    }
+
+    CompactMap Parse(const std::string& path, size_t batchFaces) {
+        CompactMap map;
+        // Same estimate as the serial parse (250 bytes per side or more):
+        // growing the records by doubling would cost up to twice their size
+        std::error_code error;
+        const uintmax_t bytes = std::filesystem::file_size(path, error);
+        if (!error) {
+            map.sides.reserve(static_cast<size_t>(bytes / 256) + 16);
+            map.brushes.reserve(static_cast<size_t>(bytes / 1536) + 4);
+        }
+        map.rest = VMFParser::ParseStreaming(path, batchFaces, [&](const ParsedMap& batch) {
+            const uint32_t sideBase = static_cast<uint32_t>(map.sides.size());
+            for (const Face& f : batch.faces) {
+                SideRecord s;
+                s.p1 = f.p1;
+                s.p2 = f.p2;
+                s.p3 = f.p3;
+                s.material = f.material;
+                if (f.materialOffset >= 0) {
+                    s.spanOffset = f.materialOffset;
+                    s.materialLength = f.materialLength;
+                }
+                else {
+                    s.spanOffset = f.sideEndOffset;
+                }
+                map.sides.push_back(s);
+            }
+            for (const ParsedMap::BrushRange& b : batch.brushes) {
+                BrushRecord r;
+                r.firstSide = sideBase + b.firstFace;
+                r.sideCount = b.faceCount;
+                r.entity = b.entity;
+                map.brushes.push_back(r);
+            }
+        });
+        return map;
+    }
+
+    // EntityPolicy::Apply on the records
+    void ApplyPolicy(CompactMap& map, const EntityPolicy::Policy& policy) {
+        const std::vector<Entity>& entities = map.rest.entities;
+        const uint8_t worldRoles = EntityPolicy::RolesFor(policy, "worldspawn");
+        std::vector<uint8_t> entityRoles(entities.size());
+        for (size_t i = 0; i < entities.size(); ++i) entityRoles[i] = EntityPolicy::RolesFor(policy, entities[i].classname);
+        const std::vector<uint8_t> ignoredMaterial = EntityPolicy::IgnoredMaterials(policy, map.rest.materials);
+
+        size_t ignored = 0, ignoredSides = 0;
+        for (BrushRecord& r : map.brushes) {
+            r.roles = (r.entity >= 0 && static_cast<size_t>(r.entity) < entities.size()) ? entityRoles[r.entity] : worldRoles;
+            bool toolsOnly = r.sideCount > 0;
+            for (uint32_t k = 0; k < r.sideCount && toolsOnly; ++k) {
+                const uint32_t m = map.sides[r.firstSide + k].material;
+                toolsOnly = m < ignoredMaterial.size() && ignoredMaterial[m];
+            }
+            if (toolsOnly) r.roles = 0;
+            if (r.roles == 0) {
+                ++ignored;
+                ignoredSides += r.sideCount;
+            }
+        }
+        std::cout << "Entity policy: " << ignored << " brushes ignored (" << ignoredSides << " sides).\n";
+        Profiler::Add("policy_ignored_brushes", ignored);
+        Profiler::Add("policy_ignored_sides", ignoredSides);
+    }
+
+    // Receiver brushes cut in tiles of about tileFaces faces: halves along
+    // the longest axis of their centres, until small enough
+    std::vector<std::vector<uint32_t>> MakeTiles(const CompactMap& map, const std::vector<Bounds>& influence,
+        size_t tileFaces) {
+        std::vector<uint32_t> receivers;
+        for (uint32_t i = 0; i < map.brushes.size(); ++i) {
+            if ((map.brushes[i].roles & ROLE_RECEIVER) && map.brushes[i].sideCount) receivers.push_back(i);
+        }
+
+        std::vector<std::vector<uint32_t>> tiles;
+        std::vector<std::pair<size_t, size_t>> ranges{ { 0, receivers.size() } };
+        while (!ranges.empty()) {
+            const auto [begin, end] = ranges.back();
+            ranges.pop_back();
+            size_t faces = 0;
+            for (size_t i = begin; i < end; ++i) faces += map.brushes[receivers[i]].sideCount;
+            if (faces <= tileFaces || end - begin < 2) {
+                if (end > begin) tiles.emplace_back(receivers.begin() + begin, receivers.begin() + end);
+                continue;
+            }
+
+            double lo[3], hi[3];
+            for (int a = 0; a < 3; ++a) {
+                lo[a] = hi[a] = Centre(influence[receivers[begin]], a);
+                for (size_t i = begin + 1; i < end; ++i) {
+                    const double c = Centre(influence[receivers[i]], a);
+                    lo[a] = std::min(lo[a], c);
+                    hi[a] = std::max(hi[a], c);
+                }
+            }
+            int axis = 0;
+            for (int a = 1; a < 3; ++a) {
+                if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+            }
+            const size_t mid = begin + (end - begin) / 2;
+            std::nth_element(receivers.begin() + begin, receivers.begin() + mid, receivers.begin() + end,
+                [&](uint32_t x, uint32_t y) { return Centre(influence[x], axis) < Centre(influence[y], axis); });
+            ranges.push_back({ begin, mid });
+            ranges.push_back({ mid, end });
+        }
+        return tiles;
+    }
+}
+
+void LowMemory::ProcessMap(const Pipeline::Job& job, const Pipeline::Settings& settings, const Settings& lowMemory)
+{
+    if (settings.fill || settings.rays || settings.useCache)
+        std::cout << "Low memory: -fill, -rays and -cache need the whole map, skipped.\n";
+
+    CompactMap map = Parse(job.input, lowMemory.batchFaces);
+    std::cout << "Parsed " << map.brushes.size() << " brushes.\n";
+    std::cout << "Total faces: " << map.sides.size() << "\n";
+    ApplyPolicy(map, settings.policy);
+
+    // Influence bounds of every brush taking part
+    std::vector<Bounds> influence(map.brushes.size());
+    {
+        Profiler::Timer timer("lowmem.bounds");
+        for (uint32_t i = 0; i < map.brushes.size(); ++i) {
+            if (map.brushes[i].roles == 0) continue;
+            Visibility::InfluenceBounds(MakeBrush(map, i), influence[i].min, influence[i].max);
+        }
+    }
+
+    std::vector<uint64_t> hidden((map.sides.size() + 63) / 64, 0);
+    int hiddenCount = 0;
+    uint64_t contextBrushes = 0;
+    const auto tiles = MakeTiles(map, influence, lowMemory.tileFaces);
+    {
+        Profiler::Timer timer("visibility");
+        for (const std::vector<uint32_t>& tile : tiles) {
+            Bounds box = influence[tile[0]];
+            for (uint32_t i : tile) {
+                const Bounds& b = influence[i];
+                box.min = { std::min(box.min.x, b.min.x), std::min(box.min.y, b.min.y), std::min(box.min.z, b.min.z) };
+                box.max = { std::max(box.max.x, b.max.x), std::max(box.max.y, b.max.y), std::max(box.max.z, b.max.z) };
+            }
+
+            // The tile's brushes first (evaluated), then the occluders around it
+            std::vector<Brush> brushes;
+            std::vector<int> targets;
+            std::vector<uint8_t> inTile(map.brushes.size(), 0);
+            for (uint32_t i : tile) {
+                inTile[i] = 1;
+                targets.push_back(static_cast<int>(brushes.size()));
+                brushes.push_back(MakeBrush(map, i));
+            }
+            for (uint32_t i = 0; i < map.brushes.size(); ++i) {
+                if (inTile[i] || !(map.brushes[i].roles & ROLE_OCCLUDER) || !map.brushes[i].sideCount) continue;
+                if (!Overlaps(influence[i], box)) continue;
+                brushes.push_back(MakeBrush(map, i));
+                ++contextBrushes;
+            }
+
+            hiddenCount += Visibility::DetectHiddenFaces(brushes, targets, settings.threads, settings.precision);
+            for (int t : targets) {
+                for (const Face& f : brushes[t].faces) {
+                    if (f.hidden) hidden[f.id / 64] |= 1ull << (f.id % 64);
+                }
+            }
+        }
+    }
+    std::cout << "Low memory: " << tiles.size() << " tiles, " << contextBrushes << " neighbour brushes rebuilt.\n";
+    std::cout << "Detected " << hiddenCount << " hidden faces.\n";
+    Profiler::Add("lowmem_tiles", tiles.size());
+    Profiler::Add("lowmem_context_brushes", contextBrushes);
+    Profiler::Set("hidden_faces", static_cast<uint64_t>(hiddenCount));
+
+    // Only the hidden sides are rebuilt for the writer
+    std::vector<Face> hiddenFaces;
+    hiddenFaces.reserve(static_cast<size_t>(hiddenCount));
+    for (uint32_t i = 0; i < map.brushes.size(); ++i) {
+        const BrushRecord& r = map.brushes[i];
+        for (uint32_t k = 0; k < r.sideCount; ++k) {
+            const uint32_t side = r.firstSide + k;
+            if (hidden[side / 64] & (1ull << (side % 64))) hiddenFaces.push_back(MakeFace(map, side, static_cast<int>(i)));
+        }
+    }
+    map.sides = std::vector<SideRecord>();
+    Writer::ApplyNodraw(job.input, job.output, hiddenFaces, &map.rest.materials);
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+#include "Pipeline.h"
+#include <cstddef>
+
+// Low-memory run of one map (-lowmem), for machines with tight memory
+// limits. Only compact side records (plane points and material span) and a
+// hidden bitset stay in memory for the whole run:
+//   - the VMF is parsed in batches and its text dropped from memory behind
+//     the parser (VMFParser::ParseStreaming);
+//   - the coverage pass runs tile by tile. Brushes are split by position
+//     into tiles of about tileFaces faces; a tile is rebuilt as brushes
+//     together with every occluder whose influence bounds reach it
+//     (Visibility::InfluenceBounds), which is everything that can cover one
+//     of its faces: the result is the same as the whole-map pass;
+//   - the output is written from the hidden sides alone, the source being
+//     dropped from memory as it is copied.
+// Peak memory then follows the number of faces, not the size of the text.
+// The outside fill, ray sampling and caches need the whole map at once and
+// are not run in this mode.
+namespace LowMemory {
+    struct Settings {
+        size_t batchFaces = 4096;       // sides parsed between two text evictions
+        size_t tileFaces = 16384;       // faces evaluated per tile (without its neighbours)
+    };
+
+    // Same output as Pipeline::ProcessMap without -fill / -rays. Throws on
+    // parse errors.
+    void ProcessMap(const Pipeline::Job& job, const Pipeline::Settings& settings, const Settings& lowMemory = Settings());
+}
@@ -0,0 +1,370 @@
+﻿#include "OutsideFill.h"
+#include "Profiler.h"
+#include "Winding.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+
+namespace {
+    const double CLASSIFY_EPS = 1e-3;
+    const double FRONT_NEAR = 0.01;     // slab in front of a face checked for reached cells
+    const double FRONT_FAR = 0.5;
+    const uint32_t NONE = 0xFFFFFFFFu;
+
+    enum State : uint8_t { AIR, SOLID, MIXED };
+
+    struct Node {
+        uint32_t child = 0;     // first of 8 consecutive children, 0 for a leaf
+        uint8_t state = AIR;    // leaves only; MIXED leaves are passable
+    };
+
+    // Inside of the brush: Dot(n, p) >= d for every plane
+    struct Plane {
+        Vec3 n;
+        double d;
+    };
+
+    struct Hull {
+        Vec3 min, max;
+        uint32_t firstPlane = 0;
+        uint32_t planeCount = 0;
+    };
+
+    // Octree cell in minCell units from the octree origin; size is a power of two
+    struct Cell {
+        int64_t x, y, z, size;
+    };
+
+    enum class Relation { Outside, Inside, Crossing };
+
+    class Octree {
+    public:
+        Octree(const std::vector<Hull>& hulls_, const std::vector<Plane>& planes_, const Vec3& origin_,
+            double unit_, int64_t rootSize_, size_t maxNodes_)
+            : hulls(hulls_), planes(planes_), origin(origin_), unit(unit_), rootSize(rootSize_), maxNodes(maxNodes_) {}
+
+        void Build() {
+            nodes.assign(1, Node());
+            candidates.resize(hulls.size());
+            for (uint32_t i = 0; i < hulls.size(); ++i) candidates[i] = i;
+            BuildNode(0, Root(), 0, candidates.size());
+            candidates.clear();
+            candidates.shrink_to_fit();
+        }
+
+        Cell Root() const { return { 0, 0, 0, rootSize }; }
+        size_t NodeCount() const { return nodes.size(); }
+        bool BudgetHit() const { return budgetHit; }
+        bool Passable(uint32_t n) const { return nodes[n].state != SOLID; }
+
+        // Leaf containing p, NONE outside the octree
+        uint32_t LeafAt(const Vec3& p, Cell& cell) const {
+            const int64_t ix = static_cast<int64_t>(std::floor((p.x - origin.x) / unit));
+            const int64_t iy = static_cast<int64_t>(std::floor((p.y - origin.y) / unit));
+            const int64_t iz = static_cast<int64_t>(std::floor((p.z - origin.z) / unit));
+            if (ix < 0 || iy < 0 || iz < 0 || ix >= rootSize || iy >= rootSize || iz >= rootSize) return NONE;
+
+            uint32_t n = 0;
+            cell = Root();
+            while (nodes[n].child) {
+                const int64_t half = cell.size / 2;
+                int k = 0;
+                if (ix >= cell.x + half) { k |= 1; cell.x += half; }
+                if (iy >= cell.y + half) { k |= 2; cell.y += half; }
+                if (iz >= cell.z + half) { k |= 4; cell.z += half; }
+                cell.size = half;
+                n = nodes[n].child + k;
+            }
+            return n;
+        }
+
+        // Calls fn(node, cell) for every leaf overlapping [lo, hi) (cell units)
+        // until fn returns true; returns true if it did
+        template<typename Fn>
+        bool ForLeaves(const int64_t lo[3], const int64_t hi[3], Fn&& fn) const {
+            return VisitLeaves(0, Root(), lo, hi, fn);
+        }
+
+        void WorldBox(const Cell& c, Vec3& lo, Vec3& hi) const {
+            lo = origin + Vec3(static_cast<double>(c.x), static_cast<double>(c.y), static_cast<double>(c.z)) * unit;
+            hi = lo + Vec3(1.0, 1.0, 1.0) * (static_cast<double>(c.size) * unit);
+        }
+
+        // Integer range [lo, hi) of the cells overlapping a world box, clamped
+        void CellRange(const Vec3& bmin, const Vec3& bmax, int64_t lo[3], int64_t hi[3]) const {
+            const double mn[3] = { bmin.x - origin.x, bmin.y - origin.y, bmin.z - origin.z };
+            const double mx[3] = { bmax.x - origin.x, bmax.y - origin.y, bmax.z - origin.z };
+            for (int k = 0; k < 3; ++k) {
+                lo[k] = std::max<int64_t>(0, static_cast<int64_t>(std::floor(mn[k] / unit)));
+                hi[k] = std::min<int64_t>(rootSize, static_cast<int64_t>(std::floor(mx[k] / unit)) + 1);
+            }
+        }
+
+    private:
+        Relation Classify(const Hull& h, const Vec3& lo, const Vec3& hi) const {
+            if (h.max.x <= lo.x || h.min.x >= hi.x || h.max.y <= lo.y || h.min.y >= hi.y
+                || h.max.z <= lo.z || h.min.z >= hi.z) return Relation::Outside;
+
+            bool inside = true;
+            for (uint32_t i = 0; i < h.planeCount; ++i) {
+                const Plane& p = planes[h.firstPlane + i];
+                // Smallest and largest Dot(n, corner) over the 8 corners
+                const double ax = p.n.x * lo.x, bx = p.n.x * hi.x;
+                const double ay = p.n.y * lo.y, by = p.n.y * hi.y;
+                const double az = p.n.z * lo.z, bz = p.n.z * hi.z;
+                const double dMax = std::max(ax, bx) + std::max(ay, by) + std::max(az, bz);
+                const double dMin = std::min(ax, bx) + std::min(ay, by) + std::min(az, bz);
+                if (dMax <= p.d + CLASSIFY_EPS) return Relation::Outside;
+                if (dMin < p.d - CLASSIFY_EPS) inside = false;
+            }
+            return inside ? Relation::Inside : Relation::Crossing;
+        }
+
+        // Candidates of this cell are candidates[begin, end); the ones that
+        // cross it are appended for the children and dropped on return.
+        uint8_t BuildNode(uint32_t node, const Cell& c, size_t begin, size_t end) {
+            Vec3 lo, hi;
+            WorldBox(c, lo, hi);
+
+            const size_t mark = candidates.size();
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t h = candidates[i];
+                const Relation r = Classify(hulls[h], lo, hi);
+                if (r == Relation::Inside) {
+                    candidates.resize(mark);
+                    nodes[node].state = SOLID;
+                    return SOLID;
+                }
+                if (r == Relation::Crossing) candidates.push_back(h);
+            }
+
+            if (candidates.size() == mark) {
+                nodes[node].state = AIR;
+                return AIR;
+            }
+            if (c.size == 1 || nodes.size() + 8 > maxNodes) {
+                if (c.size > 1) budgetHit = true;
+                candidates.resize(mark);
+                nodes[node].state = MIXED;
+                return MIXED;
+            }
+
+            const uint32_t first = static_cast<uint32_t>(nodes.size());
+            nodes.resize(nodes.size() + 8);
+            nodes[node].child = first;
+
+            const int64_t half = c.size / 2;
+            int solid = 0, air = 0;
+            for (int k = 0; k < 8; ++k) {
+                const Cell cc{ c.x + ((k & 1) ? half : 0), c.y + ((k & 2) ? half : 0), c.z + ((k & 4) ? half : 0), half };
+                const uint8_t s = BuildNode(first + k, cc, mark, candidates.size());
+                const bool leaf = nodes[first + k].child == 0;
+                if (leaf && s == SOLID) ++solid;
+                if (leaf && s == AIR) ++air;
+            }
+            candidates.resize(mark);
+
+            // Uniform children: everything allocated since them is their subtree
+            if (solid == 8 || air == 8) {
+                nodes.resize(first);
+                nodes[node].child = 0;
+                nodes[node].state = solid == 8 ? SOLID : AIR;
+                return nodes[node].state;
+            }
+            nodes[node].state = MIXED;
+            return MIXED;
+        }
+
+        template<typename Fn>
+        bool VisitLeaves(uint32_t n, const Cell& c, const int64_t lo[3], const int64_t hi[3], Fn& fn) const {
+            if (c.x >= hi[0] || c.x + c.size <= lo[0] || c.y >= hi[1] || c.y + c.size <= lo[1]
+                || c.z >= hi[2] || c.z + c.size <= lo[2]) return false;
+            if (!nodes[n].child) return fn(n, c);
+            const int64_t half = c.size / 2;
+            for (int k = 0; k < 8; ++k) {
+                const Cell cc{ c.x + ((k & 1) ? half : 0), c.y + ((k & 2) ? half : 0), c.z + ((k & 4) ? half : 0), half };
+                if (VisitLeaves(nodes[n].child + k, cc, lo, hi, fn)) return true;
+            }
+            return false;
+        }
+
+        const std::vector<Hull>& hulls;
+        const std::vector<Plane>& planes;
+        Vec3 origin;
+        double unit;
+        int64_t rootSize;
+        size_t maxNodes;
+        bool budgetHit = false;
+        std::vector<Node> nodes;
+        std::vector<uint32_t> candidates;
+    };
+
+    struct Work {
+        uint32_t node;
+        Cell cell;
+    };
+}
+
+int OutsideFill::Run(std::vector<Brush>& brushes, const std::vector<Entity>& entities, const Settings& settings)
+{
+    Profiler::Timer timer("fill");
+    const double unit = settings.minCell > 0.0 ? settings.minCell : 8.0;
+    if (std::none_of(entities.begin(), entities.end(), [](const Entity& e) { return e.hasOrigin; })) {
+        std::cout << "Outside fill: no entity to start from, skipped.\n";
+        return 0;
+    }
+
+    // 1. World brushes as plane sets (inward normals) with their winding bounds
+    WindingPool windings;
+    windings.Build(brushes);
+
+    std::vector<Hull> hulls;
+    std::vector<Plane> planes;
+    std::vector<double> inward(brushes.size(), 1.0);
+    Vec3 worldMin, worldMax;
+    bool any = false;
+    uint32_t row = 0;
+    for (size_t bi = 0; bi < brushes.size(); ++bi) {
+        Brush& b = brushes[bi];
+        const uint32_t firstRow = row;
+        row += static_cast<uint32_t>(b.faces.size());
+        if (b.entity >= 0 || !(b.roles & ROLE_OCCLUDER)) continue;   // clips and triggers do not seal
+        if (!b.ComputeAABB(windings, firstRow)) continue;
+
+        inward[bi] = Winding::InwardSign(b);
+        Hull h;
+        h.min = b.min;
+        h.max = b.max;
+        h.firstPlane = static_cast<uint32_t>(planes.size());
+        for (const Face& f : b.faces) {
+            if (Length(f.normal) < 1e-4) continue;
+            const Vec3 n = f.normal * inward[bi];
+            planes.push_back({ n, Dot(n, f.p1) });
+        }
+        h.planeCount = static_cast<uint32_t>(planes.size()) - h.firstPlane;
+        if (!any) { worldMin = h.min; worldMax = h.max; any = true; }
+        worldMin = { std::min(worldMin.x, h.min.x), std::min(worldMin.y, h.min.y), std::min(worldMin.z, h.min.z) };
+        worldMax = { std::max(worldMax.x, h.max.x), std::max(worldMax.y, h.max.y), std::max(worldMax.z, h.max.z) };
+        hulls.push_back(h);
+    }
+    if (!any) return 0;
+
+    // 2. Octree: two free cells around the world so the outside is connected
+    const Vec3 origin(std::floor(worldMin.x / unit) * unit - 2 * unit,
+        std::floor(worldMin.y / unit) * unit - 2 * unit,
+        std::floor(worldMin.z / unit) * unit - 2 * unit);
+    const double extent = std::max({ worldMax.x - origin.x, worldMax.y - origin.y, worldMax.z - origin.z }) + 2 * unit;
+    int64_t rootSize = 1;
+    while (rootSize * unit < extent) rootSize *= 2;
+
+    Octree tree(hulls, planes, origin, unit, rootSize, settings.maxNodes);
+    tree.Build();
+    Profiler::Add("fill_nodes", tree.NodeCount());
+
+    // 3. Flood from every entity origin; reaching the octree border is a leak
+    std::vector<uint32_t> seedOf(tree.NodeCount(), NONE);
+    std::deque<Work> queue;
+    int leak = -1;
+    for (size_t e = 0; e < entities.size() && leak < 0; ++e) {
+        if (!entities[e].hasOrigin) continue;
+        Cell c;
+        const uint32_t n = tree.LeafAt(entities[e].origin, c);
+        if (n == NONE) {
+            leak = static_cast<int>(e);
+            break;
+        }
+        if (!tree.Passable(n) || seedOf[n] != NONE) continue;
+        seedOf[n] = static_cast<uint32_t>(e);
+        queue.push_back({ n, c });
+    }
+    if (queue.empty() && leak < 0) {
+        std::cout << "Outside fill: no entity to start from, skipped.\n";
+        return 0;
+    }
+
+    size_t reached = 0;
+    while (!queue.empty() && leak < 0) {
+        const Work w = queue.front();
+        queue.pop_front();
+        ++reached;
+
+        const Cell& c = w.cell;
+        if (c.x == 0 || c.y == 0 || c.z == 0 || c.x + c.size == rootSize || c.y + c.size == rootSize || c.z + c.size == rootSize) {
+            leak = static_cast<int>(seedOf[w.node]);
+            break;
+        }
+
+        // Face neighbours: one cell-unit thick slab on each side
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int dir = 0; dir < 2; ++dir) {
+                int64_t lo[3] = { c.x, c.y, c.z };
+                int64_t hi[3] = { c.x + c.size, c.y + c.size, c.z + c.size };
+                if (dir == 0) { hi[axis] = lo[axis]; lo[axis] -= 1; }
+                else { lo[axis] = hi[axis]; hi[axis] += 1; }
+                tree.ForLeaves(lo, hi, [&](uint32_t m, const Cell& mc) {
+                    if (tree.Passable(m) && seedOf[m] == NONE) {
+                        seedOf[m] = seedOf[w.node];
+                        queue.push_back({ m, mc });
+                    }
+                    return false;
+                });
+            }
+        }
+    }
+    Profiler::Add("fill_cells_reached", reached);
+
+    if (leak >= 0) {
+        const Entity& e = entities[leak];
+        std::cout << "Outside fill: leak, " << (e.classname.empty() ? "entity" : e.classname) << " at ("
+            << e.origin.x << " " << e.origin.y << " " << e.origin.z << ") reaches the outside; nothing hidden.\n";
+        return 0;
+    }
+
+    // 4. A world face is visible if a reached cell touches its front side
+    int hiddenCount = 0;
+    row = 0;
+    for (size_t bi = 0; bi < brushes.size(); ++bi) {
+        Brush& b = brushes[bi];
+        const uint32_t firstRow = row;
+        row += static_cast<uint32_t>(b.faces.size());
+        if (b.entity >= 0 || !(b.roles & ROLE_RECEIVER)) continue;
+
+        for (size_t fi = 0; fi < b.faces.size(); ++fi) {
+            Face& f = b.faces[fi];
+            const uint32_t r = firstRow + static_cast<uint32_t>(fi);
+            if (f.hidden || windings.count[r] < 3) continue;
+
+            const Vec3 outward = f.normal * -inward[bi];
+            Vec3 bmin, bmax;
+            for (uint32_t k = 0; k < windings.count[r]; ++k) {
+                for (double offset : { FRONT_NEAR, FRONT_FAR }) {
+                    const Vec3 p = windings.Polygon(r)[k] + outward * offset;
+                    if (k == 0 && offset == FRONT_NEAR) { bmin = bmax = p; continue; }
+                    bmin = { std::min(bmin.x, p.x), std::min(bmin.y, p.y), std::min(bmin.z, p.z) };
+                    bmax = { std::max(bmax.x, p.x), std::max(bmax.y, p.y), std::max(bmax.z, p.z) };
+                }
+            }
+
+            int64_t lo[3], hi[3];
+            tree.CellRange(bmin, bmax, lo, hi);
+            const bool visible = tree.ForLeaves(lo, hi, [&](uint32_t m, const Cell& mc) {
+                if (seedOf[m] == NONE) return false;
+                Vec3 cmin, cmax;
+                tree.WorldBox(mc, cmin, cmax);
+                return cmin.x < bmax.x && cmax.x > bmin.x && cmin.y < bmax.y && cmax.y > bmin.y
+                    && cmin.z < bmax.z && cmax.z > bmin.z;
+            });
+            if (!visible) {
+                f.hidden = true;
+                ++hiddenCount;
+            }
+        }
+    }
+
+    if (tree.BudgetHit()) std::cout << "Outside fill: node budget reached, some cells kept coarse.\n";
+    std::cout << "Outside fill: " << hiddenCount << " faces hidden (" << tree.NodeCount() << " octree nodes).\n";
+    Profiler::Add("fill_hidden", static_cast<uint64_t>(hiddenCount));
+    return hiddenCount;
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <cstddef>
+#include <vector>
+
+// Reachability pass: flood-fills the empty space from the entities and hides
+// the world faces whose front side is never reached (faces looking into the
+// sealed void around the map, or into closed pockets nobody can enter).
+//
+// Empty space is a sparse octree built from the world brushes: a cell is
+// solid when it lies inside one brush (or all its children are solid), empty
+// when it touches no brush, and is subdivided otherwise, down to minCell.
+// Cells still undecided at minCell, or once the node budget is spent, count
+// as empty: the fill may reach more space than really exists, never less.
+// Solids of brush entities (doors, func_detail...) do not stop the fill and
+// their faces are left alone.
+namespace OutsideFill {
+    struct Settings {
+        double minCell = 8.0;           // smallest octree cell (Hammer units)
+        size_t maxNodes = 1u << 22;     // node budget, 12 bytes per node
+    };
+
+    // Adds hidden flags (never clears one). Returns the number of faces it
+    // hid: 0 without any entity to start from, or when the fill leaks out of
+    // the map (an entity in the void), like a VBSP leak.
+    int Run(std::vector<Brush>& brushes, const std::vector<Entity>& entities, const Settings& settings = Settings());
+}
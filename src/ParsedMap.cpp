@@ -0,0 +1,33 @@
+﻿#include "ParsedMap.h"
+
+MaterialTable::MaterialTable()
+{
+    names.emplace_back();
+    lookup.emplace(std::string_view(names.back()), 0u);
+}
+
+uint32_t MaterialTable::Intern(std::string_view name)
+{
+    auto it = lookup.find(name);
+    if (it != lookup.end()) return it->second;
+
+    const uint32_t id = static_cast<uint32_t>(names.size());
+    names.emplace_back(name);
+    lookup.emplace(std::string_view(names.back()), id);
+    return id;
+}
+
+std::vector<Brush> ParsedMap::ToBrushes() const
+{
+    std::vector<Brush> out(brushes.size());
+    for (size_t i = 0; i < brushes.size(); ++i) {
+        const BrushRange& r = brushes[i];
+        Brush& b = out[i];
+        b.id = r.id;
+        b.entity = r.entity;
+        b.faces.assign(FacesOf(i), FacesOf(i) + r.faceCount);
+        b.min = r.min;
+        b.max = r.max;
+    }
+    return out;
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Distinct material names of a map, referenced by 32-bit ids (Face::material).
+// Id 0 is the empty name, used by sides without a "material" key.
+class MaterialTable {
+public:
+    MaterialTable();
+    MaterialTable(MaterialTable&&) = default;
+    MaterialTable& operator=(MaterialTable&&) = default;
+    MaterialTable(const MaterialTable&) = delete;   // lookup keys point into names
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    // Id of name, added on first use (exact bytes, case-sensitive)
+    uint32_t Intern(std::string_view name);
+
+    const std::string& Name(uint32_t id) const { return names[id]; }
+    size_t Size() const { return names.size(); }
+
+private:
+    std::deque<std::string> names;      // deque: elements never move
+    std::unordered_map<std::string_view, uint32_t> lookup;
+};
+
+// Parse result held in a few large arrays instead of one vector per brush:
+// every side lives in one pool (brush after brush) and a brush is a range
+// of that pool.
+struct ParsedMap {
+    struct BrushRange {
+        int id = -1;
+        int entity = -1;            // index in entities, -1 = world
+        uint32_t firstFace = 0;
+        uint32_t faceCount = 0;
+        Vec3 min, max;              // face center bounds, same as Brush::ComputeAABB()
+    };
+
+    std::vector<Face> faces;
+    std::vector<BrushRange> brushes;
+    std::vector<Entity> entities;
+    MaterialTable materials;
+
+    const Face* FacesOf(size_t brush) const { return faces.data() + brushes[brush].firstFace; }
+
+    // Copy in the std::vector<Brush> form taken by the visibility pass and the writer
+    std::vector<Brush> ToBrushes() const;
+};
@@ -0,0 +1,352 @@
+﻿#include "Patch.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "TextHash.h"
+#include "VMFTokenizer.h"
+#include "Writer.h"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const int PATCH_VERSION = 1;
+    const size_t EVICT_STEP = 8u << 20;     // input pages dropped behind the pass
+
+    struct Header {
+        uint64_t sourceSize = 0;
+        uint64_t sourceHash = 0;
+        uint64_t resultSize = 0;
+        uint64_t resultHash = 0;
+    };
+
+    // What one pass read and wrote
+    struct PassResult {
+        uint64_t inputHash = 0;
+        uint64_t outputSize = 0;
+        uint64_t outputHash = 0;
+    };
+
+    std::string Hex(uint64_t v) {
+        char buf[17];
+        for (int i = 15; i >= 0; --i, v >>= 4) buf[i] = "0123456789abcdef"[v & 15];
+        buf[16] = '\0';
+        return buf;
+    }
+
+    std::string Describe(bool has, std::string_view material) {
+        return has ? "\"" + std::string(material) + "\"" : std::string("none");
+    }
+
+    // Span of a "material" key added by Writer::MaterialInsertion, from its
+    // value at [at, at + length): its whole line, or the inline form in
+    // front of the side's '}'. False if the text around it is not that.
+    bool InsertedSpan(std::string_view text, size_t at, size_t length, size_t& begin, size_t& end) {
+        const std::string_view key = "\"material\" \"";
+        if (at < key.size() || text.substr(at - key.size(), key.size()) != key) return false;
+        const size_t keyAt = at - key.size();
+        size_t lineStart = keyAt;
+        while (lineStart > 0 && text[lineStart - 1] != '\n') --lineStart;
+
+        const bool alone = std::all_of(text.begin() + lineStart, text.begin() + keyAt, [](char c) { return c == ' ' || c == '\t'; });
+        if (alone) {
+            const size_t lineEnd = text.find('\n', at + length);
+            if (lineEnd == std::string_view::npos) return false;
+            const std::string_view rest = text.substr(at + length, lineEnd - at - length);
+            begin = lineStart;
+            end = lineEnd + 1;
+            return rest == "\"" || rest == "\"\r";
+        }
+        if (keyAt == 0 || text[keyAt - 1] != ' ' || text.substr(at + length, 2) != "\" ") return false;
+        begin = keyAt - 1;
+        end = at + length + 2;
+        return true;
+    }
+
+    // The pass over a map: every side of text whose id is in sides (sorted
+    // by id) goes from its before material to its after one, or back with
+    // revert. The result is hashed, and written to out when given; with
+    // source (the mapping text views) the pages read are dropped behind.
+    PassResult Rewrite(std::string_view text, const std::vector<Patch::Side>& sides, bool revert, std::ostream* out,
+        MappedFile* source) {
+        TextHash inputHash, outputHash;
+        size_t pos = 0, evicted = 0;
+        auto emit = [&](std::string_view piece) {
+            outputHash.Add(piece);
+            if (out) out->write(piece.data(), static_cast<std::streamsize>(piece.size()));
+        };
+        auto replace = [&](size_t at, size_t length, std::string_view with) {
+            const std::string_view kept = text.substr(pos, at - pos);
+            inputHash.Add(kept);
+            emit(kept);
+            inputHash.Add(text.substr(at, length));
+            emit(with);
+            pos = at + length;
+            if (source && pos >= evicted + EVICT_STEP) {
+                source->Evict(pos);
+                evicted = pos;
+            }
+        };
+
+        // Same block rules as the parser: "side" blocks directly inside the
+        // outermost "solid"
+        enum class Block { Other, Solid, Side };
+        std::vector<Block> stack;
+        bool inSolid = false;
+        std::string_view lastWord, key;
+        bool haveKey = false;
+        int sideId = -1;
+        bool hasMaterial = false;
+        size_t materialAt = 0, materialLength = 0;
+        std::vector<uint8_t> done(sides.size(), 0);
+
+        VMFTokenizer tokenizer(text);
+        for (VMFToken tok = tokenizer.Next(); tok.type != VMFToken::End; tok = tokenizer.Next()) {
+            if (tok.type == VMFToken::Word) {
+                lastWord = tok.text;
+                haveKey = false;
+            }
+            else if (tok.type == VMFToken::Open) {
+                Block kind = Block::Other;
+                if (!inSolid && lastWord == "solid") {
+                    kind = Block::Solid;
+                    inSolid = true;
+                }
+                else if (!stack.empty() && stack.back() == Block::Solid && lastWord == "side") {
+                    kind = Block::Side;
+                    sideId = -1;
+                    hasMaterial = false;
+                }
+                stack.push_back(kind);
+                lastWord = {};
+                haveKey = false;
+            }
+            else if (tok.type == VMFToken::Close) {
+                const Block kind = stack.empty() ? Block::Other : stack.back();
+                if (!stack.empty()) stack.pop_back();
+                if (kind == Block::Solid) inSolid = false;
+                lastWord = {};
+                haveKey = false;
+                if (kind != Block::Side) continue;
+
+                const auto it = std::lower_bound(sides.begin(), sides.end(), sideId,
+                    [](const Patch::Side& s, int id) { return s.id < id; });
+                if (it == sides.end() || it->id != sideId) continue;
+                const size_t k = static_cast<size_t>(it - sides.begin());
+                const std::string id = std::to_string(sideId);
+                if (done[k]) throw std::runtime_error("side id " + id + " appears more than once in the map");
+                done[k] = 1;
+
+                const bool hasFrom = revert || it->hasBefore;
+                const bool hasTo = !revert || it->hasBefore;
+                const std::string& from = revert ? it->after : it->before;
+                const std::string& to = revert ? it->before : it->after;
+                const std::string_view current = text.substr(materialAt, materialLength);
+                if (hasFrom != hasMaterial || (hasMaterial && current != from))
+                    throw std::runtime_error("side " + id + ": material " + Describe(hasMaterial, current) + ", the patch expects "
+                        + Describe(hasFrom, from));
+
+                if (!hasFrom) {
+                    const Writer::Splice s = Writer::MaterialInsertion(text, static_cast<int64_t>(tok.offset), to);
+                    replace(static_cast<size_t>(s.offset), 0, s.text);
+                }
+                else if (hasTo) {
+                    replace(materialAt, materialLength, to);
+                }
+                else {
+                    size_t begin = 0, end = 0;
+                    if (!InsertedSpan(text, materialAt, materialLength, begin, end))
+                        throw std::runtime_error("side " + id + ": the \"material\" key was not added by this patch");
+                    replace(begin, end - begin, {});
+                }
+            }
+            else if (!haveKey) {
+                key = tok.text;
+                haveKey = true;
+            }
+            else {
+                haveKey = false;
+                if (stack.empty() || stack.back() != Block::Side) continue;
+                if (key == "id") {
+                    std::from_chars(tok.text.data(), tok.text.data() + tok.text.size(), sideId);
+                }
+                else if (key == "material") {
+                    hasMaterial = true;
+                    materialAt = tok.offset;
+                    materialLength = tok.text.size();
+                }
+            }
+        }
+        replace(text.size(), 0, {});
+
+        for (size_t k = 0; k < sides.size(); ++k) {
+            if (!done[k]) throw std::runtime_error("side " + std::to_string(sides[k].id) + " is not in the map");
+        }
+        return { inputHash.Value(), outputHash.Size(), outputHash.Value() };
+    }
+
+    // Next field of a patch line: a word, or a quoted value (quoted = true)
+    bool NextField(std::string_view& line, std::string_view& field, bool& quoted) {
+        while (!line.empty() && (line[0] == ' ' || line[0] == '\t')) line.remove_prefix(1);
+        if (line.empty()) return false;
+        quoted = line[0] == '"';
+        if (quoted) {
+            const size_t close = line.find('"', 1);
+            if (close == std::string_view::npos) return false;
+            field = line.substr(1, close - 1);
+            line.remove_prefix(close + 1);
+            return true;
+        }
+        const size_t end = std::min(line.find_first_of(" \t"), line.size());
+        field = line.substr(0, end);
+        line.remove_prefix(end);
+        return true;
+    }
+
+    bool ReadNumber(std::string_view text, uint64_t& out, int base = 10) {
+        const auto res = std::from_chars(text.data(), text.data() + text.size(), out, base);
+        return res.ec == std::errc() && res.ptr == text.data() + text.size();
+    }
+
+    // Throws std::runtime_error on a malformed patch
+    void Read(const std::string& path, Header& header, std::vector<Patch::Side>& sides) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("Failed to open patch: " + path);
+
+        std::string text;
+        size_t lineNumber = 0;
+        bool version = false, hasSource = false, hasResult = false;
+        auto fail = [&]() { throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": malformed patch line"); };
+        while (std::getline(in, text)) {
+            ++lineNumber;
+            std::string_view line = text;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            std::string_view word, a, b, c;
+            bool quoted = false, quotedB = false, quotedC = false;
+            if (!NextField(line, word, quoted) || word.substr(0, 2) == "//") continue;
+
+            if (word == "vpatch") {
+                uint64_t v = 0;
+                if (!NextField(line, a, quoted) || !ReadNumber(a, v)) fail();
+                if (v != PATCH_VERSION) throw std::runtime_error(path + ": unsupported patch version " + std::string(a));
+                version = true;
+            }
+            else if (word == "source" || word == "result") {
+                uint64_t size = 0, hash = 0;
+                if (!NextField(line, a, quoted) || !ReadNumber(a, size) || !NextField(line, b, quoted) || !ReadNumber(b, hash, 16))
+                    fail();
+                if (word == "source") {
+                    header.sourceSize = size;
+                    header.sourceHash = hash;
+                    hasSource = true;
+                }
+                else {
+                    header.resultSize = size;
+                    header.resultHash = hash;
+                    hasResult = true;
+                }
+            }
+            else if (word == "side") {
+                uint64_t id = 0;
+                if (!NextField(line, a, quoted) || !ReadNumber(a, id) || id > INT32_MAX
+                    || !NextField(line, b, quotedB) || !NextField(line, c, quotedC) || !quotedC || (!quotedB && b != "-"))
+                    fail();
+                Patch::Side s;
+                s.id = static_cast<int>(id);
+                s.hasBefore = quotedB;
+                s.before = quotedB ? std::string(b) : std::string();
+                s.after = std::string(c);
+                sides.push_back(std::move(s));
+            }
+            else {
+                fail();
+            }
+        }
+        if (!version || !hasSource || !hasResult) throw std::runtime_error(path + ": not a VMF patch");
+
+        std::sort(sides.begin(), sides.end(), [](const Patch::Side& x, const Patch::Side& y) { return x.id < y.id; });
+        for (size_t i = 1; i < sides.size(); ++i) {
+            if (sides[i].id == sides[i - 1].id) throw std::runtime_error(path + ": side " + std::to_string(sides[i].id) + " listed twice");
+        }
+    }
+}
+
+void Patch::Write(const std::string& sourcePath, const std::string& patchPath, std::vector<Side> sides)
+{
+    std::sort(sides.begin(), sides.end(), [](const Side& x, const Side& y) { return x.id < y.id; });
+
+    // A pass without output checks every side against the source and gives
+    // the hash of the result
+    MappedFile source(sourcePath);
+    const PassResult pass = Rewrite(source.View(), sides, false, nullptr, nullptr);
+
+    std::ofstream out(patchPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error("Failed to write patch: " + patchPath);
+    out << "vpatch " << PATCH_VERSION << "\n";
+    out << "source " << source.Size() << " " << Hex(pass.inputHash) << "\n";
+    out << "result " << pass.outputSize << " " << Hex(pass.outputHash) << "\n";
+    for (const Side& s : sides) {
+        out << "side " << s.id << " ";
+        if (s.hasBefore) out << "\"" << s.before << "\" ";
+        else out << "- ";
+        out << "\"" << s.after << "\"\n";
+    }
+    const uint64_t written = static_cast<uint64_t>(out.tellp());
+    out.close();
+    if (out.fail()) throw std::runtime_error("Failed to write patch: " + patchPath);
+    Profiler::Add("faces_nodraw", sides.size());
+    Profiler::Add("bytes_written", written);
+}
+
+void Patch::Apply(const std::string& patchPath, const std::string& inputPath, const std::string& outputPath, bool revert)
+{
+    Header header;
+    std::vector<Side> sides;
+    Read(patchPath, header, sides);
+    const uint64_t inSize = revert ? header.resultSize : header.sourceSize;
+    const uint64_t inHash = revert ? header.resultHash : header.sourceHash;
+    const uint64_t outSize = revert ? header.sourceSize : header.resultSize;
+    const uint64_t outHash = revert ? header.sourceHash : header.resultHash;
+    const std::string role = revert ? "result" : "source";
+
+    // Written next to the output and renamed once checked: the output may
+    // be the input itself
+    const std::string temp = outputPath + ".tmp";
+    {
+        MappedFile input(inputPath);
+        if (input.Size() != inSize)
+            throw std::runtime_error(inputPath + " is not the " + role + " of " + patchPath + " (size differs)");
+
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("Failed to write " + temp);
+        try {
+            const PassResult pass = Rewrite(input.View(), sides, revert, &out, &input);
+            out.close();
+            if (out.fail()) throw std::runtime_error("Failed to write " + temp);
+            if (pass.inputHash != inHash)
+                throw std::runtime_error(inputPath + " is not the " + role + " of " + patchPath + " (content differs)");
+            if (pass.outputSize != outSize || pass.outputHash != outHash)
+                throw std::runtime_error("the patched map does not match " + patchPath);
+        }
+        catch (const std::runtime_error&) {
+            out.close();
+            std::error_code ignored;
+            fs::remove(temp, ignored);
+            throw;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(temp, outputPath, error);
+    if (error) {
+        fs::remove(temp, error);
+        throw std::runtime_error("Failed to replace " + outputPath);
+    }
+    std::cout << "Patch: " << sides.size() << " sides " << (revert ? "reverted" : "applied") << ", written to "
+        << outputPath << "\n";
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Delta output (-delta): a text file listing the sides whose material the
+// optimization changes, instead of a full copy of the map:
+//
+//   vpatch 1
+//   source <bytes> <hash>          the map the patch was made from
+//   result <bytes> <hash>          that map with the patch applied
+//   side <id> "<old>" "<new>"      one line per side, by Hammer side id
+//
+// <old> is - (no quotes) for a side without a "material" key, which gets
+// one. Hashes are TextHash values of the whole file, in hex. Sides are
+// sorted by id, so the patch of a map under version control only changes
+// where the result does.
+//
+// Apply and Revert rewrite a map in one pass, side blocks found with the
+// tokenizer and the text copied around them. The map must be the source
+// (apply) or the result (revert) exactly: sizes are checked first, every
+// patched side must hold the expected material, and the hash of the input
+// and of what was written are checked at the end; on any mismatch nothing
+// is written.
+namespace Patch {
+    struct Side {
+        int id = -1;                // "id" key of the side
+        bool hasBefore = true;      // false: the side has no "material" key
+        std::string before;         // material in the source
+        std::string after;          // material in the result
+    };
+
+    // Patch turning the map at sourcePath into its copy with the given
+    // side materials. sides[i].before must be what the map holds. Throws
+    // std::runtime_error if a side is missing, differs or shares its id, or
+    // if the patch cannot be written.
+    void Write(const std::string& sourcePath, const std::string& patchPath, std::vector<Side> sides);
+
+    // Writes inputPath with the patch applied (revert = false) or taken back
+    // (revert = true) to outputPath, which may be inputPath itself (the file
+    // is replaced once complete). Throws std::runtime_error on a mismatch.
+    void Apply(const std::string& patchPath, const std::string& inputPath, const std::string& outputPath, bool revert);
+}
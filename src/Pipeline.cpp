@@ -0,0 +1,395 @@
+﻿#include "Pipeline.h"
+#include "GeometryCache.h"
+#include "Instances.h"
+#include "LowMemory.h"
+#include "OutsideFill.h"
+#include "Profiler.h"
+#include "RayVisibility.h"
+#include "VMFParser.h"
+#include "Visibility.h"
+#include "VisibilityCache.h"
+#include "Writer.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Blocking FIFO between two stages; Pop returns false once closed and empty
+    template<typename T>
+    class StageQueue {
+    public:
+        void Push(T item) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                items.push_back(std::move(item));
+            }
+            cv.notify_one();
+        }
+        void Close() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            cv.notify_all();
+        }
+        bool Pop(T& out) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return closed || !items.empty(); });
+            if (items.empty()) return false;
+            out = std::move(items.front());
+            items.pop_front();
+            return true;
+        }
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<T> items;
+        bool closed = false;
+    };
+
+    // Counting semaphore bounding the number of parsed maps alive
+    class Slots {
+    public:
+        explicit Slots(unsigned n) : free(n == 0 ? 1 : n) {}
+        void Acquire() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return free > 0; });
+            --free;
+        }
+        void Release() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++free;
+            }
+            cv.notify_one();
+        }
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        unsigned free;
+    };
+
+    struct MapWork {
+        size_t index = 0;
+        std::vector<Brush> brushes;
+        std::vector<Entity> entities;
+        MaterialTable materials;
+        Region region;              // celle de la map (ses cordons avec -cordons)
+        Instances::Expansion instances;
+        bool failed = false;
+        Profiler::Report report;
+    };
+
+    // Géométrie relue depuis le cache si la source n'a pas bougé, sinon parsée
+    // (et le cache réécrit). region : copie de settings.region, complétée par
+    // les cordons de la map (pas de cache dans ce mode, cf. main)
+    std::vector<Brush> ParseOrLoad(const Pipeline::Job& job, const Pipeline::Settings& settings, unsigned threads,
+        std::vector<Entity>& entities, MaterialTable& materials, Region& region) {
+        region = settings.region;
+        if (!settings.useCache) return VMFParser::ParseVMF(job.input, &entities, &materials, threads, &region);
+
+        const std::string cachePath = GeometryCache::CachePathFor(job.output);
+        ParsedMap map;
+        if (GeometryCache::Load(cachePath, job.input, map)) {
+            std::cout << "Geometry cache: " << map.brushes.size() << " brushes, " << map.faces.size() << " faces loaded.\n";
+        }
+        else {
+            map = VMFParser::Parse(job.input, threads);
+            if (!GeometryCache::Save(cachePath, job.input, map)) std::cerr << "Geometry cache: cannot write " << cachePath << "\n";
+        }
+        return VMFParser::ToBrushes(map, &entities, &materials);
+    }
+
+    // Brushes de la map, puis celles de ses instances avec -instances (le
+    // cache des instances est partagé par toutes les maps d'un batch)
+    std::vector<Brush> LoadBrushes(const Pipeline::Job& job, const Pipeline::Settings& settings, unsigned threads,
+        std::vector<Entity>& entities, MaterialTable& materials, Region& region,
+        Instances::Cache& instanceCache, Instances::Expansion& expansion) {
+        std::vector<Brush> brushes = ParseOrLoad(job, settings, threads, entities, materials, region);
+        if (settings.instances)
+            expansion = Instances::Expand(job.input, brushes, entities, materials, instanceCache, threads);
+        return brushes;
+    }
+
+    void RunVisibility(std::vector<Brush>& brushes, const std::vector<Entity>& entities, const MaterialTable& materials,
+        const Region& region, const Instances::Expansion& expansion, const Pipeline::Job& job,
+        const Pipeline::Settings& settings) {
+        // Avant le cache : les rôles font partie du hash des brushes
+        EntityPolicy::Apply(settings.policy, brushes, entities, materials);
+        // Autour de la région, les brushes parsées ne font que cacher
+        if (region.Active()) region.Restrict(brushes);
+        {
+            Profiler::Timer timer("visibility");
+            // La comparaison refait toute la passe deux fois : pas de cache
+            if (settings.comparePrecision)
+                Visibility::ComparePrecision(brushes, settings.precision, settings.threads);
+            else if (settings.useCache)
+                VisibilityCache::DetectHiddenFaces(brushes, VisibilityCache::CachePathFor(job.output), settings.threads,
+                    settings.precision);
+            else
+                Visibility::DetectHiddenFaces(brushes, settings.threads, settings.precision);
+        }
+        // Après le cache : le remplissage dépend de toute la map, pas d'une brush
+        if (settings.fill) OutsideFill::Run(brushes, entities);
+        if (settings.rays) {
+            RayVisibility::Settings rays;
+            rays.raysPerSample = settings.rays;
+            rays.hide = settings.hideRays;
+            RayVisibility::Run(brushes, entities, rays, settings.threads);
+        }
+
+        // Les faces des instances ne sont pas dans le fichier : comptées à part
+        uint64_t hidden = 0;
+        for (const Brush& b : brushes) {
+            if (b.instance >= 0) continue;
+            for (const Face& f : b.faces) hidden += f.hidden ? 1 : 0;
+        }
+        Profiler::Set("hidden_faces", hidden);
+        Instances::Report(brushes, expansion);
+    }
+
+    // Copie optimisée, ou patch des sides modifiés avec -delta
+    void WriteOutput(const Pipeline::Job& job, const Pipeline::Settings& settings, const std::vector<Brush>& brushes,
+        const MaterialTable& materials) {
+        if (settings.delta) Writer::WritePatch(job.input, job.output, brushes, materials);
+        else Writer::ApplyNodraw(job.input, job.output, brushes, &materials);
+    }
+
+    // Rapport d'une map terminée (écrit ou affiché selon -report)
+    void EmitReport(Profiler::Report& report, const Pipeline::Settings& settings) {
+        if (settings.report.empty()) return;
+        // Pic du processus : en batch il couvre aussi les maps précédentes
+        report.Set("peak_rss_bytes", Profiler::PeakRss());
+        if (settings.report == "json") {
+            const std::string path = Pipeline::ReportPathFor(report.output);
+            if (!Profiler::WriteJson(report, path)) std::cerr << "Report: cannot write " << path << "\n";
+        }
+        else {
+            Profiler::PrintText(report, std::cout);
+        }
+    }
+
+    bool IsVmf(const fs::path& p) {
+        std::string ext = p.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ext == ".vmf";
+    }
+}
+
+std::string Pipeline::OutputPathFor(const std::string& input, const std::string& pattern)
+{
+    if (pattern.find('{') == std::string::npos) return pattern;
+
+    const fs::path in(input);
+    std::string dir = in.parent_path().string();
+    if (dir.empty()) dir = ".";
+    const std::string name = in.stem().string();
+
+    std::string out;
+    for (size_t i = 0; i < pattern.size();) {
+        if (pattern.compare(i, 6, "{name}") == 0) { out += name; i += 6; }
+        else if (pattern.compare(i, 5, "{dir}") == 0) { out += dir; i += 5; }
+        else out += pattern[i++];
+    }
+    return out;
+}
+
+std::string Pipeline::ReportPathFor(const std::string& outputPath)
+{
+    return outputPath + ".report.json";
+}
+
+std::vector<Pipeline::Job> Pipeline::CollectJobs(const std::string& source, const std::string& outputPattern)
+{
+    std::vector<std::string> inputs;
+    if (fs::is_directory(source)) {
+        for (const auto& entry : fs::directory_iterator(source)) {
+            if (entry.is_regular_file() && IsVmf(entry.path())) inputs.push_back(entry.path().string());
+        }
+        std::sort(inputs.begin(), inputs.end());
+    }
+    else {
+        std::ifstream list(source);
+        if (!list.is_open()) throw std::runtime_error("Failed to open batch list: " + source);
+        std::string line;
+        while (std::getline(list, line)) {
+            size_t a = line.find_first_not_of(" \t\r\n");
+            if (a == std::string::npos || line[a] == '#') continue;
+            size_t b = line.find_last_not_of(" \t\r\n");
+            inputs.push_back(line.substr(a, b - a + 1));
+        }
+    }
+
+    std::vector<Job> jobs;
+    for (const auto& in : inputs) jobs.push_back({ in, OutputPathFor(in, outputPattern) });
+
+    // Un dossier déjà traité contient aussi nos sorties : on ne les reprend pas
+    std::vector<fs::path> produced;
+    for (const auto& j : jobs) produced.push_back(fs::path(j.output).lexically_normal());
+    jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [&](const Job& j) {
+        const fs::path in = fs::path(j.input).lexically_normal();
+        return std::find(produced.begin(), produced.end(), in) != produced.end();
+    }), jobs.end());
+
+    // Deux maps qui écriraient au même endroit : on refuse plutôt qu'écraser
+    std::vector<std::string> outputs;
+    for (const auto& j : jobs) outputs.push_back(j.output);
+    std::sort(outputs.begin(), outputs.end());
+    if (std::adjacent_find(outputs.begin(), outputs.end()) != outputs.end())
+        throw std::runtime_error("Several maps share the same output path; use {name} in -output.");
+    return jobs;
+}
+
+void Pipeline::ProcessMap(const Job& job, const Settings& settings)
+{
+    Profiler::Report report;
+    report.input = job.input;
+    report.output = job.output;
+    Profiler::Bind bind(settings.report.empty() ? nullptr : &report);
+
+    if (settings.lowMemory) {
+        LowMemory::ProcessMap(job, settings);
+        EmitReport(report, settings);
+        return;
+    }
+
+    std::vector<Entity> entities;
+    MaterialTable materials;
+    Region region;
+    Instances::Cache instanceCache;
+    Instances::Expansion expansion;
+    auto brushes = LoadBrushes(job, settings, settings.threads, entities, materials, region, instanceCache, expansion);
+    std::cout << "Parsed " << brushes.size() << " brushes.\n";
+
+    // 🧮 Calcul du nombre total de faces
+    int totalFaces = 0;
+    for (const auto& b : brushes)
+        totalFaces += static_cast<int>(b.faces.size());
+    std::cout << "Total faces: " << totalFaces << "\n";
+
+    // 🔍 Détection des faces cachées
+    RunVisibility(brushes, entities, materials, region, expansion, job, settings);
+
+    // ✍️ Écriture du VMF optimisé
+    WriteOutput(job, settings, brushes, materials);
+
+    EmitReport(report, settings);
+}
+
+int Pipeline::RunBatch(const std::vector<Job>& jobs, const Settings& settings)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+
+    // Mode mémoire réduite : une map à la fois, le pipeline en garderait plusieurs
+    if (settings.lowMemory) {
+        int failures = 0;
+        for (const Job& job : jobs) {
+            try {
+                ProcessMap(job, settings);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Batch: " << job.input << " failed: " << e.what() << "\n";
+                ++failures;
+            }
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "Batch: " << (jobs.size() - failures) << "/" << jobs.size() << " maps optimized in "
+            << seconds << " s.\n";
+        return failures;
+    }
+
+    Slots slots(settings.maxInFlight);
+    Instances::Cache instanceCache;
+    StageQueue<std::unique_ptr<MapWork>> toVisibility;
+    StageQueue<std::unique_ptr<MapWork>> toWriter;
+    std::mutex logMutex;
+    int failures = 0;
+
+    auto fail = [&](const Job& job, const std::string& what) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cerr << "Batch: " << job.input << " failed: " << what << "\n";
+        ++failures;
+    };
+
+    // Stage 1 : parsing (une map ne démarre que si un slot est libre)
+    std::thread parser([&] {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            slots.Acquire();
+            auto work = std::make_unique<MapWork>();
+            work->index = i;
+            work->report.input = jobs[i].input;
+            work->report.output = jobs[i].output;
+            Profiler::Bind bind(settings.report.empty() ? nullptr : &work->report);
+            try {
+                // Parsing série : les threads sont déjà pris par la visibilité de la map précédente
+                work->brushes = LoadBrushes(jobs[i], settings, 1, work->entities, work->materials, work->region,
+                    instanceCache, work->instances);
+            }
+            catch (const std::exception& e) {
+                fail(jobs[i], e.what());
+                work->failed = true;
+            }
+            toVisibility.Push(std::move(work));
+        }
+        toVisibility.Close();
+    });
+
+    // Stage 3 : écriture
+    std::thread writer([&] {
+        std::unique_ptr<MapWork> work;
+        while (toWriter.Pop(work)) {
+            const Job& job = jobs[work->index];
+            if (!work->failed) {
+                Profiler::Bind bind(settings.report.empty() ? nullptr : &work->report);
+                try {
+                    WriteOutput(job, settings, work->brushes, work->materials);
+                }
+                catch (const std::exception& e) {
+                    fail(job, e.what());
+                }
+                std::lock_guard<std::mutex> lock(logMutex);
+                EmitReport(work->report, settings);
+            }
+            work.reset();       // libère la map avant de rendre le slot
+            slots.Release();
+        }
+    });
+
+    // Stage 2 : visibilité, sur ce thread (elle utilise son propre pool)
+    std::unique_ptr<MapWork> work;
+    while (toVisibility.Pop(work)) {
+        if (!work->failed) {
+            Profiler::Bind bind(settings.report.empty() ? nullptr : &work->report);
+            try {
+                RunVisibility(work->brushes, work->entities, work->materials, work->region, work->instances,
+                    jobs[work->index], settings);
+            }
+            catch (const std::exception& e) {
+                fail(jobs[work->index], e.what());
+                work->failed = true;
+            }
+        }
+        toWriter.Push(std::move(work));
+    }
+    toWriter.Close();
+
+    parser.join();
+    writer.join();
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Batch: " << (jobs.size() - failures) << "/" << jobs.size() << " maps optimized in "
+        << seconds << " s.\n";
+    return failures;
+}
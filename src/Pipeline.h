@@ -0,0 +1,51 @@
+﻿#pragma once
+#include "EntityPolicy.h"
+#include "Region.h"
+#include "Scalar.h"
+#include <string>
+#include <vector>
+
+// Map processing: parse -> visibility -> write, for one map or a batch.
+namespace Pipeline {
+    struct Job {
+        std::string input;
+        std::string output;
+    };
+
+    struct Settings {
+        unsigned threads = 1;       // visibility pass threads
+        bool useCache = false;      // geometry and incremental visibility caches next to each output
+        unsigned maxInFlight = 3;   // maps held in memory at once in batch mode
+        std::string report;         // "" (none), "text" (stdout) or "json" (ReportPathFor)
+        bool fill = false;          // also hide world faces the entities cannot reach (OutsideFill)
+        bool lowMemory = false;     // compact records and tiled visibility (LowMemory)
+        unsigned rays = 0;          // rays per sample point of the sampling pass (RayVisibility), 0 = off
+        bool hideRays = false;      // hide the faces no ray hit instead of only counting them
+        Precision precision = DEFAULT_PRECISION;    // visibility prefilter precision (same result)
+        bool comparePrecision = false;  // also run the double pass and report the faces that differ
+        EntityPolicy::Policy policy = EntityPolicy::Default();  // brushes that occlude / receive nodraw
+        Region region;              // part of each map to optimize (-region, -cordons), inactive = all
+        bool delta = false;         // output: a patch of the changed sides (Patch) instead of a copy
+        bool instances = false;     // expand func_instance placements before the visibility pass (Instances)
+    };
+
+    // Output path for input from a pattern: {name} = file name without
+    // extension, {dir} = directory of the input. A pattern without '{' is
+    // used as is.
+    std::string OutputPathFor(const std::string& input, const std::string& pattern);
+
+    // "<output>.report.json"
+    std::string ReportPathFor(const std::string& outputPath);
+
+    // Jobs for every *.vmf of a directory (sorted), or for every line of a
+    // list file (blank lines and lines starting with '#' are skipped).
+    std::vector<Job> CollectJobs(const std::string& dirOrListFile, const std::string& outputPattern);
+
+    // Parses, optimizes and writes one map. Throws on parse errors.
+    void ProcessMap(const Job& job, const Settings& settings);
+
+    // Runs the three stages as a pipeline: while map N is in the visibility
+    // pass, map N+1 is parsed and map N-1 written. At most maxInFlight maps
+    // are alive at any time. Returns the number of maps that failed.
+    int RunBatch(const std::vector<Job>& jobs, const Settings& settings);
+}
@@ -0,0 +1,238 @@
+﻿#include "PlaneIndex.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // Any orthonormal basis works here, the grid only needs distances to be
+    // preserved.
+    void CellBasis(const Vec3& n, Vec3& u, Vec3& v) {
+        Vec3 ref = (std::abs(n.z) < 0.9) ? Vec3(0.0, 0.0, 1.0) : Vec3(0.0, 1.0, 0.0);
+        u = Normalize(Cross(n, ref));
+        v = Normalize(Cross(n, u));
+    }
+
+    double AngleBetween(const Vec3& a, const Vec3& b) {
+        double d = Dot(a, b);
+        if (d > 1.0) d = 1.0;
+        if (d < -1.0) d = -1.0;
+        return std::acos(d);
+    }
+}
+
+// Octahedral mapping of a unit normal onto a NORMAL_RES x NORMAL_RES grid.
+int PlaneIndex::NormalCellKey(const Vec3& n) {
+    double s = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (s <= 0.0) return 0;
+    double px = n.x / s;
+    double py = n.y / s;
+    if (n.z < 0.0) {
+        double ox = (1.0 - std::abs(py)) * (px >= 0.0 ? 1.0 : -1.0);
+        double oy = (1.0 - std::abs(px)) * (py >= 0.0 ? 1.0 : -1.0);
+        px = ox;
+        py = oy;
+    }
+    int cx = static_cast<int>((px + 1.0) * 0.5 * NORMAL_RES);
+    int cy = static_cast<int>((py + 1.0) * 0.5 * NORMAL_RES);
+    cx = std::max(0, std::min(NORMAL_RES - 1, cx));
+    cy = std::max(0, std::min(NORMAL_RES - 1, cy));
+    return cy * NORMAL_RES + cx;
+}
+
+void PlaneIndex::Build(const FaceTable& table, double normalEps_, double planeEps_)
+{
+    normalEps = normalEps_;
+    planeEps = planeEps_;
+    faceCount = 0;
+    cells.clear();
+    cellLookup.clear();
+    entries.clear();
+    slabRows.clear();
+    grid.clear();
+
+    // 1. Assign every usable face to a normal cell (same rejection as the
+    //    visibility pass: non-occluders, degenerate normals and sides without
+    //    a polygon never cover anything).
+    std::vector<uint32_t> rows;
+    std::vector<int> faceCell;
+    std::vector<Vec3> normalSum;
+    for (uint32_t r = 0; r < table.count; ++r) {
+        const uint8_t usable = FaceTable::VALID_NORMAL | FaceTable::HAS_WINDING | FaceTable::OCCLUDER;
+        if ((table.flags[r] & usable) != usable) continue;
+
+        const Vec3 n = table.Normal(r);
+        const int key = NormalCellKey(n);
+        auto it = cellLookup.find(key);
+        int c;
+        if (it == cellLookup.end()) {
+            c = static_cast<int>(cells.size());
+            cellLookup.emplace(key, c);
+            cells.emplace_back();
+            normalSum.emplace_back();
+        }
+        else {
+            c = it->second;
+        }
+        normalSum[c] = normalSum[c] + n;
+        rows.push_back(r);
+        faceCell.push_back(c);
+    }
+    faceCount = rows.size();
+
+    for (size_t c = 0; c < cells.size(); ++c) {
+        Vec3 axis = Normalize(normalSum[c]);
+        if (Length(axis) < 0.5) axis = { 0.0, 0.0, 1.0 };   // degenerate sum, any axis is valid
+        cells[c].axis = axis;
+        CellBasis(axis, cells[c].u, cells[c].v);
+    }
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+        NormalCell& cell = cells[faceCell[i]];
+        cell.angle = std::max(cell.angle, AngleBetween(table.Normal(rows[i]), cell.axis));
+        cell.maxCenterLen = std::max(cell.maxCenterLen, Length(table.Center(rows[i])));
+    }
+
+    // 2. Opposing cells: nA.nB <= -(1 - eps) means angle(nA, -nB) <= maxAngle,
+    //    so cells whose cones are further apart than that can never match.
+    const double maxAngle = std::acos(std::max(-1.0, std::min(1.0, 1.0 - normalEps)));
+    for (size_t a = 0; a < cells.size(); ++a) {
+        for (size_t b = 0; b < cells.size(); ++b) {
+            Vec3 negB = cells[b].axis * -1.0;
+            double gap = AngleBetween(cells[a].axis, negB);
+            if (gap <= maxAngle + cells[a].angle + cells[b].angle + 1e-9) {
+                cells[a].opposing.push_back(static_cast<int>(b));
+            }
+        }
+    }
+
+    // 3. Plane slab + hierarchical 2D grid.
+    //    If the convex polygon fB covers COVER_RATIO (> 5/9) of the convex
+    //    polygon fA, the centroid P of fA lies inside fB projected on fA's plane
+    //    (Gruenbaum: any half-plane through the centroid holds >= 4/9 of the
+    //    area). With r = farthest winding vertex from fB.center, the projected
+    //    point is within r in the plane and r + planeEps along the normal, so
+    //    |P - fB.center| <= 2r + planeEps. fB is inserted in every grid cell of
+    //    that disc; a query only has to look at the cell of one point.
+    struct Pending {
+        GridKey key;
+        uint32_t face;
+    };
+    std::vector<Pending> pending;
+    pending.reserve(rows.size() * 2);
+    std::vector<Pending> bySlab;    // one per row, level and cell position unused
+    bySlab.reserve(rows.size());
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const uint32_t row = rows[i];
+        const Vec3 center = table.Center(row);
+        const int c = faceCell[i];
+        NormalCell& cell = cells[c];
+
+        const double radius = 2.0 * table.radius[row] + planeEps + SLACK;
+
+        int level = 0;
+        while (level < MAX_LEVEL && LevelSize(level) < 2.0 * radius) ++level;
+        const double size = LevelSize(level);
+
+        const int64_t slab = SlabKey(Dot(cell.axis, center));
+        const double cu = Dot(cell.u, center);
+        const double cv = Dot(cell.v, center);
+        const int32_t x0 = static_cast<int32_t>(std::floor((cu - radius) / size));
+        const int32_t x1 = static_cast<int32_t>(std::floor((cu + radius) / size));
+        const int32_t y0 = static_cast<int32_t>(std::floor((cv - radius) / size));
+        const int32_t y1 = static_cast<int32_t>(std::floor((cv + radius) / size));
+        for (int32_t gx = x0; gx <= x1; ++gx) {
+            for (int32_t gy = y0; gy <= y1; ++gy) {
+                pending.push_back({ { c, level, slab, gx, gy }, row });
+            }
+        }
+        bySlab.push_back({ { c, 0, slab, 0, 0 }, row });
+
+        auto it = std::lower_bound(cell.slabs.begin(), cell.slabs.end(), slab,
+            [](const Slab& s, int64_t k) { return s.key < k; });
+        if (it == cell.slabs.end() || it->key != slab) {
+            it = cell.slabs.insert(it, Slab{ slab, 0 });
+        }
+        it->levelMask |= 1u << level;
+    }
+
+    // Group the entries by key so every bucket is a contiguous range.
+    std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) {
+        if (a.key.cell != b.key.cell) return a.key.cell < b.key.cell;
+        if (a.key.slab != b.key.slab) return a.key.slab < b.key.slab;
+        if (a.key.level != b.key.level) return a.key.level < b.key.level;
+        if (a.key.gx != b.key.gx) return a.key.gx < b.key.gx;
+        if (a.key.gy != b.key.gy) return a.key.gy < b.key.gy;
+        return a.face < b.face;
+    });
+
+    entries.resize(pending.size());
+    grid.reserve(pending.size());
+    for (size_t i = 0; i < pending.size();) {
+        size_t j = i;
+        while (j < pending.size() && pending[j].key == pending[i].key) {
+            entries[j] = pending[j].face;
+            ++j;
+        }
+        grid.emplace(pending[i].key, Range{ static_cast<uint32_t>(i), static_cast<uint32_t>(j) });
+        i = j;
+    }
+
+    // Rows of every slab, each once, for the queries whose disc is too
+    // large for the grid (ForEachNear). Cells and their slabs come in order.
+    std::sort(bySlab.begin(), bySlab.end(), [](const Pending& a, const Pending& b) {
+        if (a.key.cell != b.key.cell) return a.key.cell < b.key.cell;
+        if (a.key.slab != b.key.slab) return a.key.slab < b.key.slab;
+        return a.face < b.face;
+    });
+    slabRows.resize(bySlab.size());
+    for (size_t i = 0; i < bySlab.size();) {
+        const int c = bySlab[i].key.cell;
+        const int64_t key = bySlab[i].key.slab;
+        Slab& slab = *std::lower_bound(cells[c].slabs.begin(), cells[c].slabs.end(), key,
+            [](const Slab& s, int64_t k) { return s.key < k; });
+        slab.rowsBegin = static_cast<uint32_t>(i);
+        for (; i < bySlab.size() && bySlab[i].key.cell == c && bySlab[i].key.slab == key; ++i) slabRows[i] = bySlab[i].face;
+        slab.rowsEnd = static_cast<uint32_t>(i);
+    }
+}
+
+int PlaneIndex::QueryCell(const Vec3& n) const
+{
+    // A query normal outside the cone of its cell is not covered by the
+    // opposing list computed at build time
+    auto it = cellLookup.find(NormalCellKey(n));
+    if (it == cellLookup.end()) return -1;
+    const NormalCell& cell = cells[it->second];
+    const double d = std::max(-1.0, std::min(1.0, Dot(n, cell.axis)));
+    return std::acos(d) <= cell.angle + 1e-9 ? it->second : -1;
+}
+
+void PlaneIndex::SlabRange(int c, const Vec3& n, double plane, int64_t& kLo, int64_t& kHi) const
+{
+    const NormalCell& cell = cells[c];
+
+    // Opposing faces satisfy 0 < Dot(n, cB) - plane <= planeEps. Along the
+    // cell axis: Dot(axis, cB) = -Dot(n, cB) + Dot(axis + n, cB).
+    const double err = Length(cell.axis + n) * cell.maxCenterLen;
+    kLo = SlabKey(-(plane + planeEps) - err - SLACK);
+    kHi = SlabKey(-plane + err + SLACK);
+}
+
+bool PlaneIndex::LookupCell(int cell, int64_t slab, int level, const Vec3& p, uint32_t& begin, uint32_t& end) const
+{
+    const NormalCell& c = cells[cell];
+    const double size = LevelSize(level);
+    return LookupCell(cell, slab, level,
+        static_cast<int32_t>(std::floor(Dot(c.u, p) / size)),
+        static_cast<int32_t>(std::floor(Dot(c.v, p) / size)), begin, end);
+}
+
+bool PlaneIndex::LookupCell(int cell, int64_t slab, int level, int32_t gx, int32_t gy, uint32_t& begin, uint32_t& end) const
+{
+    GridKey key{ cell, level, slab, gx, gy };
+    auto it = grid.find(key);
+    if (it == grid.end()) return false;
+    begin = it->second.begin;
+    end = it->second.end;
+    return true;
+}
@@ -0,0 +1,227 @@
+﻿#pragma once
+#include "FaceTable.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Spatial index used by the visibility pass to find the faces that can possibly
+// cover a given face (opposing normal, same plane, overlapping in the plane).
+//
+// Faces are bucketed in three levels:
+//   1. normal cell  : octahedral quantization of the unit normal
+//   2. plane slab   : quantized distance along the cell's mean axis
+//   3. 2D grid      : hierarchical grid in the cell's in-plane basis
+//
+// The buckets are conservative: every face that passes the exact tests of
+// Visibility::DetectHiddenFaces is returned by ForEachCandidate, so the
+// hidden set is the same as the brute-force O(F^2) loop.
+class PlaneIndex {
+public:
+    // Indexes the rows of the table; normalEps / planeEps: same tolerances
+    // as the visibility pass. The table must outlive the index.
+    void Build(const FaceTable& table, double normalEps, double planeEps);
+
+    // Calls fn(const uint32_t* rows, uint32_t count) with runs of FaceTable
+    // rows that may cover the face with unit normal n, plane distance plane
+    // (= Dot(n, center)) and whose winding has its centroid at queryPoint.
+    // Stops early when fn returns true; returns true if fn stopped.
+    template<typename Fn>
+    bool ForEachCandidate(const Vec3& n, double plane, const Vec3& queryPoint, Fn&& fn) const;
+
+    // Same opposing planes, but every row that may overlap the disc of the
+    // given radius around queryPoint (for coverage by several faces): all
+    // the grid cells under the disc are visited, so a row can come up more
+    // than once. A slab that would take more than maxLookups grid lookups
+    // is passed whole instead (each of its rows once). Returns the number
+    // of slabs passed whole.
+    template<typename Fn>
+    size_t ForEachNear(const Vec3& n, double plane, const Vec3& queryPoint, double radius, size_t maxLookups,
+        Fn&& fn) const;
+
+    size_t FaceCount() const { return faceCount; }
+    size_t CellCount() const { return cells.size(); }
+
+private:
+    struct Slab {
+        int64_t key = 0;
+        uint32_t levelMask = 0;  // bit k set if some face lives on grid level k
+        uint32_t rowsBegin = 0;  // its rows in slabRows
+        uint32_t rowsEnd = 0;
+    };
+
+    struct NormalCell {
+        Vec3 axis;               // normalized mean normal of the cell
+        Vec3 u, v;               // in-plane basis of the cell
+        double maxCenterLen = 0; // max |center| of the faces in the cell
+        double angle = 0;        // max angle between a member normal and axis
+        std::vector<int> opposing;   // cells that may hold opposing faces
+        std::vector<Slab> slabs;     // sorted by key
+    };
+
+    struct GridKey {
+        int32_t cell;
+        int32_t level;
+        int64_t slab;
+        int32_t gx, gy;
+        bool operator==(const GridKey& o) const {
+            return cell == o.cell && level == o.level && slab == o.slab && gx == o.gx && gy == o.gy;
+        }
+    };
+    struct GridKeyHash {
+        size_t operator()(const GridKey& k) const {
+            uint64_t h = static_cast<uint64_t>(k.slab) * 0x9E3779B97F4A7C15ull;
+            h ^= (static_cast<uint64_t>(static_cast<uint32_t>(k.gx)) << 32 | static_cast<uint32_t>(k.gy)) + 0x7F4A7C15ull + (h << 6) + (h >> 2);
+            h ^= (static_cast<uint64_t>(static_cast<uint32_t>(k.cell)) << 8 | static_cast<uint32_t>(k.level)) + (h << 6) + (h >> 2);
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+    };
+    struct Range {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+
+    static constexpr int NORMAL_RES = 64;      // octahedral cells per axis
+    static constexpr double SLAB_SIZE = 1.0;   // plane slab thickness (Hammer units)
+    static constexpr double GRID_BASE = 32.0;  // grid cell size at level 0
+    static constexpr int MAX_LEVEL = 31;
+    static constexpr double SLACK = 1e-3;      // absorbs floating-point rounding
+
+    static int NormalCellKey(const Vec3& n);
+    static int64_t SlabKey(double s) { return static_cast<int64_t>(std::floor(s / SLAB_SIZE)); }
+    static double LevelSize(int level) { return std::ldexp(GRID_BASE, level); }
+
+    bool LookupCell(int cell, int64_t slab, int level, const Vec3& p, uint32_t& begin, uint32_t& end) const;
+    bool LookupCell(int cell, int64_t slab, int level, int32_t gx, int32_t gy, uint32_t& begin, uint32_t& end) const;
+
+    // Cell holding the query normal, -1 if it is not in the index (every
+    // cell is then a possible opposing cell)
+    int QueryCell(const Vec3& n) const;
+
+    // Slab keys of cell c that may hold faces opposing the plane (n, plane)
+    void SlabRange(int c, const Vec3& n, double plane, int64_t& kLo, int64_t& kHi) const;
+
+    double normalEps = 0.0;
+    double planeEps = 0.0;
+    size_t faceCount = 0;
+    std::vector<NormalCell> cells;
+    std::unordered_map<int, int> cellLookup;     // NormalCellKey -> cells index
+    std::vector<uint32_t> entries;               // FaceTable rows, grouped by GridKey
+    std::vector<uint32_t> slabRows;              // FaceTable rows, grouped by cell and slab
+    std::unordered_map<GridKey, Range, GridKeyHash> grid;
+};
+
+template<typename Fn>
+bool PlaneIndex::ForEachCandidate(const Vec3& n, double plane, const Vec3& queryPoint, Fn&& fn) const
+{
+    if (cells.empty()) return false;
+
+    // Cell of the query normal: its opposing list was computed at build time.
+    const int self = QueryCell(n);
+
+    auto visitCell = [&](int c) -> bool {
+        const NormalCell& cell = cells[c];
+        int64_t kLo, kHi;
+        SlabRange(c, n, plane, kLo, kHi);
+
+        auto it = std::lower_bound(cell.slabs.begin(), cell.slabs.end(), kLo,
+            [](const Slab& s, int64_t k) { return s.key < k; });
+        for (; it != cell.slabs.end() && it->key <= kHi; ++it) {
+            uint32_t mask = it->levelMask;
+            while (mask) {
+                int level = 0;
+                while (!(mask & (1u << level))) ++level;
+                mask &= ~(1u << level);
+
+                uint32_t begin, end;
+                if (!LookupCell(c, it->key, level, queryPoint, begin, end)) continue;
+                if (fn(entries.data() + begin, end - begin)) return true;
+            }
+        }
+        return false;
+    };
+
+    if (self >= 0) {
+        for (int c : cells[self].opposing) {
+            if (visitCell(c)) return true;
+        }
+    }
+    else {
+        for (int c = 0; c < static_cast<int>(cells.size()); ++c) {
+            if (visitCell(c)) return true;
+        }
+    }
+    return false;
+}
+
+template<typename Fn>
+size_t PlaneIndex::ForEachNear(const Vec3& n, double plane, const Vec3& queryPoint, double radius, size_t maxLookups,
+    Fn&& fn) const
+{
+    if (cells.empty()) return 0;
+
+    std::vector<int> opposing;
+    const int self = QueryCell(n);
+    if (self >= 0) {
+        opposing = cells[self].opposing;
+    }
+    else {
+        for (int c = 0; c < static_cast<int>(cells.size()); ++c) opposing.push_back(c);
+    }
+
+    // A face that overlaps the disc has a point within radius of queryPoint
+    // and within its own insertion disc, so it is in the grid cell of that
+    // point: the cells under the square around the disc are enough.
+    struct Visit {
+        int cell;
+        int64_t slab;
+        int level;
+        int32_t x0, x1, y0, y1;
+    };
+    std::vector<Visit> visits;
+    size_t whole = 0;
+    for (int c : opposing) {
+        const NormalCell& cell = cells[c];
+        int64_t kLo, kHi;
+        SlabRange(c, n, plane, kLo, kHi);
+        const double cu = Dot(cell.u, queryPoint);
+        const double cv = Dot(cell.v, queryPoint);
+
+        auto it = std::lower_bound(cell.slabs.begin(), cell.slabs.end(), kLo,
+            [](const Slab& s, int64_t k) { return s.key < k; });
+        for (; it != cell.slabs.end() && it->key <= kHi; ++it) {
+            const size_t first = visits.size();
+            size_t lookups = 0;
+            for (int level = 0; level <= MAX_LEVEL; ++level) {
+                if (!(it->levelMask & (1u << level))) continue;
+                const double size = LevelSize(level);
+                Visit v{ c, it->key, level,
+                    static_cast<int32_t>(std::floor((cu - radius - SLACK) / size)),
+                    static_cast<int32_t>(std::floor((cu + radius + SLACK) / size)),
+                    static_cast<int32_t>(std::floor((cv - radius - SLACK) / size)),
+                    static_cast<int32_t>(std::floor((cv + radius + SLACK) / size)) };
+                lookups += static_cast<size_t>(v.x1 - v.x0 + 1) * static_cast<size_t>(v.y1 - v.y0 + 1);
+                if (lookups > maxLookups) break;
+                visits.push_back(v);
+            }
+            // Disc too large for the grid: every row of the slab, which is
+            // never fewer than the grid would give
+            if (lookups > maxLookups) {
+                visits.resize(first);
+                fn(slabRows.data() + it->rowsBegin, it->rowsEnd - it->rowsBegin);
+                ++whole;
+            }
+        }
+    }
+
+    for (const Visit& v : visits) {
+        for (int32_t gx = v.x0; gx <= v.x1; ++gx) {
+            for (int32_t gy = v.y0; gy <= v.y1; ++gy) {
+                uint32_t begin, end;
+                if (LookupCell(v.cell, v.slab, v.level, gx, gy, begin, end)) fn(entries.data() + begin, end - begin);
+            }
+        }
+    }
+    return whole;
+}
@@ -0,0 +1,143 @@
+﻿#include "Profiler.h"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+    thread_local Profiler::Report* current = nullptr;
+
+    template<typename T>
+    T* Find(std::vector<std::pair<std::string, T>>& items, const std::string& name) {
+        for (auto& item : items) {
+            if (item.first == name) return &item.second;
+        }
+        return nullptr;
+    }
+
+    std::string JsonString(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+                    out += buf;
+                }
+                else out += c;
+            }
+        }
+        return out + "\"";
+    }
+}
+
+void Profiler::Report::AddStage(const std::string& name, double seconds)
+{
+    if (double* s = Find(stages, name)) *s += seconds;
+    else stages.emplace_back(name, seconds);
+}
+
+void Profiler::Report::Add(const std::string& name, uint64_t value)
+{
+    if (uint64_t* c = Find(counters, name)) *c += value;
+    else counters.emplace_back(name, value);
+}
+
+void Profiler::Report::Set(const std::string& name, uint64_t value)
+{
+    if (uint64_t* c = Find(counters, name)) *c = value;
+    else counters.emplace_back(name, value);
+}
+
+Profiler::Bind::Bind(Report* report) : previous(current)
+{
+    current = report;
+}
+
+Profiler::Bind::~Bind()
+{
+    current = previous;
+}
+
+Profiler::Report* Profiler::Current()
+{
+    return current;
+}
+
+Profiler::Timer::Timer(const char* stage_) : stage(stage_), start(std::chrono::steady_clock::now())
+{
+}
+
+Profiler::Timer::~Timer()
+{
+    if (Report* r = Current()) {
+        r->AddStage(stage, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+uint64_t Profiler::PeakRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return static_cast<uint64_t>(pmc.PeakWorkingSetSize);
+#else
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss);          // bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;   // kilobytes
+#endif
+#endif
+}
+
+void Profiler::PrintText(const Report& report, std::ostream& out)
+{
+    out << "Report for " << report.input << ":\n";
+    for (const auto& s : report.stages) {
+        out << "  " << std::left << std::setw(24) << s.first << std::right << std::fixed << std::setprecision(3)
+            << s.second * 1000.0 << " ms\n";
+    }
+    out.unsetf(std::ios::fixed);
+    for (const auto& c : report.counters) {
+        out << "  " << std::left << std::setw(24) << c.first << std::right << c.second << "\n";
+    }
+}
+
+bool Profiler::WriteJson(const Report& report, const std::string& path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return false;
+
+    out << "{\n";
+    out << "  \"input\": " << JsonString(report.input) << ",\n";
+    out << "  \"output\": " << JsonString(report.output) << ",\n";
+    out << "  \"stages_seconds\": {";
+    for (size_t i = 0; i < report.stages.size(); ++i) {
+        out << (i ? ",\n" : "\n") << "    " << JsonString(report.stages[i].first) << ": "
+            << std::setprecision(9) << report.stages[i].second;
+    }
+    out << (report.stages.empty() ? "},\n" : "\n  },\n");
+    out << "  \"counters\": {";
+    for (size_t i = 0; i < report.counters.size(); ++i) {
+        out << (i ? ",\n" : "\n") << "    " << JsonString(report.counters[i].first) << ": " << report.counters[i].second;
+    }
+    out << (report.counters.empty() ? "}\n" : "\n  }\n");
+    out << "}\n";
+    return !out.fail();
+}
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Lightweight stage timers and counters.
+//
+// A Report collects the stage durations and counters of one map. The thread
+// working on a map binds its report with Profiler::Bind; Timer, Add and Set
+// do nothing when no report is bound, so the parser, the visibility pass and
+// the writer are instrumented unconditionally (bench included).
+namespace Profiler {
+    struct Report {
+        std::string input;
+        std::string output;
+        std::vector<std::pair<std::string, double>> stages;      // seconds, first-seen order
+        std::vector<std::pair<std::string, uint64_t>> counters;  // first-seen order
+
+        void AddStage(const std::string& name, double seconds);
+        void Add(const std::string& name, uint64_t value);
+        void Set(const std::string& name, uint64_t value);
+    };
+
+    // Binds a report to the calling thread for the lifetime of the object
+    class Bind {
+    public:
+        explicit Bind(Report* report);
+        ~Bind();
+        Bind(const Bind&) = delete;
+        Bind& operator=(const Bind&) = delete;
+    private:
+        Report* previous;
+    };
+
+    // Report bound to the calling thread, or nullptr
+    Report* Current();
+
+    // Adds the lifetime of the object to the stage of the bound report
+    class Timer {
+    public:
+        explicit Timer(const char* stage);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    private:
+        const char* stage;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    inline void Add(const char* counter, uint64_t value) {
+        if (Report* r = Current()) r->Add(counter, value);
+    }
+    inline void Set(const char* counter, uint64_t value) {
+        if (Report* r = Current()) r->Set(counter, value);
+    }
+
+    // Peak resident set size of the process in bytes (0 if unknown)
+    uint64_t PeakRss();
+
+    void PrintText(const Report& report, std::ostream& out);
+    bool WriteJson(const Report& report, const std::string& path);
+}
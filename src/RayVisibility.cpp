@@ -0,0 +1,250 @@
+﻿#include "RayVisibility.h"
+#include "BrushBvh.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "Winding.h"
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+
+namespace {
+    const double PI = 3.14159265358979323846;
+    const double MAX_DISTANCE = 1e6;            // well past Hammer's +-16384 map limits
+    const double MAX_SPACING = 4096.0;
+    const Vec3 LATTICE_OFFSET(1.37, 2.29, 3.41);  // off the Hammer grid: lattice points never lie on a side
+    const size_t SAMPLE_CHUNK = 4;
+
+    struct LatticePoint {
+        int64_t x, y, z;
+    };
+
+    uint64_t Key(const LatticePoint& l) {
+        const uint64_t mask = (1u << 21) - 1, bias = 1u << 20;
+        return ((static_cast<uint64_t>(l.x + bias) & mask) << 42) | ((static_cast<uint64_t>(l.y + bias) & mask) << 21)
+            | (static_cast<uint64_t>(l.z + bias) & mask);
+    }
+
+    // Fibonacci sphere: n directions of about the same solid angle
+    std::vector<Vec3> SphereDirections(unsigned n) {
+        std::vector<Vec3> dirs(n);
+        const double golden = PI * (3.0 - std::sqrt(5.0));
+        for (unsigned i = 0; i < n; ++i) {
+            const double z = 1.0 - 2.0 * (i + 0.5) / n;
+            const double r = std::sqrt(std::max(0.0, 1.0 - z * z));
+            dirs[i] = { r * std::cos(golden * i), r * std::sin(golden * i), z };
+        }
+        return dirs;
+    }
+
+    // Uniformly distributed rotation (Shoemake's random unit quaternion), as
+    // the rows of its matrix
+    void RandomRotation(std::mt19937& rng, Vec3 rows[3]) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        const double u1 = uniform(rng), u2 = uniform(rng), u3 = uniform(rng);
+        const double a = std::sqrt(1.0 - u1), b = std::sqrt(u1);
+        const double x = a * std::sin(2.0 * PI * u2), y = a * std::cos(2.0 * PI * u2);
+        const double z = b * std::sin(2.0 * PI * u3), w = b * std::cos(2.0 * PI * u3);
+        rows[0] = { 1.0 - 2.0 * (y * y + z * z), 2.0 * (x * y - z * w), 2.0 * (x * z + y * w) };
+        rows[1] = { 2.0 * (x * y + z * w), 1.0 - 2.0 * (x * x + z * z), 2.0 * (y * z - x * w) };
+        rows[2] = { 2.0 * (x * z - y * w), 2.0 * (y * z + x * w), 1.0 - 2.0 * (x * x + y * y) };
+    }
+
+    // Entity origins outside the brushes, then the lattice points reachable
+    // from them by straight unobstructed steps, breadth first. budgetHit if
+    // it stopped at maxSamples.
+    std::vector<Vec3> FloodSamples(const BrushBvh& bvh, const std::vector<Entity>& entities, double step,
+        size_t maxSamples, bool& leaked, bool& budgetHit) {
+        std::vector<Vec3> samples;
+        leaked = budgetHit = false;
+        const Vec3 lo = bvh.Min() - Vec3(step, step, step);
+        const Vec3 hi = bvh.Max() + Vec3(step, step, step);
+        auto inBounds = [&](const Vec3& p) {
+            return p.x >= lo.x && p.x <= hi.x && p.y >= lo.y && p.y <= hi.y && p.z >= lo.z && p.z <= hi.z;
+        };
+
+        Vec3 anchor;
+        bool hasAnchor = false;
+        auto position = [&](const LatticePoint& l) {
+            return anchor + Vec3(l.x * step, l.y * step, l.z * step);
+        };
+
+        std::unordered_set<uint64_t> seen;
+        std::deque<LatticePoint> queue;
+        for (const Entity& e : entities) {
+            if (!e.hasOrigin || bvh.Inside(e.origin)) continue;
+            if (samples.size() >= maxSamples) {
+                budgetHit = true;
+                break;
+            }
+            samples.push_back(e.origin);
+            if (!hasAnchor) {
+                anchor = e.origin + LATTICE_OFFSET;
+                hasAnchor = true;
+            }
+
+            // Enter the lattice at the nearest point, if nothing is in the way
+            const Vec3 rel = e.origin - anchor;
+            const LatticePoint l{ std::llround(rel.x / step), std::llround(rel.y / step), std::llround(rel.z / step) };
+            const Vec3 p = position(l);
+            if (seen.count(Key(l)) || !inBounds(p) || bvh.Inside(p)) continue;
+            const Vec3 d = p - e.origin;
+            BrushBvh::Hit hit;
+            if (bvh.Cast(e.origin, d, 1.0, hit)) continue;
+            seen.insert(Key(l));
+            queue.push_back(l);
+            if (samples.size() < maxSamples) samples.push_back(p);
+        }
+
+        const LatticePoint steps[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        while (!queue.empty() && !budgetHit) {
+            const LatticePoint l = queue.front();
+            queue.pop_front();
+            const Vec3 from = position(l);
+            for (const LatticePoint& s : steps) {
+                const LatticePoint n{ l.x + s.x, l.y + s.y, l.z + s.z };
+                const uint64_t key = Key(n);
+                if (seen.count(key)) continue;
+                const Vec3 to = position(n);
+                if (!inBounds(to)) {
+                    leaked = true;
+                    seen.insert(key);
+                    continue;
+                }
+                if (bvh.Inside(to)) {
+                    seen.insert(key);
+                    continue;
+                }
+                // A wall between the two points: n may still be reached from elsewhere
+                BrushBvh::Hit hit;
+                if (bvh.Cast(from, to - from, 1.0, hit)) continue;
+
+                seen.insert(key);
+                queue.push_back(n);
+                samples.push_back(to);
+                if (samples.size() >= maxSamples) {
+                    budgetHit = true;
+                    break;
+                }
+            }
+        }
+        return samples;
+    }
+}
+
+int RayVisibility::Run(std::vector<Brush>& brushes, const std::vector<Entity>& entities, const Settings& settings,
+    unsigned threads)
+{
+    Profiler::Timer timer("rays");
+
+    // 1. Exact brush bounds (side polygons), then the hierarchy over them
+    WindingPool windings;
+    std::vector<uint32_t> firstRow(brushes.size() + 1, 0);
+    BrushBvh bvh;
+    {
+        Profiler::Timer bvhTimer("rays.bvh");
+        windings.Build(brushes);
+        uint32_t row = 0;
+        for (size_t bi = 0; bi < brushes.size(); ++bi) {
+            firstRow[bi] = row;
+            brushes[bi].ComputeAABB(windings, row);
+            row += static_cast<uint32_t>(brushes[bi].faces.size());
+        }
+        firstRow[brushes.size()] = row;
+        bvh.Build(brushes);
+    }
+    Profiler::Add("ray_bvh_nodes", bvh.NodeCount());
+    if (bvh.Empty()) return 0;
+
+    // 2. Sample points; a map too big for the budget is sampled more coarsely
+    //    rather than only around the entities
+    bool leaked = false, budgetHit = false;
+    double spacing = settings.spacing;
+    std::vector<Vec3> samples;
+    {
+        Profiler::Timer samplesTimer("rays.samples");
+        for (;;) {
+            samples = FloodSamples(bvh, entities, spacing, settings.maxSamples, leaked, budgetHit);
+            if (!budgetHit || spacing >= MAX_SPACING) break;
+            spacing *= 2.0;
+        }
+    }
+    Profiler::Add("ray_samples", samples.size());
+    if (samples.empty()) {
+        std::cout << "Ray sampling: no entity to start from, skipped.\n";
+        return 0;
+    }
+
+    // 3. Rays; one hit mask per worker, merged afterwards
+    const uint32_t rows = firstRow[brushes.size()];
+    const std::vector<Vec3> directions = SphereDirections(settings.raysPerSample);
+    ThreadPool pool(threads);
+    std::vector<std::vector<uint8_t>> hitPerWorker(pool.Size());
+    std::vector<uint64_t> castPerWorker(pool.Size(), 0);
+    const auto start = std::chrono::steady_clock::now();
+    {
+        Profiler::Timer castTimer("rays.cast");
+        pool.ParallelFor(samples.size(), SAMPLE_CHUNK, [&](size_t begin, size_t end, unsigned worker) {
+            std::vector<uint8_t>& hitRows = hitPerWorker[worker];
+            if (hitRows.empty()) hitRows.assign(rows, 0);
+            for (size_t i = begin; i < end; ++i) {
+                // Seeded by sample: the result does not depend on the thread count
+                std::mt19937 rng(settings.seed * 2654435761u ^ static_cast<uint32_t>(i));
+                Vec3 r[3];
+                RandomRotation(rng, r);
+                BrushBvh::Hit hit;
+                for (const Vec3& d : directions) {
+                    const Vec3 dir(Dot(r[0], d), Dot(r[1], d), Dot(r[2], d));
+                    if (bvh.Cast(samples[i], dir, MAX_DISTANCE, hit)) hitRows[firstRow[hit.brush] + hit.face] = 1;
+                }
+                castPerWorker[worker] += directions.size();
+            }
+        });
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint8_t> hitRows(rows, 0);
+    uint64_t cast = 0;
+    for (unsigned w = 0; w < pool.Size(); ++w) {
+        cast += castPerWorker[w];
+        if (hitPerWorker[w].empty()) continue;
+        for (uint32_t r = 0; r < rows; ++r) hitRows[r] |= hitPerWorker[w][r];
+    }
+    Profiler::Add("rays_cast", cast);
+
+    // 4. Receivers never hit. A coarser lattice than requested (or a budget
+    //    reached) may have stepped over a corridor or a small room: the
+    //    faces seen only from there would get nodraw, so nothing is hidden.
+    //    Only brushes in the BVH (occluders) can be hit: a receive-only
+    //    brush is never a candidate
+    std::vector<Face*> candidates;
+    for (size_t bi = 0; bi < brushes.size(); ++bi) {
+        Brush& b = brushes[bi];
+        if (!(b.roles & ROLE_RECEIVER) || !(b.roles & ROLE_OCCLUDER)) continue;
+        for (size_t fi = 0; fi < b.faces.size(); ++fi) {
+            const uint32_t r = firstRow[bi] + static_cast<uint32_t>(fi);
+            Face& f = b.faces[fi];
+            if (f.hidden || hitRows[r] || windings.count[r] < 3) continue;
+            candidates.push_back(&f);
+        }
+    }
+    const bool complete = !budgetHit && spacing <= settings.spacing;
+    int hiddenCount = 0;
+    if (settings.hide && complete) {
+        for (Face* f : candidates) f->hidden = true;
+        hiddenCount = static_cast<int>(candidates.size());
+    }
+
+    std::cout << "Ray sampling: " << samples.size() << " samples (" << spacing << " units apart), " << cast << " rays ("
+        << (seconds > 0.0 ? cast / seconds / 1e6 : 0.0) << " Mrays/s), " << candidates.size() << " faces never hit"
+        << (hiddenCount ? ", hidden.\n" : " (candidates, left visible).\n");
+    if (budgetHit) std::cout << "Ray sampling: sample budget reached, parts of the map are unsampled.\n";
+    if (settings.hide && !complete && !candidates.empty())
+        std::cout << "Ray sampling: the lattice is coarser than " << settings.spacing << " units, candidates not hidden.\n";
+    if (leaked) std::cout << "Ray sampling: samples reach the outside of the map (leak); its outer faces stay visible.\n";
+    Profiler::Add("ray_candidates", candidates.size());
+    Profiler::Add("ray_hidden", static_cast<uint64_t>(hiddenCount));
+    return hiddenCount;
+}
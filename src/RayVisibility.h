@@ -0,0 +1,37 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sampling pass: casts rays from points a player can reach and hides the
+// faces no ray ever hits.
+//
+// Coverage (Visibility) only hides faces pressed against another brush; a
+// face that can only be seen through a gap, or not at all, is out of its
+// reach. Here the sample points are the entity origins plus a lattice
+// flood-filled from them through empty space (a rough navigation mesh). From
+// each point raysPerSample directions, evenly spread on the sphere and
+// randomly rotated per point, are cast against a BrushBvh of the occluders.
+// It is a sampling: a small face seen from far away, or a small room the
+// lattice steps over, may be missed. The faces no ray hit are therefore
+// only counted as candidates; they are hidden on request (hide), and only
+// when the whole map was sampled at the requested spacing.
+namespace RayVisibility {
+    struct Settings {
+        unsigned raysPerSample = 1024;
+        double spacing = 64.0;          // lattice step between samples (Hammer units)
+        size_t maxSamples = 8192;       // past that, the lattice step is doubled
+        uint32_t seed = 1;              // rotations of the ray sets (reproducible)
+        bool hide = false;              // hide the candidates instead of only counting them
+    };
+
+    // Counts the faces with a polygon that no ray hit (counter
+    // ray_candidates), among the brushes that both occlude and receive: a
+    // receive-only brush is not in the BVH, rays never hit it. With
+    // settings.hide, and if the lattice kept its spacing within the sample
+    // budget, adds their hidden flags (never clears one). Returns the number
+    // of faces it hid.
+    int Run(std::vector<Brush>& brushes, const std::vector<Entity>& entities, const Settings& settings,
+        unsigned threads);
+}
@@ -0,0 +1,44 @@
+﻿#include "Region.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <iostream>
+
+bool Region::Overlaps(const Vec3& min, const Vec3& max, double grow) const
+{
+    for (const Box& b : boxes) {
+        if (b.min.x - grow <= max.x && min.x <= b.max.x + grow && b.min.y - grow <= max.y && min.y <= b.max.y + grow
+            && b.min.z - grow <= max.z && min.z <= b.max.z + grow)
+            return true;
+    }
+    return false;
+}
+
+void Region::PlaneBounds(const Face* faces, size_t n, Vec3& min, Vec3& max)
+{
+    min = max = faces[0].p1;
+    for (size_t i = 0; i < n; ++i) {
+        for (const Vec3* p : { &faces[i].p1, &faces[i].p2, &faces[i].p3 }) {
+            min = { std::min(min.x, p->x), std::min(min.y, p->y), std::min(min.z, p->z) };
+            max = { std::max(max.x, p->x), std::max(max.y, p->y), std::max(max.z, p->z) };
+        }
+    }
+}
+
+size_t Region::Restrict(std::vector<Brush>& brushes) const
+{
+    size_t receivers = 0, occluders = 0;
+    for (Brush& b : brushes) {
+        if (b.faces.empty() || !(b.roles & ROLE_RECEIVER)) continue;
+        Vec3 min, max;
+        PlaneBounds(b.faces.data(), b.faces.size(), min, max);
+        if (Overlaps(min, max, 0.0)) {
+            ++receivers;
+            continue;
+        }
+        b.roles = static_cast<uint8_t>(b.roles & ~ROLE_RECEIVER);
+        ++occluders;
+    }
+    std::cout << "Region: " << receivers << " brushes inside, " << occluders << " around it occlude only.\n";
+    Profiler::Add("region_brushes", receivers);
+    return receivers;
+}
@@ -0,0 +1,35 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <vector>
+
+// Part of a map to optimize (-region, -cordons): a union of boxes.
+//
+// A solid is kept when the bounds of its plane points overlap a box grown
+// by margin; the others are skipped by the parser without building any face
+// and copied through by the writer. Only the kept solids that overlap a box
+// itself receive nodraw, the ring around them only occludes: a side of a
+// brush crossing the border can stay visible if what covers it lies further
+// than margin out.
+struct Region {
+    struct Box {
+        Vec3 min, max;
+    };
+
+    std::vector<Box> boxes;
+    bool useCordons = false;    // boxes read from the active cordons of each map
+    double margin = 128.0;      // occluders kept around the boxes (Hammer units)
+
+    // Restricts the parse (boxes or cordons given)
+    bool Active() const { return useCordons || !boxes.empty(); }
+
+    // Bounds overlap one of the boxes grown by grow (closed boxes)
+    bool Overlaps(const Vec3& min, const Vec3& max, double grow) const;
+
+    // Bounds of the plane points of n faces (n >= 1), the solid bounds the
+    // parser tests (Hammer writes three corners of each side)
+    static void PlaneBounds(const Face* faces, size_t n, Vec3& min, Vec3& max);
+
+    // Takes ROLE_RECEIVER away from the brushes outside the boxes. Returns
+    // the number of brushes left as receivers.
+    size_t Restrict(std::vector<Brush>& brushes) const;
+};
@@ -0,0 +1,111 @@
+﻿#pragma once
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+// 32-bit fixed point with 14 fraction bits (Q17.14): +-131072 with a step
+// of 1/16384. Products go through 64 bits; results out of range saturate.
+struct Fixed32 {
+    static constexpr int FRACTION_BITS = 14;
+    static constexpr double ONE = double(1 << FRACTION_BITS);
+
+    int32_t raw = 0;
+
+    Fixed32() = default;
+    Fixed32(double v) : raw(Saturate(std::llround(v * ONE))) {}     // rounded to nearest step
+
+    double ToDouble() const { return raw / ONE; }
+
+    static int32_t Saturate(long long v) {
+        if (v > std::numeric_limits<int32_t>::max()) return std::numeric_limits<int32_t>::max();
+        if (v < std::numeric_limits<int32_t>::min()) return std::numeric_limits<int32_t>::min();
+        return static_cast<int32_t>(v);
+    }
+    static Fixed32 FromRaw(long long v) {
+        Fixed32 f;
+        f.raw = Saturate(v);
+        return f;
+    }
+
+    Fixed32 operator+(Fixed32 o) const { return FromRaw(static_cast<long long>(raw) + o.raw); }
+    Fixed32 operator-(Fixed32 o) const { return FromRaw(static_cast<long long>(raw) - o.raw); }
+    Fixed32 operator-() const { return FromRaw(-static_cast<long long>(raw)); }
+    // Truncated toward -infinity: off by less than one step
+    Fixed32 operator*(Fixed32 o) const { return FromRaw((static_cast<long long>(raw) * o.raw) >> FRACTION_BITS); }
+
+    bool operator==(Fixed32 o) const { return raw == o.raw; }
+    bool operator!=(Fixed32 o) const { return raw != o.raw; }
+    bool operator<(Fixed32 o) const { return raw < o.raw; }
+    bool operator>(Fixed32 o) const { return raw > o.raw; }
+    bool operator<=(Fixed32 o) const { return raw <= o.raw; }
+    bool operator>=(Fixed32 o) const { return raw >= o.raw; }
+};
+
+inline Fixed32 abs(Fixed32 v) { return v.raw < 0 ? -v : v; }
+
+// Rounding error model of a scalar type, used to widen the tolerances of the
+// reduced-precision prefilter (FaceKernel::Prefilter) so that it never
+// rejects what the double test would accept:
+//   relError: relative error of a conversion or of one operation
+//   absError: absolute error of a conversion or of one operation
+//   safeMagnitude: largest |coordinate| whose differences and dot products
+//     with unit vectors still fit; rows beyond it are left to the double test
+template<typename T> struct ScalarTraits;
+
+template<> struct ScalarTraits<double> {
+    static constexpr const char* name = "double";
+    static constexpr double relError = 0.0;
+    static constexpr double absError = 0.0;
+    static constexpr double safeMagnitude = 1e300;
+    static double ToDouble(double v) { return v; }
+};
+
+template<> struct ScalarTraits<float> {
+    static constexpr const char* name = "float";
+    static constexpr double relError = 1.0 / (1 << 24);     // unit roundoff of a 24-bit mantissa
+    static constexpr double absError = 0.0;
+    static constexpr double safeMagnitude = 1e30;
+    static double ToDouble(float v) { return v; }
+};
+
+template<> struct ScalarTraits<Fixed32> {
+    static constexpr const char* name = "fixed";
+    static constexpr double relError = 0.0;
+    static constexpr double absError = 1.0 / Fixed32::ONE;
+    static constexpr double safeMagnitude = 30000.0;        // differences and dot products stay below 2^17
+    static double ToDouble(Fixed32 v) { return v.ToDouble(); }
+};
+
+// Scalar type of the visibility prefilter. Double runs the double kernel
+// alone; Float and Fixed add a reduced-precision prefilter in front of it
+// that only rejects candidates the double test would reject too, so the
+// result is the same (see Visibility::ComparePrecision).
+enum class Precision { Double, Float, Fixed };
+
+// Build-time default of -precision: define VMF_PRECISION_FLOAT or
+// VMF_PRECISION_FIXED
+#if defined(VMF_PRECISION_FIXED)
+constexpr Precision DEFAULT_PRECISION = Precision::Fixed;
+#elif defined(VMF_PRECISION_FLOAT)
+constexpr Precision DEFAULT_PRECISION = Precision::Float;
+#else
+constexpr Precision DEFAULT_PRECISION = Precision::Double;
+#endif
+
+inline const char* PrecisionName(Precision p) {
+    switch (p) {
+    case Precision::Float: return ScalarTraits<float>::name;
+    case Precision::Fixed: return ScalarTraits<Fixed32>::name;
+    default: return ScalarTraits<double>::name;
+    }
+}
+
+// "double", "float" or "fixed"; false for anything else
+inline bool ParsePrecision(const std::string& name, Precision& out) {
+    if (name == "double") out = Precision::Double;
+    else if (name == "float") out = Precision::Float;
+    else if (name == "fixed") out = Precision::Fixed;
+    else return false;
+    return true;
+}
@@ -0,0 +1,177 @@
+﻿#include "SolidGrid.h"
+#include "Winding.h"
+#include <cmath>
+
+void SolidGrid::Build(const std::vector<Brush>& brushes, const FaceTable& table)
+{
+    solids.clear();
+    nx.clear(); ny.clear(); nz.clear(); d.clear();
+    large.clear();
+    cellStart.clear();
+    entries.clear();
+    solids.reserve(brushes.size());
+    for (auto* a : { &nx, &ny, &nz, &d }) a->reserve(table.count);
+
+    // 1. Half-spaces and exact bounds of every occluder
+    for (size_t bi = 0; bi < brushes.size(); ++bi) {
+        const Brush& b = brushes[bi];
+        if (!(b.roles & ROLE_OCCLUDER)) continue;
+
+        Solid s;
+        bool hasVertex = false;
+        for (uint32_t r = table.brushFirstRow[bi]; r < table.brushFirstRow[bi + 1]; ++r) {
+            const Vec3* poly = table.windings.Polygon(r);
+            for (uint32_t k = 0; k < table.windings.count[r]; ++k) {
+                const Vec3& p = poly[k];
+                if (!hasVertex) { s.min = s.max = p; hasVertex = true; }
+                s.min = { std::min(s.min.x, p.x), std::min(s.min.y, p.y), std::min(s.min.z, p.z) };
+                s.max = { std::max(s.max.x, p.x), std::max(s.max.y, p.y), std::max(s.max.z, p.z) };
+            }
+        }
+        // A brush that is not closed has polygons running out to the clipping
+        // box of WindingPool: its half-spaces reach past any bounds
+        if (!hasVertex || std::max({ -s.min.x, -s.min.y, -s.min.z, s.max.x, s.max.y, s.max.z }) > MAX_COORD) continue;
+
+        const double outward = -Winding::InwardSign(b);
+        s.brushId = b.id;
+        s.firstPlane = static_cast<uint32_t>(d.size());
+        for (const Face& f : b.faces) {
+            if (Length(f.normal) < 1e-4) continue;
+            const Vec3 n = f.normal * outward;
+            nx.push_back(n.x);
+            ny.push_back(n.y);
+            nz.push_back(n.z);
+            d.push_back(Dot(n, f.p1));
+        }
+        s.planeCount = static_cast<uint32_t>(d.size()) - s.firstPlane;
+        if (s.planeCount < 4) {     // not a closed solid
+            nx.resize(s.firstPlane); ny.resize(s.firstPlane); nz.resize(s.firstPlane); d.resize(s.firstPlane);
+            continue;
+        }
+        solids.push_back(s);
+    }
+    if (solids.empty()) return;
+
+    // 2. Cell size: the mean brush size, grown until the grid fits the budget
+    Vec3 worldMin = solids[0].min, worldMax = solids[0].max;
+    double meanSize = 0.0;
+    for (const Solid& s : solids) {
+        worldMin = { std::min(worldMin.x, s.min.x), std::min(worldMin.y, s.min.y), std::min(worldMin.z, s.min.z) };
+        worldMax = { std::max(worldMax.x, s.max.x), std::max(worldMax.y, s.max.y), std::max(worldMax.z, s.max.z) };
+        const Vec3 e = s.max - s.min;
+        meanSize += std::max({ e.x, e.y, e.z });
+    }
+    meanSize /= static_cast<double>(solids.size());
+
+    origin = worldMin;
+    const Vec3 extent = worldMax - worldMin;
+    const double budget = static_cast<double>(CELLS_PER_SOLID * solids.size() + 64);
+    cell = std::max(MIN_CELL, meanSize);
+    for (;;) {
+        dims[0] = static_cast<int32_t>(extent.x / cell) + 1;
+        dims[1] = static_cast<int32_t>(extent.y / cell) + 1;
+        dims[2] = static_cast<int32_t>(extent.z / cell) + 1;
+        if (static_cast<double>(dims[0]) * dims[1] * dims[2] <= budget) break;
+        cell *= 1.25;
+    }
+
+    // 3. Counting sort of the solids into their cells
+    const size_t cellCount = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+    cellStart.assign(cellCount + 1, 0);
+    struct Range {
+        int32_t lo[3], hi[3];
+    };
+    std::vector<Range> ranges(solids.size());
+    auto forCells = [&](const Range& r, auto&& fn) {
+        for (int32_t z = r.lo[2]; z <= r.hi[2]; ++z) {
+            for (int32_t y = r.lo[1]; y <= r.hi[1]; ++y) {
+                for (int32_t x = r.lo[0]; x <= r.hi[0]; ++x) fn((static_cast<size_t>(z) * dims[1] + y) * dims[0] + x);
+            }
+        }
+    };
+    std::vector<uint8_t> inGrid(solids.size(), 0);
+    for (uint32_t i = 0; i < solids.size(); ++i) {
+        Range& r = ranges[i];
+        CellOf(solids[i].min, r.lo);
+        CellOf(solids[i].max, r.hi);
+        const int64_t span = static_cast<int64_t>(r.hi[0] - r.lo[0] + 1) * (r.hi[1] - r.lo[1] + 1) * (r.hi[2] - r.lo[2] + 1);
+        if (span > MAX_SPAN) {
+            large.push_back(i);
+            continue;
+        }
+        inGrid[i] = 1;
+        forCells(r, [&](size_t c) { cellStart[c + 1]++; });
+    }
+    for (size_t c = 0; c < cellCount; ++c) cellStart[c + 1] += cellStart[c];
+    entries.resize(cellStart[cellCount]);
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (uint32_t i = 0; i < solids.size(); ++i) {
+        if (!inGrid[i]) continue;
+        const Range& r = ranges[i];
+        forCells(r, [&](size_t c) {
+            entries[fill[c]++] = { solids[i].min, solids[i].max, { r.lo[0], r.lo[1], r.lo[2] }, i };
+        });
+    }
+}
+
+void SolidGrid::CellOf(const Vec3& p, int32_t c[3]) const
+{
+    const double q[3] = { (p.x - origin.x) / cell, (p.y - origin.y) / cell, (p.z - origin.z) / cell };
+    for (int a = 0; a < 3; ++a) {
+        // Clamped as doubles first: a query far outside the map stays in range
+        const double k = std::floor(std::min(std::max(q[a], 0.0), static_cast<double>(dims[a] - 1)));
+        c[a] = static_cast<int32_t>(k);
+    }
+}
+
+SolidGrid::Containment SolidGrid::Classify(uint32_t solid, const double* x, const double* y, const double* z,
+    uint32_t n, const Vec3& min, const Vec3& max, double eps) const
+{
+    const Solid& s = solids[solid];
+    if (!BoxesOverlap(s.min, s.max, min, max, eps)) return OUTSIDE;
+
+    bool inside = true;
+    for (uint32_t j = s.firstPlane; j < s.firstPlane + s.planeCount; ++j) {
+        const double a = nx[j], b = ny[j], c = nz[j], e = d[j];
+        double lo = a * x[0] + b * y[0] + c * z[0] - e;
+        double hi = lo;
+        for (uint32_t k = 1; k < n; ++k) {
+            const double dist = a * x[k] + b * y[k] + c * z[k] - e;
+            lo = std::min(lo, dist);
+            hi = std::max(hi, dist);
+        }
+        if (lo >= -eps) return OUTSIDE;     // all on or beyond this plane (a side it lies in, too)
+        if (hi > eps) inside = false;
+    }
+    return inside ? INSIDE : PARTIAL;
+}
+
+void SolidGrid::Section(uint32_t solid, const Vec3& normal, double plane, const Vec3& u, const Vec3& v,
+    const Winding::Point2* poly, size_t n, std::vector<Winding::Point2>& out) const
+{
+    // On the plane, p = u * pu + v * pv + normal * plane: each half-space of
+    // the solid becomes a half-plane of (pu, pv)
+    thread_local std::vector<Winding::Point2> next;
+    out.assign(poly, poly + n);
+    const Solid& s = solids[solid];
+    for (uint32_t j = s.firstPlane; j < s.firstPlane + s.planeCount && out.size() >= 3; ++j) {
+        const Vec3 m(nx[j], ny[j], nz[j]);
+        const double a = Dot(m, u), b = Dot(m, v), c = plane * Dot(m, normal) - d[j];
+        auto dist = [&](const Winding::Point2& p) { return a * p.u + b * p.v + c; };
+
+        next.clear();
+        const size_t count = out.size();
+        for (size_t i = 0; i < count; ++i) {
+            const Winding::Point2& p = out[i];
+            const Winding::Point2& q = out[i + 1 < count ? i + 1 : 0];
+            const double dp = dist(p);
+            const double dq = dist(q);
+            if (dp <= 0.0) next.push_back(p);
+            if ((dp <= 0.0) != (dq <= 0.0)) {
+                const double t = dp / (dp - dq);
+                next.push_back({ p.u + (q.u - p.u) * t, p.v + (q.v - p.v) * t });
+            }
+        }
+        out.swap(next);
+    }
+}
@@ -0,0 +1,117 @@
+﻿#pragma once
+#include "FaceTable.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Occluder brushes as sets of half-spaces, binned in a uniform grid over
+// their exact bounds (the vertices of their side polygons, not the face
+// centers). Used to find the sides buried inside other solids.
+//
+// A brush is stored in every cell its bounds touch, unless that is more
+// than MAX_SPAN cells (a skybox shell, a huge terrain block): those go in a
+// short list checked by every query. Each cell entry carries a copy of the
+// bounds, so a query reads its cells in sequence instead of jumping to every
+// neighbour's record. It reports each brush once, from the first cell shared
+// by the query box and the brush bounds.
+class SolidGrid {
+public:
+    enum Containment {
+        OUTSIDE,    // no point of the polygon is strictly inside the brush
+        PARTIAL,    // the polygon crosses at least one of its planes
+        INSIDE,     // every point is inside (within eps), and the polygon is not on a side
+    };
+
+    // Closed brushes with ROLE_OCCLUDER (polygons: rows of table)
+    void Build(const std::vector<Brush>& brushes, const FaceTable& table);
+
+    // Calls fn(uint32_t solid) for every solid whose bounds overlap the box
+    // by more than eps on every axis (the first test of Classify)
+    template<typename Fn>
+    void ForEachOverlapping(const Vec3& min, const Vec3& max, double eps, Fn&& fn) const;
+
+    // Where the polygon (n points, x/y/z arrays, bounded by min/max) lies
+    // relative to the solid. OUTSIDE at once unless the two boxes overlap by
+    // more than eps on every axis (neighbours touching the face's brush),
+    // then one pass per plane over all the points, stopping at the first
+    // plane that has every point on or outside it.
+    Containment Classify(uint32_t solid, const double* x, const double* y, const double* z, uint32_t n,
+        const Vec3& min, const Vec3& max, double eps) const;
+
+    // Part of a polygon of the plane (normal, plane) inside the solid, that
+    // polygon being given in the plane's (u, v) basis, counter-clockwise.
+    // out stays counter-clockwise; fewer than 3 points if nothing is left.
+    void Section(uint32_t solid, const Vec3& normal, double plane, const Vec3& u, const Vec3& v,
+        const Winding::Point2* poly, size_t n, std::vector<Winding::Point2>& out) const;
+
+    // The first test of Classify and ForEachOverlapping alone
+    bool Overlaps(uint32_t solid, const Vec3& min, const Vec3& max, double eps) const {
+        return BoxesOverlap(solids[solid].min, solids[solid].max, min, max, eps);
+    }
+
+    size_t Count() const { return solids.size(); }
+    int32_t BrushId(uint32_t solid) const { return solids[solid].brushId; }
+
+private:
+    static constexpr int64_t MAX_SPAN = 64;          // cells per brush before it goes in the large list
+    static constexpr double MIN_CELL = 16.0;         // Hammer units
+    static constexpr size_t CELLS_PER_SOLID = 4;     // grid size budget
+    static constexpr double MAX_COORD = 65536.0;     // 4x Hammer's limit, half of WindingPool's box
+
+    struct Solid {
+        Vec3 min, max;
+        int32_t brushId = -1;
+        uint32_t firstPlane = 0;
+        uint32_t planeCount = 0;
+    };
+
+    // One cache line per entry
+    struct Entry {
+        Vec3 min, max;
+        int32_t lo[3];          // first cell of the solid
+        uint32_t solid;
+    };
+
+    void CellOf(const Vec3& p, int32_t c[3]) const;
+
+    static bool BoxesOverlap(const Vec3& aMin, const Vec3& aMax, const Vec3& min, const Vec3& max, double eps) {
+        return aMin.x + eps < max.x && min.x + eps < aMax.x && aMin.y + eps < max.y && min.y + eps < aMax.y
+            && aMin.z + eps < max.z && min.z + eps < aMax.z;
+    }
+
+    std::vector<Solid> solids;
+    std::vector<double> nx, ny, nz, d;     // outward planes: inside where Dot(n, p) <= d
+    std::vector<uint32_t> large;
+
+    Vec3 origin;
+    double cell = MIN_CELL;
+    int32_t dims[3] = {};
+    std::vector<uint32_t> cellStart;       // dims[0] * dims[1] * dims[2] + 1 offsets into entries
+    std::vector<Entry> entries;
+};
+
+template<typename Fn>
+void SolidGrid::ForEachOverlapping(const Vec3& min, const Vec3& max, double eps, Fn&& fn) const
+{
+    for (uint32_t s : large) {
+        if (BoxesOverlap(solids[s].min, solids[s].max, min, max, eps)) fn(s);
+    }
+    if (entries.empty()) return;
+
+    int32_t lo[3], hi[3];
+    CellOf(min, lo);
+    CellOf(max, hi);
+    for (int32_t z = lo[2]; z <= hi[2]; ++z) {
+        for (int32_t y = lo[1]; y <= hi[1]; ++y) {
+            for (int32_t x = lo[0]; x <= hi[0]; ++x) {
+                const size_t c = (static_cast<size_t>(z) * dims[1] + y) * dims[0] + x;
+                for (uint32_t k = cellStart[c]; k < cellStart[c + 1]; ++k) {
+                    const Entry& e = entries[k];
+                    // Reported from the first cell of the common range only
+                    if (x != std::max(lo[0], e.lo[0]) || y != std::max(lo[1], e.lo[1]) || z != std::max(lo[2], e.lo[2])) continue;
+                    if (BoxesOverlap(e.min, e.max, min, max, eps)) fn(e.solid);
+                }
+            }
+        }
+    }
+}
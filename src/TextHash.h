@@ -0,0 +1,60 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// 64-bit hash of a text, 8 bytes per step (Fnv1a goes byte by byte, too
+// slow for a whole map). The text may be fed in pieces of any size: the
+// value only depends on the bytes.
+class TextHash {
+public:
+    void Add(std::string_view s) {
+        size_t i = 0;
+        // Bytes left over from the previous piece first
+        while (pending && i < s.size()) {
+            Keep(s[i++]);
+            if (pending == 8) {
+                Mix(word);
+                pending = 0;
+                word = 0;
+            }
+        }
+        for (; i + 8 <= s.size(); i += 8) {
+            uint64_t w;
+            std::memcpy(&w, s.data() + i, 8);
+            Mix(w);
+        }
+        for (; i < s.size(); ++i) Keep(s[i]);
+        bytes += s.size();
+    }
+
+    uint64_t Value() const {
+        uint64_t v = (h ^ word ^ bytes) * 0xC4CEB9FE1A85EC53ull;
+        return v ^ (v >> 29);
+    }
+
+    uint64_t Size() const { return bytes; }
+
+    static uint64_t Of(std::string_view s) {
+        TextHash t;
+        t.Add(s);
+        return t.Value();
+    }
+
+private:
+    // Same order as the memcpy of a whole word (little-endian)
+    void Keep(char c) {
+        word |= static_cast<uint64_t>(static_cast<unsigned char>(c)) << (8 * pending++);
+    }
+
+    void Mix(uint64_t w) {
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    uint64_t word = 0;      // last 1..7 bytes, not mixed yet
+    size_t pending = 0;
+    uint64_t bytes = 0;
+};
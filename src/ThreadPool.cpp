@@ -0,0 +1,126 @@
+﻿#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (threadCount == 0) threadCount = 1;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    // Worker 0 is the thread calling ParallelFor
+    for (unsigned i = 1; i < threadCount; ++i) {
+        threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+unsigned ThreadPool::DefaultThreadCount()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+bool ThreadPool::PopLocal(unsigned worker, Chunk& out)
+{
+    Queue& q = *queues[worker];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.chunks.empty()) return false;
+    out = q.chunks.back();
+    q.chunks.pop_back();
+    return true;
+}
+
+bool ThreadPool::Steal(unsigned worker, Chunk& out)
+{
+    const unsigned n = Size();
+    for (unsigned i = 1; i < n; ++i) {
+        Queue& q = *queues[(worker + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.chunks.empty()) continue;
+        out = q.chunks.front();
+        q.chunks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::RunChunks(unsigned worker)
+{
+    Chunk c;
+    while (PopLocal(worker, c) || Steal(worker, c)) {
+        (*body)(c.begin, c.end, worker);
+        remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ThreadPool::WorkerLoop(unsigned worker)
+{
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobReady.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            ++busyWorkers;
+        }
+
+        RunChunks(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            --busyWorkers;
+        }
+        jobDone.notify_all();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t chunk, const RangeFn& fn)
+{
+    if (count == 0) return;
+    if (chunk == 0) chunk = 1;
+
+    if (Size() == 1) {
+        for (size_t b = 0; b < count; b += chunk) fn(b, std::min(count, b + chunk), 0);
+        return;
+    }
+
+    // body and remaining are published before the chunks: a worker that is
+    // still spinning in RunChunks may grab a chunk as soon as it is queued.
+    const size_t chunks = (count + chunk - 1) / chunk;
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        body = &fn;
+        remaining.store(chunks, std::memory_order_release);
+    }
+
+    // Deal the chunks round-robin before waking anybody up
+    for (size_t i = 0; i < chunks; ++i) {
+        Queue& q = *queues[i % Size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.chunks.push_back({ i * chunk, std::min(count, (i + 1) * chunk) });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        ++generation;
+    }
+    jobReady.notify_all();
+
+    RunChunks(0);
+
+    // Every chunk is taken; wait for the ones still running elsewhere, and for
+    // all workers to leave RunChunks before body goes out of scope.
+    std::unique_lock<std::mutex> lock(jobMutex);
+    jobDone.wait(lock, [&] { return remaining.load(std::memory_order_acquire) == 0 && busyWorkers == 0; });
+    body = nullptr;
+}
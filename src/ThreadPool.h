@@ -0,0 +1,64 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing pool for data-parallel loops.
+//
+// ParallelFor cuts [0, count) into chunks and deals them round-robin to one
+// deque per worker. A worker pops its own chunks from the back and, once its
+// deque is empty, steals from the front of the others, so uneven chunk costs
+// (e.g. big brushes next to tiny ones) do not leave threads idle.
+// The calling thread takes part as worker 0.
+class ThreadPool {
+public:
+    // body(begin, end, worker) with worker in [0, Size())
+    using RangeFn = std::function<void(size_t, size_t, unsigned)>;
+
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned Size() const { return static_cast<unsigned>(queues.size()); }
+
+    // Blocks until every chunk has been processed.
+    void ParallelFor(size_t count, size_t chunk, const RangeFn& body);
+
+    // std::thread::hardware_concurrency(), never 0
+    static unsigned DefaultThreadCount();
+
+private:
+    struct Chunk {
+        size_t begin;
+        size_t end;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+
+    bool PopLocal(unsigned worker, Chunk& out);
+    bool Steal(unsigned worker, Chunk& out);
+    void RunChunks(unsigned worker);
+    void WorkerLoop(unsigned worker);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    const RangeFn* body = nullptr;
+    unsigned generation = 0;
+    unsigned busyWorkers = 0;
+    std::atomic<size_t> remaining{ 0 };
+    bool stopping = false;
+};
@@ -1,229 +1,703 @@
 ﻿#include "VMFParser.h"
-#include <fstream>
-#include <sstream>
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "Region.h"
+#include "ThreadPool.h"
+#include "VMFTokenizer.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <string>
-#include <regex>
 #include <stdexcept>
 
+namespace {
+    void SkipSpaces(std::string_view& s) {
+        size_t i = 0;
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t')) ++i;
+        s.remove_prefix(i);
+    }
 
-// Parse a string like "(12 34 56)" into Vec3
-Vec3 VMFParser::ParseVec3(const std::string& str) {
-    Vec3 v{};
-    // accept ints or floats, negatives
-    sscanf_s(str.c_str(), "(%lf %lf %lf)", &v.x, &v.y, &v.z);
-    return v;
-}
-
-std::vector<Brush> VMFParser::ParseVMF(const std::string& path) {
-    std::ifstream file(path);
-    if (!file.is_open()) throw std::runtime_error("Failed to open VMF file: " + path);
+    // std::from_chars does not accept a leading '+'
+    bool ParseNumber(std::string_view& s, double& out) {
+        SkipSpaces(s);
+        if (!s.empty() && s[0] == '+') s.remove_prefix(1);
+        auto res = std::from_chars(s.data(), s.data() + s.size(), out);
+        if (res.ec != std::errc()) return false;
+        s.remove_prefix(static_cast<size_t>(res.ptr - s.data()));
+        return true;
+    }
 
-    std::vector<Brush> brushes;
+    // Below this size the prescan and the merge cost more than they save
+    const size_t PARALLEL_MIN_BYTES = 1u << 20;
 
-    std::string rawLine;
-    int brushCounter = 0;
-    int faceCounter = 0;
+    // Solid block found by the prescan: from its "solid" word to its '}' included
+    struct SolidSpan {
+        size_t begin;
+        size_t end;
+        int entity;     // top-level entity index, -1 = world
+    };
 
-    // States
-    bool pendingSolid = false;   // we've seen "solid" but not yet its opening '{'
-    bool inSolid = false;        // currently inside a solid { ... }
-    int solidBraceDepth = 0;     // brace depth inside the current solid (counts nested braces)
+    bool IsBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+    }
 
-    bool pendingSide = false;    // we've seen "side" but not yet its opening '{'
-    bool inSide = false;         // currently inside a side { ... }
-    int sideBraceDepth = 0;      // brace depth inside the current side block
+    // Brace-depth scan finding every solid block, following the tokenizer's
+    // rules (strings end at '"' or at the end of the line, "//" comments
+    // only start between tokens) without building tokens. Strings, most of
+    // a VMF, are skipped with memchr. With cordons, the top-level "cordon"
+    // and "cordons" blocks are listed too. False if the text ends inside a
+    // solid.
+    bool PrescanSolids(std::string_view text, std::vector<SolidSpan>& spans, std::vector<SolidSpan>* cordons = nullptr) {
+        const char* s = text.data();
+        const size_t n = text.size();
+        size_t i = (n >= 3 && text.compare(0, 3, "\xEF\xBB\xBF") == 0) ? 3 : 0;
 
-    Brush currentBrush;
-    Face  currentFace;
+        std::string_view lastWord;
+        size_t lastWordAt = 0;
+        size_t depth = 0;
+        bool inSolid = false;
+        size_t solidDepth = 0;
+        size_t solidBegin = 0;
+        int entity = -1;
+        int entityCount = 0;
 
-    std::ostringstream sideBuffer; // accumulate lines inside a side block
+        while (i < n) {
+            const char c = s[i];
+            if (IsBlank(c)) {
+                ++i;
+            }
+            else if (c == '{') {
+                if (depth == 0 && lastWord == "entity") {
+                    entity = entityCount++;
+                }
+                else if (depth == 0 && cordons && (lastWord == "cordon" || lastWord == "cordons")) {
+                    cordons->push_back({ lastWordAt, 0, -1 });
+                }
+                else if (!inSolid && lastWord == "solid") {
+                    inSolid = true;
+                    solidDepth = depth;
+                    solidBegin = lastWordAt;
+                }
+                ++depth;
+                lastWord = {};
+                ++i;
+            }
+            else if (c == '}') {
+                if (depth > 0) {
+                    --depth;
+                    if (inSolid && depth == solidDepth) {
+                        spans.push_back({ solidBegin, i + 1, entity });
+                        inSolid = false;
+                    }
+                    if (depth == 0) {
+                        entity = -1;
+                        if (cordons && !cordons->empty() && cordons->back().end == 0) cordons->back().end = i + 1;
+                    }
+                }
+                lastWord = {};
+                ++i;
+            }
+            else if (c == '"') {
+                ++i;
+                while (i < n && s[i] != '"' && s[i] != '\n') ++i;
+                if (i < n && s[i] == '"') ++i;
+            }
+            else if (c == '/' && i + 1 < n && s[i + 1] == '/') {
+                const char* eol = static_cast<const char*>(std::memchr(s + i, '\n', n - i));
+                i = eol ? static_cast<size_t>(eol - s) : n;
+            }
+            else {
+                const size_t begin = i;
+                while (i < n && !IsBlank(s[i]) && s[i] != '{' && s[i] != '}' && s[i] != '"') ++i;
+                lastWord = text.substr(begin, i - begin);
+                lastWordAt = begin;
+            }
+        }
+        return !inSolid;
+    }
 
-    auto trim = [](std::string& s) {
-        size_t a = s.find_first_not_of(" \t\r\n");
-        if (a == std::string::npos) { s.clear(); return; }
-        size_t b = s.find_last_not_of(" \t\r\n");
-        s = s.substr(a, b - a + 1);
-        };
+    // Value of the "id" key of the solid starting at begin (before its first
+    // child block), -1 if there is none
+    int SolidId(std::string_view text, size_t begin) {
+        VMFTokenizer tokenizer(text, begin);
+        if (tokenizer.Next().type != VMFToken::Word || tokenizer.Next().type != VMFToken::Open) return -1;
+        for (;;) {
+            const VMFToken key = tokenizer.Next();
+            if (key.type != VMFToken::String) return -1;
+            const VMFToken value = tokenizer.Next();
+            if (value.type != VMFToken::String) return -1;
+            if (key.text == "id") {
+                int id = -1;
+                std::from_chars(value.text.data(), value.text.data() + value.text.size(), id);
+                return id;
+            }
+        }
+    }
 
-    // regex to capture vectors like "(x y z)" (integers or floats, negative allowed)
-    std::regex vecRegex(R"(\(\s*([+-]?\d+\.?\d*)\s+([+-]?\d+\.?\d*)\s+([+-]?\d+\.?\d*)\s*\))");
+    // "(x y z)" of a cordon box
+    bool ParseCorner(std::string_view s, Vec3& out) {
+        SkipSpaces(s);
+        if (!s.empty() && s[0] == '(') s.remove_prefix(1);
+        return ParseNumber(s, out.x) && ParseNumber(s, out.y) && ParseNumber(s, out.z);
+    }
 
-    while (std::getline(file, rawLine)) {
-        std::string line = rawLine;
-        trim(line);
-        if (line.empty()) continue;
+    // Boxes of the active cordons. A "cordons" block (Hammer of the 2013 SDK
+    // and later) has an "active" switch and cordons of one or more "box"
+    // blocks, each cordon with its own "active"; an older "cordon" block is
+    // a single box with its "active". Boxes with min > max (Hammer's unused
+    // default) are dropped.
+    void ReadCordons(std::string_view text, const std::vector<SolidSpan>& blocks, std::vector<Region::Box>& boxes) {
+        for (const SolidSpan& block : blocks) {
+            VMFTokenizer tokenizer(text.substr(0, block.end ? block.end : text.size()), block.begin);
+            std::vector<std::string_view> stack;    // names of the open blocks
+            std::string_view lastWord, key;
+            bool haveKey = false;
+            bool switchOn = true;       // "active" of the cordons block
+            bool cordonOn = true;       // "active" of the cordon being read
+            bool hasMin = false, hasMax = false;
+            Region::Box box;
+            std::vector<Region::Box> cordonBoxes, found;
+            auto takeBox = [&]() {
+                if (hasMin && hasMax && box.min.x <= box.max.x && box.min.y <= box.max.y && box.min.z <= box.max.z)
+                    cordonBoxes.push_back(box);
+                hasMin = hasMax = false;
+            };
 
-        // Detect tokens even if '{' or other tokens are on separate lines.
-        // Handle solid start
-        if (!inSolid && !pendingSolid) {
-            // "solid" token (may be "solid" alone or "solid <something>")
-            if (line.size() >= 5 && line.rfind("solid", 0) == 0) {
-                pendingSolid = true;
-                // don't create brush yet, wait for opening brace
-                continue;
+            for (VMFToken tok = tokenizer.Next(); tok.type != VMFToken::End; tok = tokenizer.Next()) {
+                if (tok.type == VMFToken::Word) {
+                    lastWord = tok.text;
+                }
+                else if (tok.type == VMFToken::Open) {
+                    stack.push_back(lastWord);
+                    if (lastWord == "cordon") {
+                        cordonOn = true;
+                        cordonBoxes.clear();
+                    }
+                    hasMin = hasMax = false;
+                    lastWord = {};
+                }
+                else if (tok.type == VMFToken::Close) {
+                    if (stack.empty()) break;
+                    const std::string_view name = stack.back();
+                    stack.pop_back();
+                    if (name == "box") takeBox();
+                    else if (name == "cordon") {
+                        takeBox();      // older format: mins / maxs in the cordon itself
+                        if (cordonOn) found.insert(found.end(), cordonBoxes.begin(), cordonBoxes.end());
+                    }
+                    if (stack.empty()) break;
+                }
+                else if (!haveKey) {
+                    key = tok.text;
+                    haveKey = true;
+                    continue;
+                }
+                else if (!stack.empty()) {
+                    const std::string_view name = stack.back();
+                    if (key == "active" && name == "cordons") switchOn = tok.text != "0";
+                    else if (key == "active" && name == "cordon") cordonOn = tok.text != "0";
+                    else if (key == "mins") hasMin = ParseCorner(tok.text, box.min);
+                    else if (key == "maxs") hasMax = ParseCorner(tok.text, box.max);
+                }
+                haveKey = false;
             }
+            if (switchOn) boxes.insert(boxes.end(), found.begin(), found.end());
         }
+    }
 
-        // If pendingSolid and we hit an opening brace, we officially enter the solid
-        if (pendingSolid && line.find("{") != std::string::npos) {
-            pendingSolid = false;
-            inSolid = true;
-            solidBraceDepth = 1; // opened the solid block
-            currentBrush = Brush();
-            currentBrush.id = brushCounter++;
-            continue;
+    // Bounds of the plane points of a solid block, without tokenizing it:
+    // the "plane" keys are found with a substring search and only their
+    // values are read. All the work spent on a solid away from the region.
+    // False if no side has a valid plane.
+    bool PlaneBounds(std::string_view text, const SolidSpan& solid, Vec3& min, Vec3& max) {
+        const std::string_view block = text.substr(0, solid.end);
+        bool any = false;
+        for (size_t pos = block.find("plane\"", solid.begin); pos != std::string_view::npos; pos = block.find("plane\"", pos)) {
+            // "plane" as a whole key: a quote before it, the value's quote after it
+            const bool key = pos > 0 && block[pos - 1] == '"';
+            pos += 6;
+            if (!key) continue;
+            while (pos < block.size() && (block[pos] == ' ' || block[pos] == '\t')) ++pos;
+            if (pos >= block.size() || block[pos] != '"') continue;
+            const size_t begin = ++pos;
+            while (pos < block.size() && block[pos] != '"' && block[pos] != '\n') ++pos;
+            Vec3 p[3];
+            if (!VMFParser::ParsePlane(block.substr(begin, pos - begin), p[0], p[1], p[2])) continue;
+            if (!any) {
+                min = max = p[0];
+                any = true;
+            }
+            for (const Vec3& q : p) {
+                min = { std::min(min.x, q.x), std::min(min.y, q.y), std::min(min.z, q.z) };
+                max = { std::max(max.x, q.x), std::max(max.y, q.y), std::max(max.z, q.z) };
+            }
         }
+        return any;
+    }
+
+    // Streaming parse: once a solid closes with at least minFaces faces in
+    // out, take(out, offset) is called and the brushes and faces of out are
+    // cleared (ids start at 0 again); the text before offset is not read again
+    struct Flush {
+        size_t minFaces;
+        std::function<void(ParsedMap&, size_t)> take;
+    };
+
+    // The block state machine. Tokens are read from text[begin]; solids
+    // become brush ranges of out and top-level entity blocks entities of out.
+    //   skip  : solids parsed elsewhere (sorted), jumped over
+    //   single: the text starts at a solid (of the given entity) and the
+    //           parse stops once it is closed
+    //   flush : streaming parse (optional)
+    // Brush and face ids are indices in out.
+    void ParseBlocks(std::string_view text, size_t begin, const std::vector<SolidSpan>* skip, bool single,
+        int entity, ParsedMap& out, const Flush* flush = nullptr) {
+        std::vector<Face>& faces = out.faces;
+        std::vector<ParsedMap::BrushRange>& brushes = out.brushes;
+        std::vector<Entity>& entities = out.entities;
 
-        // If already inSolid, we must track braces and detect side blocks and end of solid
-        if (inSolid) {
-            // Opening brace inside solid increases depth
-            if (line.find("{") != std::string::npos) {
-                // If we're starting a side block and the '{' belongs to side, we'll handle below.
-                // But keep generic: update depth
-                solidBraceDepth++;
-            }
-            // Closing brace reduces depth; if it matches solid's root, close solid.
-            if (line.find("}") != std::string::npos) {
-                solidBraceDepth--;
-                // If we were in a side and encountered a '}', it might end the side — but handled in side flow.
-                if (!inSide && solidBraceDepth == 0) {
-                    // end of solid
-                    if (!currentBrush.faces.empty()) currentBrush.ComputeAABB();
-                    brushes.push_back(currentBrush);
-                    inSolid = false;
-                }
-                // continue processing (we still may have other tokens on the same line, but typically not)
-            }
-
-            // Detect side start even if '{' on next line
-            if (!inSide && !pendingSide) {
-                if (line.size() >= 4 && line.rfind("side", 0) == 0) {
-                    pendingSide = true;
-                    // Wait for its '{' to actually begin side content
-                    // but a following "{" may be on the same line or next lines
-                    // do not continue here, need to handle same-line '{' below
-                }
-            }
-
-            // If pendingSide and the current line contains '{', start the side
-            if (pendingSide && line.find("{") != std::string::npos) {
-                pendingSide = false;
-                inSide = true;
-                sideBraceDepth = 1;
-                currentFace = Face();
-                currentFace.id = faceCounter++;
-                currentFace.brushID = currentBrush.id;
-                sideBuffer.str("");
-                sideBuffer.clear();
-                // If there is additional content on the same line after '{', ignore (rare)
-                continue;
-            }
-
-            // If we were not pending side but line contains "side" and "{" on same line (e.g., "side {")
-            if (!inSide && line.find("side") != std::string::npos && line.find("{") != std::string::npos) {
-                inSide = true;
-                sideBraceDepth = 1;
-                currentFace = Face();
-                currentFace.id = faceCounter++;
-                currentFace.brushID = currentBrush.id;
-                sideBuffer.str("");
-                sideBuffer.clear();
-                continue;
-            }
-
-            // If we're inside a side, accumulate its content and watch for its braces
-            if (inSide) {
-                // If the line contains a '{' increase nested depth for the side block
-                if (line.find("{") != std::string::npos) {
-                    sideBraceDepth++;
-                }
-                // If the line contains a '}', decrease depth and maybe end side
-                if (line.find("}") != std::string::npos) {
-                    sideBraceDepth--;
-                    if (sideBraceDepth == 0) {
-                        // end of side block -> parse accumulated content
-                        std::string sideText = sideBuffer.str();
-                        std::istringstream ss(sideText);
-                        std::string sline;
-                        while (std::getline(ss, sline)) {
-                            trim(sline);
-                            if (sline.empty()) continue;
-
-                            // parse plane lines
-                            if (sline.find("\"plane\"") != std::string::npos) {
-                                std::vector<Vec3> verts;
-                                for (std::sregex_iterator it(sline.begin(), sline.end(), vecRegex), end; it != end; ++it) {
-                                    std::smatch m = *it;
-                                    Vec3 v{};
-                                    v.x = std::stod(m[1].str());
-                                    v.y = std::stod(m[2].str());
-                                    v.z = std::stod(m[3].str());
-                                    verts.push_back(v);
-                                }
-                                if (verts.size() >= 3) {
-                                    currentFace.p1 = verts[0];
-                                    currentFace.p2 = verts[1];
-                                    currentFace.p3 = verts[2];
-                                    currentFace.ComputeDerived();
-                                }
-                                continue;
-                            }
-
-                            // parse material lines
-                            if (sline.find("\"material\"") != std::string::npos) {
-                                size_t lastQ = sline.rfind('\"');
-                                if (lastQ != std::string::npos) {
-                                    size_t prevQ = sline.rfind('\"', lastQ - 1);
-                                    if (prevQ != std::string::npos && lastQ > prevQ) {
-                                        currentFace.material = sline.substr(prevQ + 1, lastQ - prevQ - 1);
-                                    }
-                                }
-                                continue;
-                            }
-
-                            // other side-level keys are ignored for parsing faces
+        // Block nesting. Only top-level "entity" blocks, "solid" (outside
+        // another solid) and its direct "side" children matter; everything else
+        // (world, editor, vertices_plus, dispinfo...) is walked over.
+        enum class Block { Other, Entity, Solid, Side };
+        std::vector<Block> stack;
+        stack.reserve(16);
+        bool inSolid = false;
+        int openEntity = single ? entity : -1;  // index in entities while inside an entity block
+        size_t nextSkip = 0;
+
+        Face currentFace;
+
+        VMFTokenizer tokenizer(text, begin);
+        std::string_view lastWord;   // block name waiting for its '{'
+        std::string_view pendingKey; // key waiting for its value
+        bool haveKey = false;
+
+        auto finishSide = [&]() {
+            faces.push_back(currentFace);
+        };
+        auto finishSolid = [&]() {
+            brushes.back().faceCount = static_cast<uint32_t>(faces.size()) - brushes.back().firstFace;
+            inSolid = false;
+        };
+
+        for (VMFToken tok = tokenizer.Next(); tok.type != VMFToken::End; tok = tokenizer.Next()) {
+            switch (tok.type) {
+            case VMFToken::Word:
+                if (skip && nextSkip < skip->size() && tok.offset == (*skip)[nextSkip].begin) {
+                    // Same state as after the solid's closing brace
+                    tokenizer = VMFTokenizer(text, (*skip)[nextSkip++].end);
+                    lastWord = {};
+                    haveKey = false;
+                    break;
+                }
+                lastWord = tok.text;
+                haveKey = false;
+                break;
+
+            case VMFToken::Open: {
+                Block kind = Block::Other;
+                if (stack.empty() && lastWord == "entity") {
+                    kind = Block::Entity;
+                    openEntity = static_cast<int>(entities.size());
+                    entities.emplace_back();
+                }
+                else if (!inSolid && lastWord == "solid") {
+                    kind = Block::Solid;
+                    inSolid = true;
+                    ParsedMap::BrushRange b;
+                    b.id = static_cast<int>(brushes.size());
+                    b.entity = openEntity;
+                    b.firstFace = static_cast<uint32_t>(faces.size());
+                    brushes.push_back(b);
+                }
+                else if (!stack.empty() && stack.back() == Block::Solid && lastWord == "side") {
+                    kind = Block::Side;
+                    currentFace = Face();
+                    currentFace.id = static_cast<int>(faces.size());
+                    currentFace.brushID = brushes.back().id;
+                }
+                stack.push_back(kind);
+                lastWord = {};
+                haveKey = false;
+                break;
+            }
+
+            case VMFToken::Close:
+                if (!stack.empty()) {
+                    Block kind = stack.back();
+                    stack.pop_back();
+                    if (kind == Block::Side) {
+                        currentFace.sideEndOffset = static_cast<int64_t>(tok.offset);
+                        finishSide();
+                    }
+                    else if (kind == Block::Solid) {
+                        finishSolid();
+                        if (flush && faces.size() >= flush->minFaces) {
+                            flush->take(out, tok.offset + 1);
+                            faces.clear();
+                            brushes.clear();
                         }
+                    }
+                    else if (kind == Block::Entity) openEntity = -1;
+                }
+                lastWord = {};
+                haveKey = false;
+                if (single && stack.empty()) return;
+                break;
 
-                        // push face into current brush (even if plane was not found, face object kept)
-                        currentBrush.faces.push_back(currentFace);
-                        inSide = false;
-                        continue;
+            case VMFToken::String:
+                if (!haveKey) {
+                    pendingKey = tok.text;
+                    haveKey = true;
+                    break;
+                }
+                // key/value pair complete
+                if (!stack.empty() && stack.back() == Block::Side) {
+                    if (pendingKey == "plane") {
+                        Vec3 p1, p2, p3;
+                        if (VMFParser::ParsePlane(tok.text, p1, p2, p3)) {
+                            currentFace.p1 = p1;
+                            currentFace.p2 = p2;
+                            currentFace.p3 = p3;
+                            currentFace.ComputeDerived();
+                        }
+                    }
+                    else if (pendingKey == "id") {
+                        std::from_chars(tok.text.data(), tok.text.data() + tok.text.size(), currentFace.sideId);
+                    }
+                    else if (pendingKey == "material") {
+                        currentFace.material = out.materials.Intern(tok.text);
+                        currentFace.materialOffset = static_cast<int64_t>(tok.offset);
+                        currentFace.materialLength = static_cast<int32_t>(tok.text.size());
                     }
+                    // other side-level keys are ignored for parsing faces
+                }
+                else if (!stack.empty() && stack.back() == Block::Entity) {
+                    Entity& e = entities[openEntity];
+                    if (pendingKey == "classname") {
+                        e.classname.assign(tok.text.data(), tok.text.size());
+                    }
+                    else if (pendingKey == "origin") {
+                        std::string_view v = tok.text;
+                        e.hasOrigin = ParseNumber(v, e.origin.x) && ParseNumber(v, e.origin.y) && ParseNumber(v, e.origin.z);
+                    }
+                    else if (pendingKey == "angles") {
+                        std::string_view v = tok.text;
+                        Vec3 a;
+                        if (ParseNumber(v, a.x) && ParseNumber(v, a.y) && ParseNumber(v, a.z)) e.angles = a;
+                    }
+                    else if (pendingKey == "file") {
+                        e.file.assign(tok.text.data(), tok.text.size());
+                    }
+                }
+                haveKey = false;
+                break;
+
+            case VMFToken::End:
+                break;
+            }
+        }
+
+        // End of file: if a solid is still open, finalize it
+        for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+            if (*it == Block::Side) finishSide();
+            else if (*it == Block::Solid) finishSolid();
+        }
+    }
+
+    // Parses the solids of spans on the pool in chunks of about the same
+    // size, the entities on the side (jumping over every solid of skip),
+    // then appends the chunks in file order: ids come out the same as with
+    // the serial parse.
+    void ParseParallel(std::string_view text, const std::vector<SolidSpan>& spans, const std::vector<SolidSpan>& skip,
+        unsigned threads, ParsedMap& map) {
+        size_t bytes = 0;
+        for (const SolidSpan& s : spans) bytes += s.end - s.begin;
+        const size_t chunkCount = std::min(spans.size(), static_cast<size_t>(threads) * 4);
+        const size_t target = bytes / chunkCount + 1;
+
+        std::vector<size_t> chunkFirst{ 0 };   // first span of each chunk, plus a final sentinel
+        size_t filled = 0;
+        for (size_t i = 0; i < spans.size(); ++i) {
+            filled += spans[i].end - spans[i].begin;
+            if (filled >= target && i + 1 < spans.size()) {
+                chunkFirst.push_back(i + 1);
+                filled = 0;
+            }
+        }
+        chunkFirst.push_back(spans.size());
+        const size_t chunks = chunkFirst.size() - 1;
+
+        std::vector<ParsedMap> parts(chunks);
+        ThreadPool pool(threads);
+        pool.ParallelFor(chunks + 1, 1, [&](size_t begin, size_t end, unsigned) {
+            for (size_t c = begin; c < end; ++c) {
+                if (c == chunks) {
+                    ParseBlocks(text, 0, &skip, false, -1, map);
+                    continue;
                 }
+                ParsedMap& part = parts[c];
+                size_t sides = 0;
+                for (size_t i = chunkFirst[c]; i < chunkFirst[c + 1]; ++i) sides += (spans[i].end - spans[i].begin) / 256;
+                part.faces.reserve(sides + 16);
+                part.brushes.reserve(chunkFirst[c + 1] - chunkFirst[c]);
+                for (size_t i = chunkFirst[c]; i < chunkFirst[c + 1]; ++i)
+                    ParseBlocks(text, spans[i].begin, nullptr, true, spans[i].entity, part);
+            }
+        });
+
+        Profiler::Timer timer("parse.merge");
+        std::vector<uint32_t> faceFirst(chunks + 1, 0), brushFirst(chunks + 1, 0);
+        std::vector<std::vector<uint32_t>> remap(chunks);
+        for (size_t c = 0; c < chunks; ++c) {
+            faceFirst[c + 1] = faceFirst[c] + static_cast<uint32_t>(parts[c].faces.size());
+            brushFirst[c + 1] = brushFirst[c] + static_cast<uint32_t>(parts[c].brushes.size());
+            // Chunk order and first use within a chunk: same ids as the serial parse
+            remap[c].resize(parts[c].materials.Size());
+            for (uint32_t id = 0; id < remap[c].size(); ++id) remap[c][id] = map.materials.Intern(parts[c].materials.Name(id));
+        }
 
-                // if still inside side, append the line to buffer (except the closing brace which we've handled)
-                if (inSide) {
-                    sideBuffer << rawLine << "\n"; // keep rawLine to preserve formatting if needed later
+        map.faces.resize(faceFirst[chunks]);
+        map.brushes.resize(brushFirst[chunks]);
+        pool.ParallelFor(chunks, 1, [&](size_t begin, size_t end, unsigned) {
+            for (size_t c = begin; c < end; ++c) {
+                const ParsedMap& part = parts[c];
+                for (size_t i = 0; i < part.faces.size(); ++i) {
+                    Face& f = map.faces[faceFirst[c] + i];
+                    f = part.faces[i];
+                    f.id += static_cast<int>(faceFirst[c]);
+                    f.brushID += static_cast<int>(brushFirst[c]);
+                    f.material = remap[c][f.material];
+                }
+                for (size_t i = 0; i < part.brushes.size(); ++i) {
+                    ParsedMap::BrushRange& b = map.brushes[brushFirst[c] + i];
+                    b = part.brushes[i];
+                    b.id += static_cast<int>(brushFirst[c]);
+                    b.firstFace += faceFirst[c];
                 }
-                continue;
-            } // end inSide handling
+            }
+        });
+    }
+
+    // Region parse: every solid is found by the prescan and its plane points
+    // bounded; only the solids near the region are parsed, on the pool with
+    // threads > 1. -cordons fills region.boxes; without an active cordon it
+    // returns false with nothing parsed, and the whole map is.
+    bool ParseRegion(std::string_view text, unsigned threads, Region& region, ParsedMap& map) {
+        std::vector<SolidSpan> spans, cordons;
+        {
+            Profiler::Timer timer("parse.prescan");
+            // A solid left open at the end of the file is parsed with the entities
+            PrescanSolids(text, spans, region.useCordons ? &cordons : nullptr);
+        }
+        if (region.useCordons) {
+            region.boxes.clear();
+            ReadCordons(text, cordons, region.boxes);
+            if (region.boxes.empty()) {
+                std::cout << "Region: no active cordon, the whole map is optimized.\n";
+                region.useCordons = false;
+                return false;
+            }
+        }
+
+        std::vector<SolidSpan> kept;
+        size_t keptBytes = 0, skippedBytes = 0;
+        {
+            Profiler::Timer timer("parse.region");
+            std::vector<uint8_t> keep(spans.size(), 0);
+            auto test = [&](size_t begin, size_t end, unsigned) {
+                for (size_t i = begin; i < end; ++i) {
+                    Vec3 min, max;
+                    keep[i] = !PlaneBounds(text, spans[i], min, max) || region.Overlaps(min, max, region.margin);
+                }
+            };
+            if (threads > 1 && text.size() >= PARALLEL_MIN_BYTES) {
+                ThreadPool pool(threads);
+                pool.ParallelFor(spans.size(), 256, test);
+            }
+            else {
+                test(0, spans.size(), 0);
+            }
+            for (size_t i = 0; i < spans.size(); ++i) {
+                const size_t bytes = spans[i].end - spans[i].begin;
+                if (keep[i]) {
+                    kept.push_back(spans[i]);
+                    keptBytes += bytes;
+                }
+                else {
+                    skippedBytes += bytes;
+                }
+            }
+        }
+        std::cout << "Region: " << region.boxes.size() << " box(es), " << kept.size() << " of " << spans.size()
+            << " solids parsed.\n";
+        Profiler::Add("region_skipped_solids", spans.size() - kept.size());
+        Profiler::Add("region_skipped_bytes", skippedBytes);
+
+        if (threads > 1 && kept.size() > 1 && keptBytes >= PARALLEL_MIN_BYTES) {
+            ParseParallel(text, kept, spans, threads, map);
+        }
+        else {
+            map.faces.reserve(keptBytes / 256 + 16);
+            map.brushes.reserve(kept.size());
+            ParseBlocks(text, 0, &spans, false, -1, map);
+            for (const SolidSpan& s : kept) ParseBlocks(text, s.begin, nullptr, true, s.entity, map);
+        }
+        return true;
+    }
+}
+
+// Parse "(12 34 56)" into Vec3
+bool VMFParser::ParseVec3(std::string_view& str, Vec3& out) {
+    SkipSpaces(str);
+    if (str.empty() || str[0] != '(') return false;
+    str.remove_prefix(1);
+    // accept ints or floats, negatives
+    if (!ParseNumber(str, out.x) || !ParseNumber(str, out.y) || !ParseNumber(str, out.z)) return false;
+    SkipSpaces(str);
+    if (str.empty() || str[0] != ')') return false;
+    str.remove_prefix(1);
+    return true;
+}
 
-            // Other tokens inside solid that we do not need (id, editor, vertices_plus etc.) are ignored here
-            continue;
-        } // end inSolid
+bool VMFParser::ParsePlane(std::string_view str, Vec3& p1, Vec3& p2, Vec3& p3) {
+    return ParseVec3(str, p1) && ParseVec3(str, p2) && ParseVec3(str, p3);
+}
 
-        // If not in solid and not pendingSolid, but line contains '{' or '}' standalone for other sections, ignore
-    } // end while lines
+std::vector<Brush> VMFParser::ToBrushes(ParsedMap& map, std::vector<Entity>* entities, MaterialTable* materials) {
+    Profiler::Timer timer("parse.brushes");
+    std::vector<Brush> brushes = map.ToBrushes();
+    if (entities) *entities = std::move(map.entities);
+    if (materials) *materials = std::move(map.materials);
+    return brushes;
+}
 
-    // End of file: if a solid is still open, finalize it
-    if (inSide) {
-        // finalize last side if file ended unexpectedly
-        currentBrush.faces.push_back(currentFace);
-        inSide = false;
+ParsedMap VMFParser::Parse(const std::string& path, unsigned threads, Region* region) {
+    Profiler::Timer timer("parse");
+    MappedFile file;
+    try {
+        file.Open(path);
     }
-    if (inSolid) {
-        if (!currentBrush.faces.empty()) currentBrush.ComputeAABB();
-        brushes.push_back(currentBrush);
-        inSolid = false;
+    catch (const std::runtime_error&) {
+        throw std::runtime_error("Failed to open VMF file: " + path);
+    }
+    Profiler::Add("bytes_read", file.Size());
+    return ParseText(file.View(), threads, region);
+}
+
+std::vector<Brush> VMFParser::ParseVMF(const std::string& path, std::vector<Entity>* entities, MaterialTable* materials,
+    unsigned threads, Region* region) {
+    ParsedMap map = Parse(path, threads, region);
+    return ToBrushes(map, entities, materials);
+}
+
+std::vector<Brush> VMFParser::ParseBuffer(std::string_view text, std::vector<Entity>* entities, MaterialTable* materials,
+    unsigned threads) {
+    ParsedMap map = ParseText(text, threads);
+    return ToBrushes(map, entities, materials);
+}
+
+ParsedMap VMFParser::ParseStreaming(const std::string& path, size_t batchFaces,
+    const std::function<void(const ParsedMap& batch)>& take) {
+    Profiler::Timer timer("parse");
+    MappedFile file;
+    try {
+        file.Open(path);
+    }
+    catch (const std::runtime_error&) {
+        throw std::runtime_error("Failed to open VMF file: " + path);
+    }
+    Profiler::Add("bytes_read", file.Size());
+
+    ParsedMap map;
+    size_t brushCount = 0, faceCount = 0;
+    auto flushBatch = [&](ParsedMap& batch, size_t offset) {
+        brushCount += batch.brushes.size();
+        faceCount += batch.faces.size();
+        take(batch);
+        file.Evict(offset);
+    };
+    const Flush flush{ std::max<size_t>(batchFaces, 1), flushBatch };
+    map.faces.reserve(flush.minFaces + 256);
+    ParseBlocks(file.View(), 0, nullptr, false, -1, map, &flush);
+    flushBatch(map, file.Size());
+    map.faces.clear();
+    map.faces.shrink_to_fit();
+    map.brushes.clear();
+
+    Profiler::Add("brushes", brushCount);
+    Profiler::Add("sides", faceCount);
+    Profiler::Add("entities", map.entities.size());
+    Profiler::Add("materials", map.materials.Size());
+
+    std::cout << "Total brushes parsed: " << brushCount << "\n";
+    std::cout << "Total faces parsed: " << faceCount << "\n";
+    return map;
+}
+
+bool VMFParser::ScanSolids(std::string_view text, std::vector<SolidBlock>& solids, ParsedMap& rest) {
+    std::vector<SolidSpan> spans;
+    if (!PrescanSolids(text, spans)) return false;
+
+    solids.clear();
+    solids.reserve(spans.size());
+    for (const SolidSpan& s : spans) {
+        SolidBlock b;
+        b.begin = s.begin;
+        b.end = s.end;
+        b.entity = s.entity;
+        b.id = SolidId(text, s.begin);
+        solids.push_back(b);
+    }
+    ParseBlocks(text, 0, &spans, false, -1, rest);
+    return true;
+}
+
+void VMFParser::ParseSolid(std::string_view text, const SolidBlock& solid, ParsedMap& out) {
+    ParseBlocks(text, solid.begin, nullptr, true, solid.entity, out);
+}
+
+ParsedMap VMFParser::ParseText(std::string_view text, unsigned threads, Region* region) {
+    ParsedMap map;
+
+    const bool restricted = region && region->Active() && ParseRegion(text, threads, *region, map);
+    bool parallel = false;
+    std::vector<SolidSpan> spans;
+    if (!restricted && threads > 1 && text.size() >= PARALLEL_MIN_BYTES) {
+        Profiler::Timer timer("parse.prescan");
+        // A solid left open at the end of the file is finalized by the serial parse
+        parallel = PrescanSolids(text, spans) && spans.size() > 1;
+    }
+
+    if (parallel) {
+        ParseParallel(text, spans, spans, threads, map);
+    }
+    else if (!restricted) {
+        // A side takes about 250 bytes in a compact VMF and more as written by
+        // Hammer: one allocation covers most maps
+        map.faces.reserve(text.size() / 256 + 16);
+        map.brushes.reserve(text.size() / 1536 + 4);
+        ParseBlocks(text, 0, nullptr, false, -1, map);
+    }
+
+    {
+        Profiler::Timer timer("aabb");
+        for (ParsedMap::BrushRange& b : map.brushes) {
+            if (b.faceCount) FaceBounds(map.faces.data() + b.firstFace, b.faceCount, b.min, b.max);
+        }
     }
 
     // Final stats
-    size_t totalFaces = 0;
-    for (auto& b : brushes) totalFaces += b.faces.size();
+    Profiler::Add("brushes", map.brushes.size());
+    Profiler::Add("sides", map.faces.size());
+    Profiler::Add("entities", map.entities.size());
+    Profiler::Add("materials", map.materials.Size());
 
-    std::cout << "Total brushes parsed: " << brushes.size() << "\n";
-    std::cout << "Total faces parsed: " << totalFaces << "\n";
+    std::cout << "Total brushes parsed: " << map.brushes.size() << "\n";
+    std::cout << "Total faces parsed: " << map.faces.size() << "\n";
 
-    return brushes;
+    return map;
 }
@@ -1,14 +1,71 @@
 ﻿#pragma once
 #include "Geometry.h"
+#include "ParsedMap.h"
+#include "Region.h"
+#include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class VMFParser {
 public:
-    // Parse the given VMF and return brushes + faces
-    static std::vector<Brush> ParseVMF(const std::string& path);
+    // Parse the given VMF into one arena: faces pool, brush ranges, top-level
+    // entities (classname, origin, angles, instance file) and interned
+    // materials. With threads > 1, large files are cut at solid boundaries and the solids parsed in
+    // parallel; the result is the same as the serial parse.
+    // With an active region, only the solids near it are parsed (see Region);
+    // -cordons boxes are read from the map into region->boxes, and
+    // useCordons is cleared when the map has no active cordon.
+    static ParsedMap Parse(const std::string& path, unsigned threads = 1, Region* region = nullptr);
+
+    // Parse VMF text already in memory (same rules as Parse)
+    static ParsedMap ParseText(std::string_view text, unsigned threads = 1, Region* region = nullptr);
+
+    // Same as Parse, as brushes + faces. Entities and materials are moved to
+    // *entities / *materials when given; Brush::entity and Face::material
+    // index them.
+    static std::vector<Brush> ParseVMF(const std::string& path, std::vector<Entity>* entities = nullptr,
+        MaterialTable* materials = nullptr, unsigned threads = 1, Region* region = nullptr);
+
+    // Same as ParseText, as brushes + faces
+    static std::vector<Brush> ParseBuffer(std::string_view text, std::vector<Entity>* entities = nullptr,
+        MaterialTable* materials = nullptr, unsigned threads = 1);
+
+    // Low-memory parse: the text is dropped from memory behind the parser.
+    // Each time at least batchFaces faces are parsed (at a solid boundary)
+    // take(batch) receives them and must copy what it needs: the batch is
+    // cleared afterwards and the next one starts again at brush and face id
+    // 0. Brush::min/max are not computed. Returns the entities and materials,
+    // without brushes or faces.
+    static ParsedMap ParseStreaming(const std::string& path, size_t batchFaces,
+        const std::function<void(const ParsedMap& batch)>& take);
+
+    // Solid block of a VMF text, for incremental re-parses (watch mode)
+    struct SolidBlock {
+        size_t begin = 0;       // offset of the "solid" word
+        size_t end = 0;         // past its closing '}'
+        int entity = -1;        // index in the entities of the same text, -1 = world
+        int id = -1;            // value of the solid's "id" key, -1 if missing
+    };
+
+    // Finds every solid block of text (file order) and parses the rest into
+    // rest: entities only, no brushes. False if the text ends inside a solid
+    // (a file still being written).
+    static bool ScanSolids(std::string_view text, std::vector<SolidBlock>& solids, ParsedMap& rest);
+
+    // Parses one block found by ScanSolids, appended to out (brush and face
+    // ids are indices in out). Brush::min/max are not computed.
+    static void ParseSolid(std::string_view text, const SolidBlock& solid, ParsedMap& out);
+
+    // The std::vector<Brush> form of a parse result (what ParseVMF returns);
+    // entities and materials are moved out of map when given
+    static std::vector<Brush> ToBrushes(ParsedMap& map, std::vector<Entity>* entities = nullptr,
+        MaterialTable* materials = nullptr);
+
+    // helper: parse "(x y z) (x y z) (x y z)" plane points; false if malformed
+    static bool ParsePlane(std::string_view str, Vec3& p1, Vec3& p2, Vec3& p3);
 
 private:
-    // helper: parse "(x y z)" into Vec3
-    static Vec3 ParseVec3(const std::string& str);
+    // helper: parse "(x y z)" into Vec3, advancing str past the closing ')'
+    static bool ParseVec3(std::string_view& str, Vec3& out);
 };
@@ -0,0 +1,86 @@
+﻿#pragma once
+#include <cstddef>
+#include <string_view>
+
+// Single-pass tokenizer over an in-memory VMF (KeyValues text).
+// Tokens are views into the source buffer: nothing is copied or allocated.
+//
+//   solid            -> Word
+//   {  /  }          -> Open / Close
+//   "plane"          -> String (view excludes the quotes)
+//   // comment       -> skipped
+struct VMFToken {
+    enum Type { End, Word, String, Open, Close };
+
+    Type type = End;
+    std::string_view text;   // Word / String contents
+    size_t offset = 0;       // byte offset of text in the source buffer
+};
+
+class VMFTokenizer {
+public:
+    explicit VMFTokenizer(std::string_view src, size_t startOffset = 0)
+        : src(src), pos(startOffset) {}
+
+    VMFToken Next() {
+        SkipBlank();
+        VMFToken tok;
+        if (pos >= src.size()) {
+            tok.offset = src.size();
+            return tok;
+        }
+
+        const char c = src[pos];
+        if (c == '{' || c == '}') {
+            tok.type = (c == '{') ? VMFToken::Open : VMFToken::Close;
+            tok.offset = pos;
+            tok.text = src.substr(pos, 1);
+            ++pos;
+            return tok;
+        }
+
+        if (c == '"') {
+            const size_t begin = pos + 1;
+            size_t end = begin;
+            while (end < src.size() && src[end] != '"' && src[end] != '\n') ++end;
+            tok.type = VMFToken::String;
+            tok.offset = begin;
+            tok.text = src.substr(begin, end - begin);
+            pos = (end < src.size() && src[end] == '"') ? end + 1 : end;
+            return tok;
+        }
+
+        const size_t begin = pos;
+        while (pos < src.size() && !IsBlank(src[pos]) && src[pos] != '{' && src[pos] != '}' && src[pos] != '"') ++pos;
+        tok.type = VMFToken::Word;
+        tok.offset = begin;
+        tok.text = src.substr(begin, pos - begin);
+        return tok;
+    }
+
+    size_t Position() const { return pos; }
+
+private:
+    static bool IsBlank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+    }
+
+    void SkipBlank() {
+        for (;;) {
+            while (pos < src.size() && IsBlank(src[pos])) ++pos;
+            if (pos + 1 < src.size() && src[pos] == '/' && src[pos + 1] == '/') {
+                while (pos < src.size() && src[pos] != '\n') ++pos;
+                continue;
+            }
+            // UTF-8 byte order mark written by some editors
+            if (pos == 0 && src.size() >= 3 && src.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+                pos = 3;
+                continue;
+            }
+            return;
+        }
+    }
+
+    std::string_view src;
+    size_t pos = 0;
+};
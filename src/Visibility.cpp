@@ -1,119 +1,658 @@
-#include "Visibility.h"
+﻿#include "Visibility.h"
+#include "CoverageMask.h"
+#include "FaceKernel.h"
+#include "PlaneIndex.h"
+#include "Profiler.h"
+#include "SolidGrid.h"
+#include "ThreadPool.h"
+#include "Winding.h"
 #include <algorithm>
 #include <cmath>
+#include <chrono>
 #include <iostream>
+#include <type_traits>
 
-void Visibility::DetectHiddenFaces(std::vector<Brush>& brushes)
-{
+namespace {
     const double NORMAL_EPS = 0.02;    // tolérance sur l'angle (~arccos(0.98) ≈ 11°)
     const double PLANE_EPS = 0.5;      // tolérance de coplanarité (unités Hammer)
-    const double COVER_RATIO = 0.98;   // % minimum de recouvrement de la face testée
-
-    auto buildBasis = [](const Vec3& normal, Vec3& u, Vec3& v) -> bool {
-        Vec3 ref = { 0.0, 0.0, 1.0 };
-        Vec3 tangent = Cross(normal, ref);
-        if (Length(tangent) < 1e-4) {
-            ref = { 0.0, 1.0, 0.0 };
-            tangent = Cross(normal, ref);
-        }
-        double lenT = Length(tangent);
-        if (lenT < 1e-4) return false;
-        u = tangent * (1.0 / lenT);
-        v = Normalize(Cross(normal, u));
-        return Length(v) >= 1e-4;
+    const double COVER_RATIO = 0.98;   // % minimum de recouvrement de la face testée (> 5/9, cf. PlaneIndex)
+    const size_t TARGET_CHUNK = 256;   // faces par paquet pour le work-stealing
+    const size_t MAX_NEAR_LOOKUPS = 4096;  // recherches dans la grille par slab, au-delà la slab entière
+    const size_t MAX_UNION_PIECES = 256;   // morceaux de fA non recouverts, au-delà on abandonne
+    const double MASK_MARGIN = 2.0 / CoverageMask::SIZE;  // erreur du masque : deux rangées de cellules
+    const double EMBED_EPS = 0.01;     // un sommet à moins de EMBED_EPS d'un plan d'une brush compte comme dedans
+    const double EMBED_LEFT = 1e-6;    // part de fA qui peut dépasser des brushes qui l'enfouissent (arrondis)
+
+    // Face testée : sa base, son polygone projeté et son rectangle viennent
+    // de la FaceTable (calculés une fois par face)
+    struct Target {
+        uint32_t row = 0;
+        Vec3 n, u, v;
+        const Winding::Point2* polygon = nullptr;   // winding dans la base (u, v)
+        uint32_t corners = 0;
+        double AuMin = 0, AuMax = 0, AvMin = 0, AvMax = 0;
+        double areaA = 0;
+        double planeA = 0;
+        Vec3 centroid;                              // centre de gravité du winding
     };
 
-    auto projectExtents = [](const Face& face, const Vec3& u, const Vec3& v,
-        double& uMin, double& uMax, double& vMin, double& vMax)
-    {
-        auto accumulate = [&](const Vec3& p) {
-            double pu = Dot(p, u);
-            double pv = Dot(p, v);
-            if (pu < uMin) uMin = pu;
-            if (pu > uMax) uMax = pu;
-            if (pv < vMin) vMin = pv;
-            if (pv > vMax) vMax = pv;
-        };
+    // Prépare fA ; false si la face ne peut pas être cachée (brush exclue par
+    // la politique d'entités, normale, winding ou aire nulle)
+    bool prepareTarget(const FaceTable& table, uint32_t row, Target& t) {
+        const uint8_t needed = FaceTable::RECEIVER | FaceTable::HAS_WINDING;
+        if ((table.flags[row] & needed) != needed) return false;
+        if (table.area[row] <= 1e-6) return false;
 
-        uMin = uMax = Dot(face.p1, u);
-        vMin = vMax = Dot(face.p1, v);
-        accumulate(face.p2);
-        accumulate(face.p3);
-        accumulate(face.center);
-    };
+        t.row = row;
+        t.n = table.Normal(row);
+        t.u = table.u[row];
+        t.v = table.v[row];
+        t.polygon = table.Projected(row);
+        t.corners = table.windings.count[row];
+        t.AuMin = table.uMin[row]; t.AuMax = table.uMax[row];
+        t.AvMin = table.vMin[row]; t.AvMax = table.vMax[row];
+        t.areaA = table.area[row];
+        t.planeA = table.plane[row];
+        t.centroid = table.centroid[row];
+        return true;
+    }
+
+    // Winding de fB dans la base de A quand nB == -nA : BuildBasis(-n) donne
+    // (-u, v) exactement, c'est donc le polygone projeté de B miroir sur u, à
+    // l'envers pour rester dans le sens trigonométrique. Sans calcul, et le
+    // même résultat que Winding::Project (aire non nulle : l'ordre est connu).
+    void mirrored(const FaceTable& table, uint32_t rowB, std::vector<Winding::Point2>& out) {
+        const uint32_t n = table.windings.count[rowB];
+        const Winding::Point2* own = table.Projected(rowB);
+        out.resize(n);
+        for (uint32_t i = 0; i < n; ++i) out[i] = { -own[n - 1 - i].u, own[n - 1 - i].v };
+    }
+
+    // Part de fA recouverte par le winding de fB (projeté sur le plan de A) ;
+    // opposite : nB == -nA et B a sa base (le cas du noyau SIMD)
+    bool polygonCovers(const Target& t, const FaceTable& table, uint32_t rowB, bool opposite) {
+        thread_local std::vector<Winding::Point2> polygonB;
+        if (opposite && table.area[rowB] > 0.0) mirrored(table, rowB, polygonB);
+        else Winding::Project(table.windings.Polygon(rowB), table.windings.count[rowB], t.u, t.v, polygonB);
+        return Winding::OverlapArea(t.polygon, t.corners, polygonB.data(), polygonB.size()) / t.areaA >= COVER_RATIO;
+    }
+
+    // fB est-elle opposée à fA, sur le même plan et devant elle ?
+    bool facing(const Target& t, const FaceTable& table, uint32_t rowB) {
+        const Vec3& nA = t.n;
+
+        // Brush qui cache, normale non nulle (déjà testée à la construction)
+        const uint8_t needed = FaceTable::OCCLUDER | FaceTable::VALID_NORMAL;
+        if ((table.flags[rowB] & needed) != needed) return false;
+        if (table.windings.count[rowB] < 3) return false;   // côté sans surface
+
+        const Vec3 nB = table.Normal(rowB);
+        double normalDot = Dot(nA, nB);
+        if (normalDot > -(1.0 - NORMAL_EPS)) return false; // pas assez opposées
+
+        Vec3 delta = table.Center(rowB) - table.Center(t.row);
+        double planeDelta = std::abs(Dot(delta, nA));
+        if (planeDelta > PLANE_EPS) return false; // pas sur le même plan
 
-    // On repart de zéro à chaque passe
-    for (Brush& b : brushes) {
-        for (Face& f : b.faces) {
-            f.hidden = false;
+        // B doit être "devant" la face (côté extérieur)
+        if (Dot(delta, nA) <= 0.0) return false;
+
+        // Vérifie la coplanarité via la projection sur le plan de A
+        double planePosB = Dot(nA, table.Center(rowB));
+        return std::abs(planePosB - t.planeA) <= PLANE_EPS;
+    }
+
+    // nB == -nA exactement, et B a sa base : son winding se projette en miroir
+    bool exactOpposite(const Target& t, const FaceTable& table, uint32_t rowB) {
+        return (table.flags[rowB] & FaceTable::HAS_BASIS)
+            && table.nx[rowB] == -t.n.x && table.ny[rowB] == -t.n.y && table.nz[rowB] == -t.n.z;
+    }
+
+    // fB recouvre-t-elle fA (opposée, coplanaire, devant, >= COVER_RATIO) ?
+    bool covers(const Target& t, const FaceTable& table, uint32_t rowB) {
+        return facing(t, table, rowB) && polygonCovers(t, table, rowB, exactOpposite(t, table, rowB));
+    }
+
+    // Face utilisable d'une autre brush (ce que le noyau SIMD garde)
+    bool otherOccluder(const Target& t, const FaceTable& table, uint32_t rowB) {
+        const uint8_t usable = FaceTable::VALID_NORMAL | FaceTable::HAS_WINDING | FaceTable::OCCLUDER;
+        return (table.flags[rowB] & usable) == usable && table.brushId[rowB] != table.brushId[t.row];
+    }
+
+    // fB cache une partie de fA, assez près de son centre de gravité pour
+    // que l'index la renvoie (|P - cB| <= 2 rB + PLANE_EPS, cf. PlaneIndex).
+    // Le test à plusieurs faces n'est lancé que si une telle face existe :
+    // la règle ne dépend pas de l'index, la version brute donne le même
+    // résultat.
+    bool nearPartial(const Target& t, const FaceTable& table, uint32_t rowB) {
+        if (!otherOccluder(t, table, rowB) || !facing(t, table, rowB)) return false;
+        if (exactOpposite(t, table, rowB)) {
+            // Rectangles comme dans le noyau : vide, aucune surface commune
+            double overlapU = std::min(t.AuMax, -table.uMin[rowB]) - std::max(t.AuMin, -table.uMax[rowB]);
+            double overlapV = std::min(t.AvMax, table.vMax[rowB]) - std::max(t.AvMin, table.vMin[rowB]);
+            if (!(overlapU > 0.0 && overlapV > 0.0)) return false;
         }
+        return Length(t.centroid - table.Center(rowB)) <= 2.0 * table.radius[rowB] + PLANE_EPS;
     }
 
-    int hiddenCount = 0;
+    // Part de fA recouverte par l'union des faces listées (doublons permis) :
+    // un mur caché par trois brushes côte à côte, qu'aucune ne recouvre seule.
+    // Le masque 64 x 64 (CoverageMask, centres des cellules) écarte vite les
+    // faces loin du compte ; il peut se tromper d'une rangée de cellules, la
+    // réponse vient donc de l'aire exacte laissée par l'union (fA découpée en
+    // morceaux convexes hors de chaque face).
+    bool unionCovers(const Target& t, const FaceTable& table, const uint32_t* rows, size_t count) {
+        thread_local CoverageMask mask;
+        thread_local std::vector<Winding::Point2> polygonB, polygons;
+        thread_local std::vector<uint32_t> corners;
+        if (mask.Reset(t.polygon, t.corners, t.AuMin, t.AuMax, t.AvMin, t.AvMax) == 0) return false;
+        polygons.clear();
+        corners.clear();
+        for (size_t k = 0; k < count; ++k) {
+            const uint32_t rowB = rows[k];
+            if (!otherOccluder(t, table, rowB) || !facing(t, table, rowB)) continue;
+            if (exactOpposite(t, table, rowB) && table.area[rowB] > 0.0) mirrored(table, rowB, polygonB);
+            else Winding::Project(table.windings.Polygon(rowB), table.windings.count[rowB], t.u, t.v, polygonB);
+            mask.Add(polygonB.data(), polygonB.size());
+            polygons.insert(polygons.end(), polygonB.begin(), polygonB.end());
+            corners.push_back(static_cast<uint32_t>(polygonB.size()));
+        }
+        if (!mask.Covers(COVER_RATIO - MASK_MARGIN)) return false;
+
+        const double allowed = (1.0 - COVER_RATIO) * t.areaA;
+        const double left = Winding::UncoveredArea(t.polygon, t.corners, polygons.data(), corners.data(), corners.size(),
+            allowed, MAX_UNION_PIECES);
+        return left >= 0.0 && left <= allowed;
+    }
+
+    // Boîte des windings des lignes first..end-1 (au moins un sommet) :
+    // une face, ou toute sa brush
+    void windingBounds(const FaceTable& table, uint32_t first, uint32_t end, Vec3& min, Vec3& max) {
+        bool any = false;
+        for (uint32_t r = first; r < end; ++r) {
+            const Vec3* poly = table.windings.Polygon(r);
+            for (uint32_t k = 0; k < table.windings.count[r]; ++k) {
+                const Vec3& p = poly[k];
+                if (!any) { min = max = p; any = true; }
+                min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+                max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+            }
+        }
+    }
+
+    // fA est-elle enfouie dans d'autres brushes : à l'intérieur d'une seule
+    // (un pilier enfoncé dans le sol), ou de plusieurs ensemble (l'union de
+    // leurs sections dans le plan de fA la recouvre) ? Une face posée sur un
+    // côté d'une brush n'est pas dedans : c'est le test des faces opposées.
+    // solids : les brushes candidates, sans doublon ; lo, hi : windingBounds.
+    bool embedded(const Target& t, const FaceTable& table, const SolidGrid& grid, const uint32_t* solids, size_t count,
+        const Vec3& lo, const Vec3& hi, uint64_t& solidTests) {
+        thread_local std::vector<double> xs, ys, zs;
+        thread_local std::vector<Winding::Point2> section, polygons;
+        thread_local std::vector<uint32_t> partial, corners;
+        const int32_t own = table.brushId[t.row];
+        bool loaded = false;
+        partial.clear();
+        for (size_t k = 0; k < count; ++k) {
+            const uint32_t s = solids[k];
+            if (grid.BrushId(s) == own || !grid.Overlaps(s, lo, hi, EMBED_EPS)) continue;
+            if (!loaded) {
+                // Sommets en colonnes pour Classify, une fois pour toutes les brushes
+                const Vec3* poly = table.windings.Polygon(t.row);
+                xs.resize(t.corners);
+                ys.resize(t.corners);
+                zs.resize(t.corners);
+                for (uint32_t i = 0; i < t.corners; ++i) {
+                    xs[i] = poly[i].x;
+                    ys[i] = poly[i].y;
+                    zs[i] = poly[i].z;
+                }
+                loaded = true;
+            }
+            solidTests++;
+            const SolidGrid::Containment c = grid.Classify(s, xs.data(), ys.data(), zs.data(), t.corners, lo, hi, EMBED_EPS);
+            if (c == SolidGrid::INSIDE) return true;
+            if (c == SolidGrid::PARTIAL) partial.push_back(s);
+        }
+        if (partial.size() < 2) return false;   // une seule brush qui ne contient pas fA ne la recouvre pas
 
-    for (Brush& A : brushes) {
-        for (Face& fA : A.faces) {
-            Vec3 nA = fA.normal;
-            double lenA = Length(nA);
-            if (lenA < 1e-4) continue;
+        polygons.clear();
+        corners.clear();
+        for (uint32_t s : partial) {
+            grid.Section(s, t.n, t.planeA, t.u, t.v, t.polygon, t.corners, section);
+            if (section.size() < 3) continue;
+            polygons.insert(polygons.end(), section.begin(), section.end());
+            corners.push_back(static_cast<uint32_t>(section.size()));
+        }
+        if (corners.size() < 2) return false;
+
+        const double allowed = EMBED_LEFT * t.areaA;
+        const double left = Winding::UncoveredArea(t.polygon, t.corners, polygons.data(), corners.data(), corners.size(),
+            allowed, MAX_UNION_PIECES);
+        return left >= 0.0 && left <= allowed;
+    }
 
-            Vec3 u, v;
-            if (!buildBasis(nA, u, v)) continue;
+    void resetHidden(std::vector<Brush>& brushes) {
+        // On repart de zéro à chaque passe
+        for (Brush& b : brushes) {
+            for (Face& f : b.faces) {
+                f.hidden = false;
+            }
+        }
+    }
+}
 
-            double AuMin, AuMax, AvMin, AvMax;
-            projectExtents(fA, u, v, AuMin, AuMax, AvMin, AvMax);
-            double areaA = (AuMax - AuMin) * (AvMax - AvMin);
-            if (areaA <= 1e-6) continue;
+namespace {
+    // Tolérances du préfiltre en précision T : de combien l'arrondi de T peut
+    // déplacer chaque prédicat, magnitude = plus grande valeur stockée. Le
+    // préfiltre n'écarte un candidat que si le test en double l'écarterait
+    // aussi (erreurs de conversion et d'opération comprises, plus une marge
+    // pour l'arrondi du test en double lui-même).
+    template<typename T>
+    void setSlack(FaceKernel::Query& q, double magnitude) {
+        const double r = ScalarTraits<T>::relError;
+        const double a = ScalarTraits<T>::absError;
+        const double M = magnitude + 1.0;
+        q.slackNormal = 16.0 * (r + a) + 1e-12;
+        q.slackPlane = 16.0 * r * M + 12.0 * a + 1e-9;
+        q.slackPlanePerUnit = 1.01 * (5.0 * r + a);
+        q.slackRect = 4.0 * (r * M + a) + 1e-9;
+    }
 
-            double planeA = Dot(nA, fA.center);
+    // Teste les faces listées (lignes de la FaceTable) contre tout l'index ;
+    // renvoie le nombre de faces cachées. Avec T = float ou Fixed32, les
+    // candidats passent d'abord par le préfiltre sur compact.
+    template<typename T>
+    int runPass(std::vector<Brush>& brushes, const FaceTable& table,
+        const std::vector<uint32_t>& targets, unsigned threads, const CompactFaceRows<T>* compact)
+    {
+        constexpr bool prefilter = !std::is_same_v<T, double>;
+        // Index par plan : chaque face n'est testée que contre les faces de son
+        // plan opposé qui peuvent recouvrir le centre de gravité de son winding.
+        PlaneIndex index;
+        {
+            Profiler::Timer timer("visibility.index");
+            index.Build(table, NORMAL_EPS, PLANE_EPS);
+        }
+        // Brushes pleines, pour les faces enfouies dans d'autres brushes
+        SolidGrid grid;
+        {
+            Profiler::Timer timer("visibility.solids");
+            grid.Build(brushes, table);
+        }
+        Profiler::Timer timer("visibility.faces");
 
-            for (const Brush& B : brushes) {
-                if (A.id == B.id) continue;
+        const FaceKernel::Isa isa = FaceKernel::Detect();
 
-                for (const Face& fB : B.faces) {
-                    Vec3 nB = fB.normal;
-                    double lenB = Length(nB);
-                    if (lenB < 1e-4) continue;
+        // Des compteurs par thread (sur leur propre ligne de cache) au lieu de
+        // compteurs partagés ; chaque face n'est écrite que par un seul thread.
+        struct alignas(64) Counter {
+            int value = 0;
+            uint64_t skipped = 0;        // faces sans normale, winding ou aire
+            uint64_t polygonTests = 0;
+            uint64_t unionTests = 0;     // faces passées au test à plusieurs faces
+            uint64_t unionHidden = 0;
+            uint64_t unionSlabScans = 0; // slabs prises entières (MAX_NEAR_LOOKUPS)
+            uint64_t solidTests = 0;     // (face, brush) passés à SolidGrid::Classify
+            uint64_t embeddedHidden = 0;
+            FaceKernel::Stats kernel;
+        };
 
-                    double normalDot = Dot(nA, nB);
-                    if (normalDot > -(1.0 - NORMAL_EPS)) continue; // pas assez opposées
+        ThreadPool pool(threads);
+        std::vector<Counter> hiddenPerThread(pool.Size());
 
-                    Vec3 delta = fB.center - fA.center;
-                    double planeDelta = std::abs(Dot(delta, nA));
-                    if (planeDelta > PLANE_EPS) continue; // pas sur le même plan
+        pool.ParallelFor(targets.size(), TARGET_CHUNK, [&](size_t begin, size_t end, unsigned worker) {
+            Counter& counter = hiddenPerThread[worker];
+            int& hiddenCount = counter.value;
+            thread_local std::vector<uint32_t> solids;   // brushes pleines autour de la brush solidsOf
+            int32_t solidsOf = -1;
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t row = targets[i];
+                Brush& A = brushes[table.brush[row]];
+                Face& fA = A.faces[table.face[row]];
+                fA.hidden = false;
 
-                    // B doit être "devant" la face (côté extérieur)
-                    if (Dot(delta, nA) <= 0.0) continue;
+                Target t;
+                if (!prepareTarget(table, row, t)) {
+                    counter.skipped++;
+                    continue;
+                }
 
-                    // Vérifie la coplanarité via la projection sur le plan de A
-                    double planePosB = Dot(nA, fB.center);
-                    if (std::abs(planePosB - planeA) > PLANE_EPS) continue;
+                FaceKernel::Query q;
+                q.nx = t.n.x; q.ny = t.n.y; q.nz = t.n.z;
+                q.cx = table.cx[row]; q.cy = table.cy[row]; q.cz = table.cz[row];
+                q.planeA = t.planeA;
+                q.AuMin = t.AuMin; q.AuMax = t.AuMax; q.AvMin = t.AvMin; q.AvMax = t.AvMax;
+                q.areaA = t.areaA;
+                q.brushId = A.id;
+                q.normalLimit = -(1.0 - NORMAL_EPS);
+                q.planeEps = PLANE_EPS;
+                // Marge d'arrondi : le test des rectangles ne doit jamais
+                // écarter une face que le test des polygones accepterait
+                q.coverRatio = COVER_RATIO * (1.0 - 1e-9);
+                bool usePrefilter = false;
+                if constexpr (prefilter) {
+                    q.row = row;
+                    setSlack<T>(q, compact->magnitude);
+                    usePrefilter = compact->normalId[row] != CompactFaceRows<T>::NO_ID;
+                }
 
-                    double BuMin, BuMax, BvMin, BvMax;
-                    projectExtents(fB, u, v, BuMin, BuMax, BvMin, BvMax);
+                // Les candidats passent par paquets dans le noyau SIMD (qui
+                // élimine ceux dont le rectangle ne suffit pas) puis par le test
+                // des polygones ; ceux dont la normale n'est pas exactement
+                // opposée finissent en scalaire. Au passage, on note si une
+                // face en recouvre une partie (nearPartial).
+                bool partialSeen = false;
+                auto notePartial = [&](uint32_t r) {
+                    if (!partialSeen) partialSeen = nearPartial(t, table, r);
+                };
+                bool hidden = index.ForEachCandidate(t.n, t.planeA, t.centroid, [&](const uint32_t* rows, uint32_t count) {
+                    for (uint32_t k = 0; k < count; k += FaceKernel::MAX_BATCH) {
+                        const uint32_t* batch = rows + k;
+                        int n = static_cast<int>(std::min<uint32_t>(FaceKernel::MAX_BATCH, count - k));
+                        uint32_t left[FaceKernel::MAX_BATCH];
+                        if constexpr (prefilter) {
+                            if (usePrefilter) {
+                                uint32_t partial = 0;
+                                uint32_t keep = FaceKernel::Prefilter(isa, table, *compact, q, batch, n, partial, counter.kernel);
+                                for (int lane = 0; partial; ++lane, partial >>= 1) {
+                                    if (partial & 1u) notePartial(batch[lane]);
+                                }
+                                int m = 0;
+                                for (int lane = 0; keep; ++lane, keep >>= 1) {
+                                    if (keep & 1u) left[m++] = batch[lane];
+                                }
+                                batch = left;
+                                n = m;
+                                if (n == 0) continue;
+                            }
+                        }
+                        uint32_t needScalar = 0, partial = 0;
+                        uint32_t maybe = FaceKernel::TestBatch(isa, table, q, batch, n, needScalar, partial, counter.kernel);
+                        for (int lane = 0; partial; ++lane, partial >>= 1) {
+                            if (partial & 1u) notePartial(batch[lane]);
+                        }
+                        for (int lane = 0; maybe; ++lane, maybe >>= 1) {
+                            if (!(maybe & 1u)) continue;
+                            counter.polygonTests++;
+                            if (polygonCovers(t, table, batch[lane], true)) return true;
+                            notePartial(batch[lane]);
+                        }
+                        for (int lane = 0; needScalar; ++lane, needScalar >>= 1) {
+                            if (!(needScalar & 1u)) continue;
+                            counter.polygonTests++;
+                            if (covers(t, table, batch[lane])) return true;
+                            notePartial(batch[lane]);
+                        }
+                    }
+                    return false;
+                });
 
-                    double overlapU = std::max(0.0, std::min(AuMax, BuMax) - std::max(AuMin, BuMin));
-                    double overlapV = std::max(0.0, std::min(AvMax, BvMax) - std::max(AvMin, BvMin));
-                    if (overlapU <= 0.0 || overlapV <= 0.0) continue;
+                // Aucune face ne suffit seule : l'union de toutes celles qui
+                // touchent fA (la recherche dans l'index couvre tout le disque
+                // de fA, pas seulement son centre de gravité)
+                if (!hidden && partialSeen) {
+                    thread_local std::vector<uint32_t> near;
+                    near.clear();
+                    counter.unionSlabScans += index.ForEachNear(t.n, t.planeA, table.Center(row), table.radius[row] + PLANE_EPS,
+                        MAX_NEAR_LOOKUPS, [&](const uint32_t* rows, uint32_t count) { near.insert(near.end(), rows, rows + count); });
+                    std::sort(near.begin(), near.end());
+                    near.erase(std::unique(near.begin(), near.end()), near.end());
+                    counter.unionTests++;
+                    hidden = unionCovers(t, table, near.data(), near.size());
+                    if (hidden) counter.unionHidden++;
+                }
 
-                    double overlapArea = overlapU * overlapV;
-                    double coverage = overlapArea / areaA;
-                    if (coverage >= COVER_RATIO) {
-                        fA.hidden = true;
-                        hiddenCount++;
-                        break;
+                // Toujours visible : reste le cas d'une face à l'intérieur
+                // d'autres brushes
+                if (!hidden) {
+                    // Une requête par brush : ses faces se suivent, et
+                    // Classify écarte ce qui ne touche pas la face elle-même
+                    const int32_t bi = table.brush[row];
+                    if (bi != solidsOf) {
+                        solidsOf = bi;
+                        solids.clear();
+                        Vec3 lo, hi;
+                        windingBounds(table, table.brushFirstRow[bi], table.brushFirstRow[bi + 1], lo, hi);
+                        grid.ForEachOverlapping(lo, hi, EMBED_EPS, [&](uint32_t s) { solids.push_back(s); });
                     }
+                    Vec3 lo, hi;
+                    windingBounds(table, row, row + 1, lo, hi);
+                    if (!solids.empty()) hidden = embedded(t, table, grid, solids.data(), solids.size(), lo, hi, counter.solidTests);
+                    if (hidden) counter.embeddedHidden++;
                 }
 
-                if (fA.hidden) break;
+                if (hidden) {
+                    fA.hidden = true;
+                    hiddenCount++;
+                }
             }
+        });
+
+        int hiddenCount = 0;
+        uint64_t skipped = 0, polygonTests = 0, unionTests = 0, unionHidden = 0, unionSlabScans = 0;
+        uint64_t solidTests = 0, embeddedHidden = 0;
+        FaceKernel::Stats kernel;
+        for (const Counter& c : hiddenPerThread) {
+            hiddenCount += c.value;
+            skipped += c.skipped;
+            polygonTests += c.polygonTests;
+            unionTests += c.unionTests;
+            unionHidden += c.unionHidden;
+            unionSlabScans += c.unionSlabScans;
+            solidTests += c.solidTests;
+            embeddedHidden += c.embeddedHidden;
+            kernel += c.kernel;
         }
+
+        Profiler::Add("faces_tested", targets.size());
+        Profiler::Add("faces_skipped", skipped);
+        Profiler::Add("pairs_tested", kernel.tested);
+        Profiler::Add("rejected_unusable", kernel.rejectedUnusable);
+        Profiler::Add("rejected_normal", kernel.rejectedNormal);
+        Profiler::Add("rejected_plane", kernel.rejectedPlane);
+        Profiler::Add("rejected_front", kernel.rejectedFront);
+        Profiler::Add("rejected_plane_pos", kernel.rejectedPlanePos);
+        Profiler::Add("rejected_rect", kernel.rejectedRect);
+        Profiler::Add("polygon_tests", polygonTests);
+        Profiler::Add("union_tests", unionTests);
+        Profiler::Add("union_hidden", unionHidden);
+        Profiler::Add("union_slab_scans", unionSlabScans);
+        Profiler::Add("solid_tests", solidTests);
+        Profiler::Add("embedded_hidden", embeddedHidden);
+        return hiddenCount;
     }
+}
+
+namespace {
+    // runPass dans la précision demandée (la copie compacte est construite ici)
+    int runPass(std::vector<Brush>& brushes, const FaceTable& table,
+        const std::vector<uint32_t>& targets, unsigned threads, Precision precision)
+    {
+        if (precision == Precision::Float) {
+            CompactFaceRows<float> compact;
+            {
+                Profiler::Timer timer("visibility.compact");
+                compact.Build(table);
+            }
+            return runPass(brushes, table, targets, threads, &compact);
+        }
+        if (precision == Precision::Fixed) {
+            CompactFaceRows<Fixed32> compact;
+            {
+                Profiler::Timer timer("visibility.compact");
+                compact.Build(table);
+            }
+            return runPass(brushes, table, targets, threads, &compact);
+        }
+        return runPass<double>(brushes, table, targets, threads, nullptr);
+    }
+}
+
+void Visibility::DetectHiddenFaces(std::vector<Brush>& brushes, unsigned threads, Precision precision)
+{
+    resetHidden(brushes);
+
+    FaceTable table;
+    {
+        Profiler::Timer timer("visibility.table");
+        table.Build(brushes);
+    }
+
+    // Toutes les faces, découpées en paquets pour les threads
+    std::vector<uint32_t> targets(table.count);
+    for (uint32_t r = 0; r < table.count; ++r) targets[r] = r;
+
+    int hiddenCount = runPass(brushes, table, targets, threads, precision);
 
     std::cout << "Detected " << hiddenCount << " hidden faces.\n";
 }
 
+int Visibility::DetectHiddenFaces(std::vector<Brush>& brushes, const std::vector<int>& brushSubset, unsigned threads,
+    Precision precision)
+{
+    FaceTable table;
+    {
+        Profiler::Timer timer("visibility.table");
+        table.Build(brushes);
+    }
+
+    std::vector<uint32_t> targets;
+    for (int bi : brushSubset) {
+        for (uint32_t r = table.brushFirstRow[bi]; r < table.brushFirstRow[bi + 1]; ++r) targets.push_back(r);
+    }
+
+    return runPass(brushes, table, targets, threads, precision);
+}
 
+void Visibility::InfluenceBounds(const Brush& b, Vec3& min, Vec3& max)
+{
+    // Si fB recouvre fA, |cA - cB| <= rA + 2 * rB + PLANE_EPS (voir PlaneIndex,
+    // r = sommet du winding le plus éloigné du centre) : une boîte de
+    // demi-côté 2 * r + PLANE_EPS autour du centre de chaque face suffit.
+    // Elle contient aussi tout le solide, où les faces enfouies se trouvent.
+    WindingPool windings;
+    windings.AddBrush(b);
 
+    bool first = true;
+    for (size_t i = 0; i < b.faces.size(); ++i) {
+        const Face& f = b.faces[i];
+        if (windings.count[i] < 3) continue;   // ni cachée ni couvrante
+        double r = 0.0;
+        for (uint32_t k = 0; k < windings.count[i]; ++k) {
+            r = std::max(r, Length(windings.Polygon(static_cast<uint32_t>(i))[k] - f.center));
+        }
+        double R = 2.0 * r + PLANE_EPS + 1e-3;
+        Vec3 lo = f.center - Vec3(R, R, R);
+        Vec3 hi = f.center + Vec3(R, R, R);
+        if (first) {
+            min = lo;
+            max = hi;
+            first = false;
+            continue;
+        }
+        min = { std::min(min.x, lo.x), std::min(min.y, lo.y), std::min(min.z, lo.z) };
+        max = { std::max(max.x, hi.x), std::max(max.y, hi.y), std::max(max.z, hi.z) };
+    }
+    if (first) min = max = Vec3();
+}
 
- 
+size_t Visibility::ComparePrecision(std::vector<Brush>& brushes, Precision precision, unsigned threads)
+{
+    using Clock = std::chrono::steady_clock;
+    auto elapsedMs = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+
+    // Référence en double
+    Clock::time_point start = Clock::now();
+    DetectHiddenFaces(brushes, threads, Precision::Double);
+    const double referenceMs = elapsedMs(start);
+    std::vector<uint8_t> reference;
+    for (const Brush& b : brushes) {
+        for (const Face& f : b.faces) reference.push_back(f.hidden ? 1 : 0);
+    }
+
+    start = Clock::now();
+    DetectHiddenFaces(brushes, threads, precision);
+    const double testedMs = elapsedMs(start);
+
+    // Les premières différences sont listées (brush, id du side dans le VMF)
+    const size_t LISTED = 10;
+    size_t differences = 0;
+    size_t row = 0;
+    for (const Brush& b : brushes) {
+        for (const Face& f : b.faces) {
+            const bool expected = reference[row++] != 0;
+            if (f.hidden == expected) continue;
+            if (differences++ < LISTED) {
+                std::cout << "  brush " << b.id << " side " << f.sideId << ": " << (expected ? "hidden" : "visible")
+                    << " in double, " << (f.hidden ? "hidden" : "visible") << " in " << PrecisionName(precision) << "\n";
+            }
+        }
+    }
+    std::cout << "Precision check: " << PrecisionName(precision) << " vs double, " << differences
+        << " faces differ (" << testedMs << " ms vs " << referenceMs << " ms).\n";
+    Profiler::Set("precision_differences", differences);
+    return differences;
+}
+
+uint64_t Visibility::SettingsHash()
+{
+    // Change dès qu'une tolérance ou l'algorithme change : invalide les caches
+    const double values[] = { NORMAL_EPS, PLANE_EPS, COVER_RATIO, 4.0 /* version : faces enfouies */ };
+    uint64_t h = 1469598103934665603ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+    for (size_t i = 0; i < sizeof(values); ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+void Visibility::DetectHiddenFacesBruteForce(std::vector<Brush>& brushes)
+{
+    resetHidden(brushes);
+
+    // Les tests lisent les lignes de la table, pas les Face
+    FaceTable table;
+    table.Build(brushes);
+    SolidGrid grid;
+    grid.Build(brushes, table);
+    std::vector<uint32_t> allSolids(grid.Count());
+    for (uint32_t s = 0; s < allSolids.size(); ++s) allSolids[s] = s;
+    uint64_t solidTests = 0;
+
+    int hiddenCount = 0;
+
+    for (uint32_t rowA = 0; rowA < table.count; ++rowA) {
+        Brush& A = brushes[table.brush[rowA]];
+        Face& fA = A.faces[table.face[rowA]];
+        Target t;
+        if (!prepareTarget(table, rowA, t)) continue;
+
+        bool hidden = false, partialSeen = false;
+        for (uint32_t rowB = 0; rowB < table.count && !hidden; ++rowB) {
+            if (table.brushId[rowB] == A.id) continue;
+            hidden = covers(t, table, rowB);
+            if (!hidden && !partialSeen) partialSeen = nearPartial(t, table, rowB);
+        }
+        if (!hidden && partialSeen) {
+            thread_local std::vector<uint32_t> all;
+            all.resize(table.count);
+            for (uint32_t r = 0; r < table.count; ++r) all[r] = r;
+            hidden = unionCovers(t, table, all.data(), all.size());
+        }
+        if (!hidden) {
+            Vec3 lo, hi;
+            windingBounds(table, rowA, rowA + 1, lo, hi);
+            hidden = embedded(t, table, grid, allSolids.data(), allSolids.size(), lo, hi, solidTests);
+        }
+        if (hidden) {
+            fA.hidden = true;
+            hiddenCount++;
+        }
+    }
+
+    std::cout << "Detected " << hiddenCount << " hidden faces.\n";
+}
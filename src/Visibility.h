@@ -1,8 +1,32 @@
 ﻿#pragma once
+#include <cstdint>
 #include <vector>
+#include "Scalar.h"
 #include "VMFParser.h"   // On utilise les structs déjà définis ici
 
 namespace Visibility {
     // Détecte les faces cachées dans un ensemble de brushes
-    void DetectHiddenFaces(std::vector<Brush>& brushes);
+    // threads : nombre de threads du pool (1 = exécution série)
+    // precision : type des calculs du préfiltre (Scalar.h) ; même résultat
+    void DetectHiddenFaces(std::vector<Brush>& brushes, unsigned threads = 1, Precision precision = DEFAULT_PRECISION);
+
+    // Ne recalcule que les faces des brushes listés (indices dans brushes),
+    // contre toute la map ; les autres faces gardent leur flag actuel.
+    // Renvoie le nombre de faces cachées parmi celles recalculées.
+    int DetectHiddenFaces(std::vector<Brush>& brushes, const std::vector<int>& brushSubset, unsigned threads,
+        Precision precision = DEFAULT_PRECISION);
+
+    // Passe en double puis dans precision ; affiche les faces dont le flag
+    // diffère et les deux durées. Les brushes gardent le résultat de
+    // precision. Renvoie le nombre de faces qui diffèrent.
+    size_t ComparePrecision(std::vector<Brush>& brushes, Precision precision, unsigned threads);
+
+    // Boîte englobant toute la zone où ce brush peut cacher ou être caché
+    void InfluenceBounds(const Brush& b, Vec3& min, Vec3& max);
+
+    // Empreinte des tolérances et de la version de l'algorithme (pour les caches)
+    uint64_t SettingsHash();
+
+    // Version de référence O(F²), sans index : même résultat, sert à valider
+    void DetectHiddenFacesBruteForce(std::vector<Brush>& brushes);
 }
@@ -0,0 +1,204 @@
+﻿#include "VisibilityCache.h"
+#include "Fnv1a.h"
+#include "Profiler.h"
+#include "Visibility.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+    const char CACHE_MAGIC[8] = { 'V', 'M', 'F', 'V', 'C', 'A', 'C', 'H' };
+    const uint32_t CACHE_VERSION = 1;
+
+    // File layout (native endianness):
+    //   header | brushCount x BrushRecord | faceCount x uint8 hidden flags
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t settingsHash;
+        uint64_t brushCount;
+        uint64_t faceCount;
+    };
+
+    struct BrushRecord {
+        uint64_t hash;
+        double min[3];
+        double max[3];
+        uint32_t faceCount;
+        uint32_t reserved;
+    };
+
+    bool Overlaps(const BrushRecord& a, const BrushRecord& b) {
+        for (int k = 0; k < 3; ++k) {
+            if (a.max[k] < b.min[k] || b.max[k] < a.min[k]) return false;
+        }
+        return true;
+    }
+
+    BrushRecord MakeRecord(const Brush& b) {
+        BrushRecord r{};
+        r.hash = VisibilityCache::HashBrush(b);
+        Vec3 lo, hi;
+        Visibility::InfluenceBounds(b, lo, hi);
+        r.min[0] = lo.x; r.min[1] = lo.y; r.min[2] = lo.z;
+        r.max[0] = hi.x; r.max[1] = hi.y; r.max[2] = hi.z;
+        r.faceCount = static_cast<uint32_t>(b.faces.size());
+        return r;
+    }
+
+    bool Load(const std::string& path, std::vector<BrushRecord>& records, std::vector<uint8_t>& hidden) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) return false;
+
+        Header h{};
+        if (!in.read(reinterpret_cast<char*>(&h), sizeof(h))) return false;
+        if (std::memcmp(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) return false;
+        if (h.version != CACHE_VERSION || h.settingsHash != Visibility::SettingsHash()) return false;
+        if (h.brushCount > (1ull << 32) || h.faceCount > (1ull << 36)) return false;
+
+        records.resize(static_cast<size_t>(h.brushCount));
+        hidden.resize(static_cast<size_t>(h.faceCount));
+        if (!in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(BrushRecord))) return false;
+        if (!in.read(reinterpret_cast<char*>(hidden.data()), hidden.size())) return false;
+
+        uint64_t faces = 0;
+        for (const BrushRecord& r : records) faces += r.faceCount;
+        return faces == h.faceCount;
+    }
+
+    void Save(const std::string& path, const std::vector<BrushRecord>& records, const std::vector<Brush>& brushes) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "Visibility cache: cannot write " << path << "\n";
+            return;
+        }
+
+        Header h{};
+        std::memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        h.version = CACHE_VERSION;
+        h.settingsHash = Visibility::SettingsHash();
+        h.brushCount = records.size();
+
+        std::vector<uint8_t> hidden;
+        for (const Brush& b : brushes) {
+            for (const Face& f : b.faces) hidden.push_back(f.hidden ? 1 : 0);
+        }
+        h.faceCount = hidden.size();
+
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(BrushRecord));
+        out.write(reinterpret_cast<const char*>(hidden.data()), hidden.size());
+    }
+}
+
+std::string VisibilityCache::CachePathFor(const std::string& outputPath)
+{
+    return outputPath + ".vcache";
+}
+
+uint64_t VisibilityCache::HashBrush(const Brush& b)
+{
+    Fnv1a h;
+    const uint64_t count = b.faces.size();
+    h.Add(&count, sizeof(count));
+    h.Add(&b.roles, sizeof(b.roles));
+    for (const Face& f : b.faces) {
+        h.Add(&f.sideId, sizeof(f.sideId));
+        h.Add(f.p1);
+        h.Add(f.p2);
+        h.Add(f.p3);
+    }
+    return h.h;
+}
+
+void VisibilityCache::DetectHiddenFaces(std::vector<Brush>& brushes,
+    const std::string& cachePath,
+    unsigned threads,
+    Precision precision)
+{
+    std::vector<BrushRecord> current;
+    current.reserve(brushes.size());
+    for (const Brush& b : brushes) current.push_back(MakeRecord(b));
+
+    std::vector<BrushRecord> old;
+    std::vector<uint8_t> oldHidden;
+    if (!Load(cachePath, old, oldHidden)) {
+        Visibility::DetectHiddenFaces(brushes, threads, precision);
+        Save(cachePath, current, brushes);
+        return;
+    }
+
+    // Match every brush with an unused cached brush of identical content
+    std::vector<size_t> oldFirstFace(old.size());
+    std::unordered_multimap<uint64_t, size_t> oldByHash;
+    oldByHash.reserve(old.size());
+    size_t faceOffset = 0;
+    for (size_t i = 0; i < old.size(); ++i) {
+        oldFirstFace[i] = faceOffset;
+        faceOffset += old[i].faceCount;
+        oldByHash.emplace(old[i].hash, i);
+    }
+
+    std::vector<bool> consumed(old.size(), false);
+    std::vector<long long> match(brushes.size(), -1);
+    std::vector<BrushRecord> dirty;   // bounds of added, edited and removed brushes
+    for (size_t i = 0; i < brushes.size(); ++i) {
+        auto range = oldByHash.equal_range(current[i].hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (!consumed[it->second] && old[it->second].faceCount == current[i].faceCount) {
+                consumed[it->second] = true;
+                match[i] = static_cast<long long>(it->second);
+                break;
+            }
+        }
+        if (match[i] < 0) dirty.push_back(current[i]);
+    }
+    for (size_t i = 0; i < old.size(); ++i) {
+        if (!consumed[i]) dirty.push_back(old[i]);
+    }
+
+    // Brute-force box tests stop paying off once a large part of the map moved
+    if (dirty.size() > 4096 || dirty.size() * 4 > brushes.size() + 4) {
+        std::cout << "Visibility cache: " << dirty.size() << " brushes changed, full pass.\n";
+        Visibility::DetectHiddenFaces(brushes, threads, precision);
+        Save(cachePath, current, brushes);
+        return;
+    }
+
+    std::vector<int> subset;
+    for (size_t i = 0; i < brushes.size(); ++i) {
+        bool reevaluate = match[i] < 0;
+        for (size_t d = 0; d < dirty.size() && !reevaluate; ++d) {
+            reevaluate = Overlaps(current[i], dirty[d]);
+        }
+
+        if (reevaluate) {
+            subset.push_back(static_cast<int>(i));
+            continue;
+        }
+        const size_t first = oldFirstFace[static_cast<size_t>(match[i])];
+        for (size_t k = 0; k < brushes[i].faces.size(); ++k) {
+            brushes[i].faces[k].hidden = oldHidden[first + k] != 0;
+        }
+    }
+
+    std::cout << "Visibility cache: " << (brushes.size() - subset.size()) << "/" << brushes.size()
+        << " brushes reused, " << subset.size() << " re-evaluated.\n";
+    Profiler::Add("cache_brushes_reused", brushes.size() - subset.size());
+    if (!subset.empty()) {
+        size_t faces = 0;
+        for (int i : subset) faces += brushes[i].faces.size();
+        const int hidden = Visibility::DetectHiddenFaces(brushes, subset, threads, precision);
+        std::cout << "Re-evaluated " << faces << " faces, " << hidden << " hidden.\n";
+    }
+
+    int hiddenCount = 0;
+    for (const Brush& b : brushes) {
+        for (const Face& f : b.faces) hiddenCount += f.hidden ? 1 : 0;
+    }
+    std::cout << "Detected " << hiddenCount << " hidden faces.\n";
+
+    Save(cachePath, current, brushes);
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+#include "Geometry.h"
+#include "Scalar.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk cache of the visibility pass, stored next to the output VMF.
+//
+// Each brush is keyed by a hash of its content (plane points and side ids).
+// On a re-run, brushes whose hash is in the cache get their hidden flags
+// back from it; only new/edited brushes, and brushes whose influence bounds
+// overlap an added or removed brush, go through the visibility pass again.
+class VisibilityCache {
+public:
+    // Same result as Visibility::DetectHiddenFaces, then rewrites the cache.
+    // A missing, stale or corrupted cache file just means a full pass.
+    static void DetectHiddenFaces(std::vector<Brush>& brushes,
+        const std::string& cachePath,
+        unsigned threads,
+        Precision precision = DEFAULT_PRECISION);
+
+    // "<output>.vcache"
+    static std::string CachePathFor(const std::string& outputPath);
+
+    // 64-bit content hash of a brush (plane points + side ids)
+    static uint64_t HashBrush(const Brush& b);
+};
@@ -0,0 +1,300 @@
+﻿#include "Watch.h"
+#include "FileWatcher.h"
+#include "MappedFile.h"
+#include "TextHash.h"
+#include "ThreadPool.h"
+#include "VMFParser.h"
+#include "Visibility.h"
+#include "Writer.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace {
+    // Past this many moved brushes a whole-map pass is cheaper than the box tests
+    const size_t MAX_MOVED = 4096;
+
+    struct Bounds {
+        Vec3 min, max;
+    };
+
+    bool Overlaps(const Bounds& a, const Bounds& b) {
+        return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y
+            && a.min.z <= b.max.z && b.min.z <= a.max.z;
+    }
+
+    void Extend(Bounds& a, const Bounds& b) {
+        a.min = { std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z) };
+        a.max = { std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z) };
+    }
+
+    // Resident state of one solid, parallel to WarmMap::brushes
+    struct SolidState {
+        int id = -1;            // VMF "id" of the solid
+        uint64_t hash = 0;      // TextHash of its block
+        size_t begin = 0;       // offset of the block in the source
+        Bounds influence;       // Visibility::InfluenceBounds
+    };
+
+    struct WarmMap {
+        std::vector<Brush> brushes;
+        std::vector<SolidState> solids;
+        std::vector<Entity> entities;
+        MaterialTable materials;    // only grows: names no side uses any more stay
+    };
+
+    struct UpdateStats {
+        size_t parsed = 0;          // solids parsed again
+        size_t removed = 0;
+        size_t reevaluated = 0;     // brushes through the visibility pass
+        size_t context = 0;         // occluders rebuilt around them
+        bool full = false;
+    };
+
+    struct Stamp {
+        uintmax_t size = 0;
+        fs::file_time_type time{};
+        bool operator==(const Stamp& o) const { return size == o.size && time == o.time; }
+    };
+
+    bool ReadStamp(const std::string& path, Stamp& out) {
+        std::error_code error;
+        out.size = fs::file_size(path, error);
+        if (error) return false;
+        out.time = fs::last_write_time(path, error);
+        return !error;
+    }
+
+    // Brings warm up to date with the source. False if the text ends inside
+    // a solid (save in progress); warm is then left as it was.
+    bool Update(WarmMap& warm, const std::string& path, const Pipeline::Settings& settings, UpdateStats& stats) {
+        // The mapping is closed before the visibility pass: on Windows it
+        // would keep the editor from saving again
+        std::vector<VMFParser::SolidBlock> blocks;
+        ParsedMap rest;
+        std::vector<uint64_t> hashes;
+        std::vector<long long> match;       // resident solid kept for each block, -1 = parsed
+        std::vector<size_t> changed;
+        std::vector<ParsedMap> parts;
+        size_t partCount = 0;
+        {
+            MappedFile file(path);
+            const std::string_view text = file.View();
+            if (!VMFParser::ScanSolids(text, blocks, rest)) return false;
+
+            // Same id and same text: the resident brush is kept
+            std::unordered_multimap<int, size_t> residentById;
+            residentById.reserve(warm.solids.size());
+            for (size_t i = 0; i < warm.solids.size(); ++i) residentById.emplace(warm.solids[i].id, i);
+            std::vector<uint8_t> taken(warm.solids.size(), 0);
+            hashes.resize(blocks.size());
+            match.assign(blocks.size(), -1);
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                hashes[i] = TextHash::Of(text.substr(blocks[i].begin, blocks[i].end - blocks[i].begin));
+                auto range = residentById.equal_range(blocks[i].id);
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (!taken[it->second] && warm.solids[it->second].hash == hashes[i]) {
+                        taken[it->second] = 1;
+                        match[i] = static_cast<long long>(it->second);
+                        break;
+                    }
+                }
+                if (match[i] < 0) changed.push_back(i);
+            }
+            stats.removed = std::count(taken.begin(), taken.end(), 0);
+
+            // New and edited solids, in chunks on the pool
+            ThreadPool pool(settings.threads);
+            partCount = std::min(changed.size(), static_cast<size_t>(pool.Size()) * 4);
+            parts.resize(partCount);
+            pool.ParallelFor(partCount, 1, [&](size_t begin, size_t end, unsigned) {
+                for (size_t c = begin; c < end; ++c) {
+                    for (size_t k = changed.size() * c / partCount; k < changed.size() * (c + 1) / partCount; ++k)
+                        VMFParser::ParseSolid(text, blocks[changed[k]], parts[c]);
+                }
+            });
+        }
+        stats.parsed = changed.size();
+
+        // Dirty boxes: where brushes were removed, and (below) where they appear
+        std::vector<Bounds> moved;
+        std::vector<uint8_t> kept(warm.solids.size(), 0);
+        for (long long m : match) {
+            if (m >= 0) kept[static_cast<size_t>(m)] = 1;
+        }
+        for (size_t i = 0; i < warm.solids.size(); ++i) {
+            if (!kept[i]) moved.push_back(warm.solids[i].influence);
+        }
+
+        std::vector<Brush> brushes(blocks.size());
+        std::vector<SolidState> solids(blocks.size());
+        std::vector<uint8_t> dirty(blocks.size(), 0);
+        for (size_t c = 0; c < partCount; ++c) {
+            ParsedMap& part = parts[c];
+            const size_t first = changed.size() * c / partCount;
+            if (part.brushes.size() != changed.size() * (c + 1) / partCount - first)
+                throw std::runtime_error("Watch: solid blocks and parsed brushes differ");
+            std::vector<uint32_t> remap(part.materials.Size());
+            for (uint32_t id = 0; id < remap.size(); ++id) remap[id] = warm.materials.Intern(part.materials.Name(id));
+            for (size_t j = 0; j < part.brushes.size(); ++j) {
+                const size_t i = changed[first + j];
+                Brush& b = brushes[i];
+                b.faces.assign(part.FacesOf(j), part.FacesOf(j) + part.brushes[j].faceCount);
+                for (Face& f : b.faces) f.material = remap[f.material];
+                b.ComputeAABB();
+                dirty[i] = 1;
+            }
+            part = ParsedMap();
+        }
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (match[i] < 0) continue;
+            const size_t r = static_cast<size_t>(match[i]);
+            // The text moved with the edits before it
+            const int64_t shift = static_cast<int64_t>(blocks[i].begin) - static_cast<int64_t>(warm.solids[r].begin);
+            brushes[i] = std::move(warm.brushes[r]);
+            for (Face& f : brushes[i].faces) {
+                if (f.materialOffset >= 0) f.materialOffset += shift;
+                if (f.sideEndOffset >= 0) f.sideEndOffset += shift;
+            }
+            solids[i].influence = warm.solids[r].influence;
+        }
+
+        // Ids as a full parse gives them
+        int faceId = 0;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            Brush& b = brushes[i];
+            b.id = static_cast<int>(i);
+            b.entity = blocks[i].entity;
+            for (Face& f : b.faces) {
+                f.id = faceId++;
+                f.brushID = b.id;
+            }
+            solids[i].id = blocks[i].id;
+            solids[i].hash = hashes[i];
+            solids[i].begin = blocks[i].begin;
+        }
+
+        // An entity block may have changed class: a kept brush with new roles is dirty too
+        std::vector<uint8_t> roles(brushes.size());
+        for (size_t i = 0; i < brushes.size(); ++i) roles[i] = brushes[i].roles;
+        EntityPolicy::Apply(settings.policy, brushes, rest.entities, warm.materials);
+        for (size_t i = 0; i < brushes.size(); ++i) {
+            if (match[i] >= 0 && brushes[i].roles != roles[i]) dirty[i] = 1;
+            if (!dirty[i]) continue;
+            if (match[i] < 0) Visibility::InfluenceBounds(brushes[i], solids[i].influence.min, solids[i].influence.max);
+            moved.push_back(solids[i].influence);
+        }
+
+        stats.full = warm.solids.empty() || moved.size() > MAX_MOVED || moved.size() * 4 > brushes.size() + 4;
+        if (stats.full) {
+            Visibility::DetectHiddenFaces(brushes, settings.threads, settings.precision);
+            stats.reevaluated = brushes.size();
+        }
+        else if (!moved.empty()) {
+            Bounds area = moved[0];
+            for (const Bounds& m : moved) Extend(area, m);
+
+            // Re-evaluated: brushes whose influence meets a moved box
+            std::vector<size_t> targets;
+            std::vector<uint8_t> isTarget(brushes.size(), 0);
+            for (size_t i = 0; i < brushes.size(); ++i) {
+                bool hit = dirty[i] != 0;
+                if (!hit && Overlaps(solids[i].influence, area)) {
+                    for (size_t d = 0; d < moved.size() && !hit; ++d) hit = Overlaps(solids[i].influence, moved[d]);
+                }
+                if (!hit) continue;
+                isTarget[i] = 1;
+                targets.push_back(i);
+            }
+
+            // Rebuilt with every occluder that can cover one of their faces
+            std::vector<Brush> local;
+            std::vector<int> localTargets;
+            Bounds reach = solids[targets[0]].influence;
+            for (size_t t : targets) {
+                localTargets.push_back(static_cast<int>(local.size()));
+                local.push_back(brushes[t]);
+                Extend(reach, solids[t].influence);
+            }
+            for (size_t i = 0; i < brushes.size(); ++i) {
+                if (isTarget[i] || !(brushes[i].roles & ROLE_OCCLUDER) || brushes[i].faces.empty()) continue;
+                if (!Overlaps(solids[i].influence, reach)) continue;
+                bool hit = false;
+                for (size_t k = 0; k < targets.size() && !hit; ++k) hit = Overlaps(solids[i].influence, solids[targets[k]].influence);
+                if (hit) local.push_back(brushes[i]);
+            }
+
+            Visibility::DetectHiddenFaces(local, localTargets, settings.threads, settings.precision);
+            for (size_t k = 0; k < targets.size(); ++k) {
+                std::vector<Face>& faces = brushes[targets[k]].faces;
+                for (size_t f = 0; f < faces.size(); ++f) faces[f].hidden = local[k].faces[f].hidden;
+            }
+            stats.reevaluated = targets.size();
+            stats.context = local.size() - targets.size();
+        }
+
+        warm.brushes = std::move(brushes);
+        warm.solids = std::move(solids);
+        warm.entities = std::move(rest.entities);
+        return true;
+    }
+}
+
+void Watch::Run(const Pipeline::Job& job, const Pipeline::Settings& settings)
+{
+    if (settings.fill || settings.rays || settings.useCache || settings.lowMemory)
+        std::cout << "Watch: -fill, -rays, -cache and -lowmem are not run in this mode.\n";
+
+    // Writing the output would wake the watch up again
+    std::error_code error;
+    if (fs::equivalent(job.input, job.output, error))
+        throw std::runtime_error("Watch: the output must not be the source map: " + job.output);
+
+    // Watching before the first parse: a save made meanwhile is not missed
+    FileWatcher watcher(job.input);
+    WarmMap warm;
+    Stamp done;
+    bool loaded = false;
+    for (;;) {
+        Stamp now;
+        if (ReadStamp(job.input, now) && !(loaded && now == done)) {
+            const auto start = std::chrono::steady_clock::now();
+            try {
+                UpdateStats stats;
+                if (!Update(warm, job.input, settings, stats)) {
+                    std::cout << "Watch: " << job.input << " ends inside a solid (still being saved?), waiting.\n";
+                }
+                else {
+                    if (settings.delta) Writer::WritePatch(job.input, job.output, warm.brushes, warm.materials);
+                    else Writer::ApplyNodraw(job.input, job.output, warm.brushes, &warm.materials);
+                    loaded = true;
+                    done = now;
+
+                    size_t hidden = 0;
+                    for (const Brush& b : warm.brushes) {
+                        for (const Face& f : b.faces) hidden += f.hidden ? 1 : 0;
+                    }
+                    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                    std::cout << "Watch: " << stats.parsed << " solids parsed, " << stats.removed << " removed, "
+                        << stats.reevaluated << " brushes re-evaluated";
+                    if (stats.full) std::cout << " (full pass)";
+                    else std::cout << " with " << stats.context << " neighbours";
+                    std::cout << "; " << hidden << " hidden faces, updated in " << ms << " ms.\n";
+                }
+            }
+            catch (const std::exception& e) {
+                if (!loaded) throw;
+                std::cerr << "Watch: " << e.what() << "\n";
+            }
+            // Flushed: the output is often read through a pipe
+            std::cout << "Watching " << job.input << " (Ctrl+C to stop)..." << std::endl;
+        }
+        if (!watcher.Wait()) throw std::runtime_error("Watch: lost the watch on " + job.input);
+    }
+}
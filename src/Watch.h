@@ -0,0 +1,21 @@
+﻿#pragma once
+#include "Pipeline.h"
+
+// Watch mode (-watch): the map is parsed and optimized once, then kept in
+// memory while the source VMF is watched (FileWatcher). On every save:
+//   - the solid blocks are found with the parser's brace-depth prescan and
+//     matched with the resident brushes by their "id" key and a hash of
+//     their text; only new and edited solids are parsed again, the others
+//     keep their faces (material offsets follow the text);
+//   - brushes whose influence bounds overlap an added, edited or removed
+//     brush are re-evaluated, rebuilt with the occluders around them only
+//     (same result as a whole-map pass);
+//   - the output (copy or -delta patch) is rewritten.
+// The outside fill, ray sampling, caches and low-memory mode work on the
+// whole map or on disk and are not run in this mode.
+namespace Watch {
+    // Runs until the watch breaks or the process is stopped. Throws if the
+    // first update fails; later failures (say, a file renamed away while
+    // saving) are reported and the next save is waited for.
+    void Run(const Pipeline::Job& job, const Pipeline::Settings& settings);
+}
@@ -0,0 +1,241 @@
+﻿#include "Winding.h"
+#include <cmath>
+
+namespace {
+    const double MAX_COORD = 131072.0;   // well past Hammer's +-16384 map limits
+    const double CLIP_EPS = 1e-3;        // points this close to a plane are kept
+    const double MERGE_EPS = 1e-6;
+
+    // Keeps the part of poly where sign * (Dot(n, p) - d) >= -CLIP_EPS
+    void ClipByPlane(std::vector<Vec3>& poly, const Vec3& n, double d, double sign, std::vector<Vec3>& scratch) {
+        scratch.clear();
+        const size_t count = poly.size();
+        for (size_t i = 0; i < count; ++i) {
+            const Vec3& a = poly[i];
+            const Vec3& b = poly[(i + 1) % count];
+            const double da = sign * (Dot(n, a) - d);
+            const double db = sign * (Dot(n, b) - d);
+            const bool inA = da >= -CLIP_EPS;
+            const bool inB = db >= -CLIP_EPS;
+            if (inA) scratch.push_back(a);
+            if (inA != inB) {
+                const double t = da / (da - db);
+                scratch.push_back(a + (b - a) * t);
+            }
+        }
+        poly.swap(scratch);
+    }
+
+    void RemoveDuplicates(std::vector<Vec3>& poly) {
+        std::vector<Vec3> out;
+        for (const Vec3& p : poly) {
+            if (!out.empty() && Length(p - out.back()) < MERGE_EPS) continue;
+            out.push_back(p);
+        }
+        while (out.size() > 1 && Length(out.front() - out.back()) < MERGE_EPS) out.pop_back();
+        poly.swap(out);
+    }
+}
+
+void WindingPool::Build(const std::vector<Brush>& brushes)
+{
+    vertices.clear();
+    first.clear();
+    count.clear();
+    for (const Brush& b : brushes) AddBrush(b);
+}
+
+void WindingPool::AddEmpty(size_t faceCount)
+{
+    first.insert(first.end(), faceCount, static_cast<uint32_t>(vertices.size()));
+    count.insert(count.end(), faceCount, 0u);
+}
+
+void WindingPool::AddBrush(const Brush& b)
+{
+    const double sign = Winding::InwardSign(b);
+
+    std::vector<Vec3> poly, scratch;
+    for (size_t i = 0; i < b.faces.size(); ++i) {
+        const Face& f = b.faces[i];
+        first.push_back(static_cast<uint32_t>(vertices.size()));
+
+        Vec3 u, v;
+        if (Length(f.normal) < 1e-4 || !BuildBasis(f.normal, u, v)) {
+            count.push_back(0);
+            continue;
+        }
+
+        const double d = Dot(f.normal, f.p1);
+        const Vec3 origin = f.normal * d;
+        poly.assign({ origin - u * MAX_COORD - v * MAX_COORD, origin + u * MAX_COORD - v * MAX_COORD,
+                      origin + u * MAX_COORD + v * MAX_COORD, origin - u * MAX_COORD + v * MAX_COORD });
+
+        for (size_t j = 0; j < b.faces.size() && poly.size() >= 3; ++j) {
+            if (j == i) continue;
+            const Face& o = b.faces[j];
+            if (Length(o.normal) < 1e-4) continue;
+            const double dj = Dot(o.normal, o.p1);
+            // Same plane written twice: it would clip the side away
+            if (Dot(o.normal, f.normal) > 1.0 - 1e-9 && std::abs(dj - d) < CLIP_EPS) continue;
+            ClipByPlane(poly, o.normal, dj, sign, scratch);
+        }
+
+        RemoveDuplicates(poly);
+        if (poly.size() < 3) {
+            count.push_back(0);
+            continue;
+        }
+        vertices.insert(vertices.end(), poly.begin(), poly.end());
+        count.push_back(static_cast<uint32_t>(poly.size()));
+    }
+}
+
+double Winding::InwardSign(const Brush& b)
+{
+    // Hammer writes the plane points clockwise, so depending on the source the
+    // computed normals point in or out: the brush's mean plane point tells.
+    Vec3 inside;
+    int points = 0;
+    for (const Face& f : b.faces) {
+        inside = inside + f.p1 + f.p2 + f.p3;
+        points += 3;
+    }
+    if (points > 0) inside = inside * (1.0 / points);
+
+    double side = 0.0;
+    for (const Face& f : b.faces) {
+        if (Length(f.normal) < 1e-4) continue;
+        side += Dot(f.normal, inside) - Dot(f.normal, f.p1);
+    }
+    return (side >= 0.0) ? 1.0 : -1.0;
+}
+
+void Winding::Project(const Vec3* poly, uint32_t n, const Vec3& u, const Vec3& v, std::vector<Point2>& out)
+{
+    out.resize(n);
+    Project(poly, n, u, v, out.data());
+}
+
+void Winding::Project(const Vec3* poly, uint32_t n, const Vec3& u, const Vec3& v, Point2* out)
+{
+    for (uint32_t i = 0; i < n; ++i) out[i] = { Dot(poly[i], u), Dot(poly[i], v) };
+
+    double twice = 0.0;
+    for (uint32_t i = 0; i < n; ++i) {
+        const Point2& a = out[i];
+        const Point2& b = out[i + 1 < n ? i + 1 : 0];
+        twice += a.u * b.v - b.u * a.v;
+    }
+    if (twice < 0.0) {
+        for (uint32_t i = 0, j = n - 1; i < j; ++i, --j) std::swap(out[i], out[j]);
+    }
+}
+
+double Winding::Area(const Point2* poly, size_t n)
+{
+    double twice = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const Point2& a = poly[i];
+        const Point2& b = poly[i + 1 < n ? i + 1 : 0];
+        twice += a.u * b.v - b.u * a.v;
+    }
+    return std::abs(twice) * 0.5;
+}
+
+double Winding::OverlapArea(const Point2* a, size_t na, const Point2* b, size_t nb)
+{
+    // Sutherland-Hodgman: clip a by every edge of b
+    thread_local std::vector<Point2> poly, next;
+    poly.assign(a, a + na);
+
+    for (size_t e = 0; e < nb && poly.size() >= 3; ++e) {
+        const Point2& p = b[e];
+        const Point2& q = b[e + 1 < nb ? e + 1 : 0];
+        const double ex = q.u - p.u, ey = q.v - p.v;
+        auto inside = [&](const Point2& s) { return ex * (s.v - p.v) - ey * (s.u - p.u); };
+
+        next.clear();
+        const size_t n = poly.size();
+        for (size_t i = 0; i < n; ++i) {
+            const Point2& s = poly[i];
+            const Point2& t = poly[i + 1 < n ? i + 1 : 0];
+            const double ds = inside(s);
+            const double dt = inside(t);
+            if (ds >= 0.0) next.push_back(s);
+            if ((ds >= 0.0) != (dt >= 0.0)) {
+                const double k = ds / (ds - dt);
+                next.push_back({ s.u + (t.u - s.u) * k, s.v + (t.v - s.v) * k });
+            }
+        }
+        poly.swap(next);
+    }
+    return poly.size() >= 3 ? Area(poly.data(), poly.size()) : 0.0;
+}
+
+double Winding::UncoveredArea(const Point2* a, size_t na, const Point2* points, const uint32_t* count, size_t polygons,
+    double stopAt, size_t maxPieces)
+{
+    // Pieces as runs of one point pool: first[k] .. first[k + 1]
+    thread_local std::vector<Point2> pool, nextPool, inside, scratch;
+    thread_local std::vector<uint32_t> first, nextFirst;
+    pool.assign(a, a + na);
+    first.assign({ 0u, static_cast<uint32_t>(na) });
+
+    double left = Area(a, na);
+    const Point2* b = points;
+    for (size_t k = 0; k < polygons && left > stopAt; b += count[k], ++k) {
+        const size_t nb = count[k];
+        if (nb < 3) continue;
+        nextPool.clear();
+        nextFirst.assign(1, 0u);
+        left = 0.0;
+
+        for (size_t piece = 0; piece + 1 < first.size(); ++piece) {
+            inside.assign(pool.begin() + first[piece], pool.begin() + first[piece + 1]);
+
+            // Each edge of b cuts off the part of the piece outside it; what
+            // is inside every edge is covered and dropped
+            for (size_t e = 0; e < nb && inside.size() >= 3; ++e) {
+                const Point2& p = b[e];
+                const Point2& q = b[e + 1 < nb ? e + 1 : 0];
+                const double ex = q.u - p.u, ey = q.v - p.v;
+                auto side = [&](const Point2& s) { return ex * (s.v - p.v) - ey * (s.u - p.u); };
+
+                scratch.clear();
+                const size_t outFirst = nextPool.size();
+                const size_t n = inside.size();
+                for (size_t i = 0; i < n; ++i) {
+                    const Point2& s = inside[i];
+                    const Point2& t = inside[i + 1 < n ? i + 1 : 0];
+                    const double ds = side(s);
+                    const double dt = side(t);
+                    if (ds >= 0.0) scratch.push_back(s);
+                    else nextPool.push_back(s);
+                    if ((ds >= 0.0) != (dt >= 0.0)) {
+                        const double r = ds / (ds - dt);
+                        const Point2 x{ s.u + (t.u - s.u) * r, s.v + (t.v - s.v) * r };
+                        scratch.push_back(x);
+                        nextPool.push_back(x);
+                    }
+                }
+                const size_t outCount = nextPool.size() - outFirst;
+                const double outArea = outCount >= 3 ? Area(nextPool.data() + outFirst, outCount) : 0.0;
+                if (outArea > 0.0) {
+                    nextFirst.push_back(static_cast<uint32_t>(nextPool.size()));
+                    left += outArea;
+                    if (nextFirst.size() > maxPieces + 1) return -1.0;
+                }
+                else {
+                    nextPool.resize(outFirst);
+                }
+                inside.swap(scratch);
+            }
+            // A piece that b misses goes out whole at the edge that separates
+            // them; what is still in inside is covered
+        }
+        pool.swap(nextPool);
+        first.swap(nextFirst);
+    }
+    return left;
+}
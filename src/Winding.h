@@ -0,0 +1,50 @@
+﻿#pragma once
+#include "Geometry.h"
+#include <cstdint>
+#include <vector>
+
+// Convex polygon of every side, obtained by clipping the side's plane with
+// the other planes of its brush (what VBSP does). All polygons live in one
+// vertex pool, indexed by face row (brush/face order, same as FaceTable).
+struct WindingPool {
+    std::vector<Vec3> vertices;
+    std::vector<uint32_t> first;    // per face row
+    std::vector<uint32_t> count;    // 0 if the side has no area (redundant plane)
+
+    void Build(const std::vector<Brush>& brushes);
+
+    // Appends the windings of one brush (one entry per face, in order)
+    void AddBrush(const Brush& b);
+
+    // Appends faceCount empty entries (a brush left out)
+    void AddEmpty(size_t faceCount);
+
+    const Vec3* Polygon(uint32_t row) const { return vertices.data() + first[row]; }
+};
+
+namespace Winding {
+    struct Point2 {
+        double u, v;
+    };
+
+    // +1 if the computed face normals of the brush point inward, -1 if outward
+    double InwardSign(const Brush& b);
+
+    // Projects a 3D polygon on the (u, v) basis, counter-clockwise
+    void Project(const Vec3* poly, uint32_t n, const Vec3& u, const Vec3& v, std::vector<Point2>& out);
+    void Project(const Vec3* poly, uint32_t n, const Vec3& u, const Vec3& v, Point2* out);
+
+    // Area of a 2D polygon of n points (absolute value)
+    double Area(const Point2* poly, size_t n);
+
+    // Area of the intersection of two counter-clockwise convex polygons
+    double OverlapArea(const Point2* a, size_t na, const Point2* b, size_t nb);
+
+    // Area of the convex polygon a left uncovered by the union of convex
+    // polygons (count[k] points each, one after the other in points): a is
+    // cut into convex pieces outside each of them. Stops as soon as the
+    // pieces left add up to stopAt or less and returns that sum; returns -1
+    // past maxPieces pieces.
+    double UncoveredArea(const Point2* a, size_t na, const Point2* points, const uint32_t* count, size_t polygons,
+        double stopAt, size_t maxPieces);
+}
@@ -1,220 +1,232 @@
 ﻿#include "Writer.h"
-#include "VMFParser.h" // pour Brush / Face structures
+#include "MappedFile.h"
+#include "Patch.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
-#include <sstream>
+#include <iostream>
+#include <stdexcept>
 #include <string>
 #include <vector>
-#include <iostream>
 
-// Petite aide pour trim gauche/droite, on garde l'indentation originale
-static inline std::string ltrim_copy(const std::string& s) {
-    size_t i = s.find_first_not_of(" \t\r\n");
-    return (i == std::string::npos) ? std::string() : s.substr(i);
-}
-static inline std::string rtrim_copy(const std::string& s) {
-    size_t i = s.find_last_not_of(" \t\r\n");
-    return (i == std::string::npos) ? std::string() : s.substr(0, i + 1);
-}
-static inline std::string trim_copy(const std::string& s) {
-    return rtrim_copy(ltrim_copy(s));
-}
+const char* const Writer::NODRAW_MATERIAL = "tools/toolsnodraw";
+
+namespace {
+    const size_t EVICT_STEP = 8u << 20;     // pages libérées par paquets (mode mémoire réduite)
+
+    // Ajoute le splice d'une face cachée ; false si le fichier n'est plus
+    // celui qui a été parsé
+    bool AddSplice(std::string_view src, const Face& f, const MaterialTable* materials,
+        std::vector<Writer::Splice>& splices) {
+        if (f.materialOffset >= 0) {
+            const size_t at = static_cast<size_t>(f.materialOffset);
+            const bool same = at > 0 && at + f.materialLength < src.size()
+                && src[at - 1] == '"' && src[at + f.materialLength] == '"'
+                && (!materials || src.substr(at, f.materialLength) == materials->Name(f.material));
+            if (!same) return false;
+            splices.push_back({ f.materialOffset, f.materialLength, Writer::NODRAW_MATERIAL });
+        }
+        else if (f.sideEndOffset >= 0 && static_cast<size_t>(f.sideEndOffset) < src.size()) {
+            splices.push_back(Writer::MaterialInsertion(src, f.sideEndOffset, Writer::NODRAW_MATERIAL));
+        }
+        return true;
+    }
 
-// Remplace la valeur d'un keyvalue "material" dans une ligne VMF, en conservant l'indentation.
-// Si la ligne ne contient pas de "material", retourne false.
-static bool ReplaceMaterialLine(std::string& line, const std::string& newMat) {
-    std::string trimmed = trim_copy(line);
-    // On veut seulement remplacer une vraie ligne de material (ex:  "material" "blah")
-    if (trimmed.size() < 10) return false;
-    // On exige que "material" apparaisse en tant que clé
-    size_t keyPos = trimmed.find("\"material\"");
-    if (keyPos == std::string::npos) return false;
-
-    // Récupérer l'indentation d'origine
-    size_t firstNonWs = line.find_first_not_of(" \t\r\n");
-    std::string indent = (firstNonWs == std::string::npos) ? "" : line.substr(0, firstNonWs);
-
-    // Construire la nouvelle ligne propre
-    std::ostringstream oss;
-    oss << indent << "\"material\" \"" << newMat << "\"";
-    line = oss.str();
-    return true;
+    // Le parser a noté, pour chaque side, où se trouve la valeur "material"
+    // (ou à défaut son '}') : on ne remplace que les faces cachées.
+    // forEachHidden(add) appelle add(face) pour chacune. Lève une
+    // std::runtime_error si rien n'a pu être écrit.
+    template<typename ForEachHidden>
+    void WriteNodraw(const std::string& srcPath, const std::string& dstPath, const MaterialTable* materials,
+        bool evict, ForEachHidden forEachHidden) {
+        Profiler::Timer timer("write");
+        MappedFile in;
+        try {
+            in.Open(srcPath);
+        }
+        catch (const std::runtime_error&) {
+            throw std::runtime_error("Writer: failed to open " + srcPath);
+        }
+        const std::string_view src = in.View();
+
+        // Les vérifications lisent le fichier à chaque face : en mode mémoire
+        // réduite (faces dans l'ordre du fichier) on libère derrière elles
+        std::vector<Writer::Splice> splices;
+        bool same = true;
+        size_t evicted = 0;
+        forEachHidden([&](const Face& f) {
+            if (!same) return;
+            same = AddSplice(src, f, materials, splices);
+            const size_t at = static_cast<size_t>(std::max(f.materialOffset, f.sideEndOffset));
+            if (evict && at >= evicted + EVICT_STEP) {
+                in.Evict(at);
+                evicted = at;
+            }
+        });
+        if (evict) in.Evict(src.size());
+        if (!same) throw std::runtime_error("Writer: " + srcPath + " changed since it was parsed, nothing written");
+
+        std::sort(splices.begin(), splices.end(), [](const Writer::Splice& a, const Writer::Splice& b) {
+            return a.offset < b.offset;
+        });
+
+        Profiler::Add("faces_nodraw", splices.size());
+        if (!Writer::WriteSpliced(src, dstPath, splices, &in, evict))
+            throw std::runtime_error("Writer: failed to write " + dstPath);
+
+        std::cout << "Optimized VMF written to " << dstPath << "\n";
+    }
 }
 
-void Writer::ApplyNodraw(const std::string& srcPath,
-    const std::string& dstPath,
-    const std::vector<Brush>& brushes)
+// Ligne "material" à injecter juste avant le '}' d'un side qui n'en a pas :
+// même indentation que la ligne du '}', plus une tabulation.
+Writer::Splice Writer::MaterialInsertion(std::string_view src, int64_t closeOffset, std::string_view material)
 {
-    std::ifstream in(srcPath);
-    std::ofstream out(dstPath, std::ios::trunc);
-
-    if (!in.is_open() || !out.is_open()) {
-        // On ne throw pas ici pour rester soft, mais on pourrait
-        std::cerr << "Writer: failed to open input or output file.\n";
-        return;
+    size_t lineStart = static_cast<size_t>(closeOffset);
+    while (lineStart > 0 && src[lineStart - 1] != '\n') --lineStart;
+
+    size_t indentEnd = lineStart;
+    while (indentEnd < src.size() && (src[indentEnd] == ' ' || src[indentEnd] == '\t')) ++indentEnd;
+
+    const bool crlf = lineStart >= 2 && src[lineStart - 2] == '\r';
+
+    Splice s;
+    s.offset = static_cast<int64_t>(lineStart);
+    s.length = 0;
+    s.text.assign(src.substr(lineStart, indentEnd - lineStart));
+    s.text += "\t\"material\" \"";
+    s.text += material;
+    s.text += crlf ? "\"\r\n" : "\"\n";
+
+    // '}' sur la même ligne que d'autres tokens : on insère juste avant lui
+    if (indentEnd != static_cast<size_t>(closeOffset)) {
+        s.offset = closeOffset;
+        s.text = " \"material\" \"";
+        s.text += material;
+        s.text += "\" ";
     }
+    return s;
+}
 
-    // On s'aligne sur l'ordre exact rencontré lors du parsing :
-    // - brushes : dans l'ordre où le parser les a rencontrés
-    // - faces   : dans l'ordre des 'side' à l'intérieur du 'solid'
-    int brushIndex = -1;
-    int faceIndexWithinBrush = -1;
-
-    bool pendingSolid = false;
-    bool inSolid = false;
-    int solidBraceDepth = 0;
-
-    bool pendingSide = false;
-    bool inSide = false;
-    int sideBraceDepth = 0;
-
-    // Pour savoir si, pendant un side, on a déjà vu une ligne "material"
-    bool sideSawMaterialLine = false;
-
-    std::string rawLine;
-    while (std::getline(in, rawLine)) {
-        std::string line = trim_copy(rawLine);
-
-        // Détection "solid" (même si { est sur la ligne suivante)
-        if (!inSolid && !pendingSolid) {
-            if (line.rfind("solid", 0) == 0) {
-                pendingSolid = true;
-                out << rawLine << "\n";
-                continue;
+bool Writer::WriteSpliced(std::string_view src,
+    const std::string& dstPath,
+    const std::vector<Splice>& splices,
+    MappedFile* source,
+    bool evict)
+{
+    // Écrit à côté puis renommé : la sortie peut être la source elle-même,
+    // encore mappée, et une sortie existante reste intacte en cas d'échec
+    const std::string temp = dstPath + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return false;
+
+    // Les plages intactes sont recopiées en un seul write chacune (par
+    // morceaux si on libère la source au fur et à mesure)
+    size_t evicted = 0;
+    auto copy = [&](size_t from, size_t to) {
+        while (from < to) {
+            const size_t end = evict ? std::min(to, from + EVICT_STEP) : to;
+            out.write(src.data() + from, static_cast<std::streamsize>(end - from));
+            from = end;
+            if (evict && source && from >= evicted + EVICT_STEP) {
+                out.flush();
+                source->Evict(from);
+                evicted = from;
             }
         }
+    };
+
+    size_t pos = 0;
+    uint64_t written = 0;
+    for (const Splice& s : splices) {
+        const size_t at = static_cast<size_t>(s.offset);
+        if (at < pos || at + static_cast<size_t>(s.length) > src.size()) continue; // splice invalide
+        copy(pos, at);
+        out.write(s.text.data(), static_cast<std::streamsize>(s.text.size()));
+        written += (at - pos) + s.text.size();
+        pos = at + static_cast<size_t>(s.length);
+    }
+    copy(pos, src.size());
+    written += src.size() - pos;
 
-        // Ouverture du block de solid
-        if (pendingSolid && line.find("{") != std::string::npos) {
-            pendingSolid = false;
-            inSolid = true;
-            solidBraceDepth = 1;
-            brushIndex++;
-            faceIndexWithinBrush = -1;
-            out << rawLine << "\n";
-            continue;
-        }
-
-        if (inSolid) {
-            // Gestion générique des braces pour solid
-            if (line.find("{") != std::string::npos) solidBraceDepth++;
-            if (line.find("}") != std::string::npos) solidBraceDepth--;
-
-            // Détection "side" (même si { est sur la ligne suivante)
-            if (!inSide && !pendingSide) {
-                if (line.rfind("side", 0) == 0) {
-                    pendingSide = true;
-                    sideSawMaterialLine = false;
-                    out << rawLine << "\n";
-                    continue;
-                }
-            }
-
-            // Ouverture effective du side
-            if (pendingSide && line.find("{") != std::string::npos) {
-                pendingSide = false;
-                inSide = true;
-                sideBraceDepth = 1;
-                faceIndexWithinBrush++;
-                sideSawMaterialLine = false;
-                out << rawLine << "\n";
-                continue;
-            }
-
-            // Cas "side {" sur la même ligne
-            if (!inSide && line.find("side") != std::string::npos && line.find("{") != std::string::npos) {
-                inSide = true;
-                sideBraceDepth = 1;
-                faceIndexWithinBrush++;
-                sideSawMaterialLine = false;
-                out << rawLine << "\n";
-                continue;
-            }
+    out.close();
+    std::error_code error;
+    if (out.fail()) {
+        std::filesystem::remove(temp, error);
+        return false;
+    }
+    if (source) source->Close();
+    std::filesystem::rename(temp, dstPath, error);
+    if (error) {
+        std::filesystem::remove(temp, error);
+        return false;
+    }
+    Profiler::Add("bytes_written", written);
+    return true;
+}
 
-            // À l’intérieur d’un side : on remplace la ligne material si la face est cachée
-            if (inSide) {
-                if (line.find("{") != std::string::npos) sideBraceDepth++;
-                if (line.find("}") != std::string::npos) {
-                    sideBraceDepth--;
-                    // Si on ferme le side, et qu'on n'a pas encore vu de ligne material,
-                    // mais que la face est cachée, on injecte une ligne material juste avant la fermeture.
-                    if (sideBraceDepth == 0) {
-                        // Inject material if needed and not seen
-                        if (brushIndex >= 0 && brushIndex < (int)brushes.size()) {
-                            const auto& b = brushes[brushIndex];
-                            if (faceIndexWithinBrush >= 0 && faceIndexWithinBrush < (int)b.faces.size()) {
-                                const auto& f = b.faces[faceIndexWithinBrush];
-                                if (f.hidden && !sideSawMaterialLine) {
-                                    // On injecte la ligne material avec l'indentation de cette ligne "}".
-                                    // On récupère l'indentation actuelle :
-                                    size_t firstNonWs = rawLine.find_first_not_of(" \t\r\n");
-                                    std::string indent = (firstNonWs == std::string::npos) ? "" : rawLine.substr(0, firstNonWs);
-                                    out << indent << "    \"material\" \"tools/toolsnodraw\"\n";
-                                }
-                            }
-                        }
-
-                        // Écrire la ligne de fermeture du side
-                        out << rawLine << "\n";
-                        inSide = false;
-                        continue;
-                    }
-                }
-
-                // Si c'est une ligne "material", on remplace si la face est cachée
-                if (line.find("\"material\"") != std::string::npos) {
-                    sideSawMaterialLine = true;
-                    // Est-ce que la face courante est cachée ?
-                    bool shouldNodraw = false;
-                    if (brushIndex >= 0 && brushIndex < (int)brushes.size()) {
-                        const auto& b = brushes[brushIndex];
-                        if (faceIndexWithinBrush >= 0 && faceIndexWithinBrush < (int)b.faces.size()) {
-                            shouldNodraw = b.faces[faceIndexWithinBrush].hidden;
-                        }
-                    }
-
-                    if (shouldNodraw) {
-                        std::string modLine = rawLine;
-                        if (!ReplaceMaterialLine(modLine, "tools/toolsnodraw")) {
-                            // Si pour une raison quelconque on n'a pas pu remplacer, on injecte une ligne propre.
-                            size_t firstNonWs = rawLine.find_first_not_of(" \t\r\n");
-                            std::string indent = (firstNonWs == std::string::npos) ? "" : rawLine.substr(0, firstNonWs);
-                            out << indent << "\"material\" \"tools/toolsnodraw\"\n";
-                        }
-                        else {
-                            out << modLine << "\n";
-                        }
-                        continue;
-                    }
-                    else {
-                        // Face visible : on recopie tel quel
-                        out << rawLine << "\n";
-                        continue;
-                    }
-                }
-
-                // Ligne quelconque à l’intérieur du side
-                out << rawLine << "\n";
-                continue;
+void Writer::ApplyNodraw(const std::string& srcPath,
+    const std::string& dstPath,
+    const std::vector<Brush>& brushes,
+    const MaterialTable* materials)
+{
+    WriteNodraw(srcPath, dstPath, materials, false, [&](auto&& add) {
+        for (const Brush& b : brushes) {
+            for (const Face& f : b.faces) {
+                if (f.hidden) add(f);
             }
+        }
+    });
+}
 
-            // Fin d'un solid (quand on remonte à la profondeur 0)
-            if (!inSide && solidBraceDepth == 0) {
-                out << rawLine << "\n";
-                inSolid = false;
-                continue;
-            }
+void Writer::ApplyNodraw(const std::string& srcPath,
+    const std::string& dstPath,
+    const std::vector<Face>& hiddenFaces,
+    const MaterialTable* materials)
+{
+    WriteNodraw(srcPath, dstPath, materials, true, [&](auto&& add) {
+        for (const Face& f : hiddenFaces) add(f);
+    });
+}
 
-            // Ligne quelconque à l’intérieur du solid (hors side)
-            out << rawLine << "\n";
-            continue;
+void Writer::WritePatch(const std::string& srcPath,
+    const std::string& patchPath,
+    const std::vector<Brush>& brushes,
+    const MaterialTable& materials)
+{
+    Profiler::Timer timer("write");
+    // Le patch désigne les sides par leur id : sans id (ou avec un id pris
+    // par plusieurs faces cachées) une face reste telle quelle
+    std::vector<Patch::Side> sides;
+    for (const Brush& b : brushes) {
+        for (const Face& f : b.faces) {
+            if (!f.hidden || f.sideId < 0) continue;
+            Patch::Side s;
+            s.id = f.sideId;
+            s.hasBefore = f.materialOffset >= 0;
+            if (s.hasBefore) s.before = materials.Name(f.material);
+            s.after = NODRAW_MATERIAL;
+            sides.push_back(std::move(s));
         }
-
-        // Ligne hors de tout solid
-        out << rawLine << "\n";
     }
+    std::sort(sides.begin(), sides.end(), [](const Patch::Side& a, const Patch::Side& b) { return a.id < b.id; });
+    size_t kept = 0, left = 0;
+    for (size_t i = 0; i < sides.size();) {
+        size_t j = i + 1;
+        while (j < sides.size() && sides[j].id == sides[i].id) ++j;
+        if (j > i + 1) left += j - i;
+        else if (kept++ != i) sides[kept - 1] = std::move(sides[i]);
+        i = j;
+    }
+    sides.resize(kept);
+    if (left) std::cout << "Writer: " << left << " hidden sides share their id, left out of the patch.\n";
 
-    in.close();
-    out.close();
-
-    std::cout << "Optimized VMF written to " << dstPath << "\n";
+    try {
+        Patch::Write(srcPath, patchPath, std::move(sides));
+    }
+    catch (const std::runtime_error& e) {
+        throw std::runtime_error("Writer: " + srcPath + ": " + e.what() + ", no patch written");
+    }
+    std::cout << "Patch written to " << patchPath << "\n";
 }
@@ -1,14 +1,67 @@
 ﻿#pragma once
 #include "Geometry.h"
+#include "MappedFile.h"
+#include "ParsedMap.h"
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Writer {
 public:
+    // Replacement of the bytes [offset, offset + length) of the source file
+    struct Splice {
+        int64_t offset = 0;
+        int64_t length = 0;     // 0 = pure insertion
+        std::string text;
+    };
+
     // inputPath: original VMF file
     // outputPath: target VMF file
     // brushes: parsed brushes with face.hidden flags set
+    // materials: names of Face::material, used to check that the input did
+    // not change since it was parsed (without it only the quotes are checked)
+    // Throws std::runtime_error if the input cannot be read, changed since
+    // it was parsed, or the output cannot be written.
     static void ApplyNodraw(const std::string& inputPath,
         const std::string& outputPath,
-        const std::vector<Brush>& brushes);
+        const std::vector<Brush>& brushes,
+        const MaterialTable* materials = nullptr);
+
+    // Same, for a list of faces (low-memory mode keeps no brushes): every
+    // face of hiddenFaces gets the nodraw material, whatever its flag
+    static void ApplyNodraw(const std::string& inputPath,
+        const std::string& outputPath,
+        const std::vector<Face>& hiddenFaces,
+        const MaterialTable* materials = nullptr);
+
+    // Delta output (-delta): instead of an optimized copy, patchPath gets
+    // the list of hidden sides, by "id", with their old and new materials
+    // (Patch::Write), materials naming the old ones. Sides without a unique
+    // id are left out. Throws std::runtime_error when no patch is written.
+    static void WritePatch(const std::string& inputPath,
+        const std::string& patchPath,
+        const std::vector<Brush>& brushes,
+        const MaterialTable& materials);
+
+    // Insertion of a "material" line in front of the '}' (at closeOffset)
+    // of a side that has no such key: same indentation as the '}' line plus
+    // a tab, or inline when the '}' follows other tokens on its line
+    static Splice MaterialInsertion(std::string_view src, int64_t closeOffset, std::string_view material);
+
+    // Copies src to outputPath verbatim except for the splices (sorted by
+    // offset, non-overlapping). The copy goes to "<outputPath>.tmp", renamed
+    // over outputPath once complete: outputPath may be the file src views.
+    // Returns false, outputPath untouched, if the output cannot be written.
+    // source (the mapping src views) is closed before the rename, Windows
+    // cannot replace a mapped file; with evict, the pages already copied are
+    // dropped from memory as the copy goes.
+    static bool WriteSpliced(std::string_view src,
+        const std::string& outputPath,
+        const std::vector<Splice>& splices,
+        MappedFile* source = nullptr,
+        bool evict = false);
+
+    // Material given to hidden sides
+    static const char* const NODRAW_MATERIAL;
 };
@@ -1,43 +1,248 @@
-﻿#include "VMFParser.h"
-#include "Visibility.h"
-#include "Writer.h"
+﻿#include "Patch.h"
+#include "Pipeline.h"
+#include "ThreadPool.h"
+#include "Watch.h"
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+
+namespace {
+    void PrintUsage() {
+        std::cout << "Usage: VmfOptimizer.exe -path <map.vmf> [options]\n"
+            << "       VmfOptimizer.exe -batch <dir|list.txt> [options]\n"
+            << "       VmfOptimizer.exe -apply|-revert <patch> -path <map.vmf> [-output <path>]\n"
+            << "Options:\n"
+            << "  -output <path|pattern>  output file; {name} and {dir} are replaced by the\n"
+            << "                          input name/directory (default: optimized_map.vmf,\n"
+            << "                          batch: {dir}/{name}_optimized.vmf)\n"
+            << "  -threads N              parse and visibility threads (default: all cores)\n"
+            << "  -inflight N             batch: maps held in memory at once (default: 3)\n"
+            << "  -cache                  geometry and incremental visibility caches next to\n"
+            << "                          the output\n"
+            << "  -report text|json       stage timings and counters, printed (text) or\n"
+            << "                          written to <output>.report.json (json)\n"
+            << "  -fill                   also hide world faces no entity can reach (void)\n"
+            << "  -rays N                 count the faces no ray from the playable space hits,\n"
+            << "                          N rays per sample point (approximate, try 1024+)\n"
+            << "  -rays-hide              also hide them, when the map is sampled at full density\n"
+            << "  -lowmem                 low-memory mode: compact records, tiled visibility,\n"
+            << "                          the text is not kept in memory (no -fill/-rays/-cache)\n"
+            << "  -policy <file>          entity classes / materials that occlude, receive\n"
+            << "                          nodraw or are ignored (default: world and func_detail)\n"
+            << "  -watch                  keep the map in memory and update the output each\n"
+            << "                          time the source is saved (Ctrl+C to stop)\n"
+            << "  -precision double|float|fixed\n"
+            << "                          scalar type of the visibility prefilter (same result,\n"
+            << "                          default: " << PrecisionName(DEFAULT_PRECISION) << ")\n"
+            << "  -compare-precision      also run the double pass and list the faces whose\n"
+            << "                          flag differs\n"
+            << "  -region minx miny minz maxx maxy maxz\n"
+            << "                          only optimize the brushes in this box; solids away\n"
+            << "                          from it are not parsed (no -fill/-rays/-cache)\n"
+            << "  -cordons                same, with the active cordons of each map\n"
+            << "  -delta                  write a patch of the changed sides instead of a copy\n"
+            << "                          (default output: {dir}/{name}.vpatch)\n"
+            << "  -instances              expand func_instance placements: their brushes hide\n"
+            << "                          faces of the map (no -watch/-lowmem)\n"
+            << "  -apply <patch>          apply a -delta patch to the -path map, in one pass\n"
+            << "  -revert <patch>         take it back from the patched map (output: the\n"
+            << "                          -path map itself unless -output is given)\n";
+    }
+
+    // Lit un entier strictement positif, false si invalide
+    bool ReadPositive(const char* text, unsigned& out) {
+        int n = std::atoi(text);
+        if (n < 1) return false;
+        out = static_cast<unsigned>(n);
+        return true;
+    }
+
+    // Lit un nombre (tout le texte), false si invalide
+    bool ReadNumber(const char* text, double& out) {
+        char* end = nullptr;
+        out = std::strtod(text, &end);
+        return end != text && *end == '\0';
+    }
+}
 
 int main(int argc, char** argv) {
     if (argc < 3) {
-        std::cout << "Usage: VmfOptimizer.exe -path <map.vmf>\n";
+        PrintUsage();
         return 1;
     }
 
     std::string path;
+    std::string batch;
+    std::string output;
+    std::string policy;
+    std::string patch;
+    bool revert = false;
+    bool watch = false;
+    Pipeline::Settings settings;
+    settings.threads = ThreadPool::DefaultThreadCount();
+
     for (int i = 1; i < argc; ++i) {
-        if (std::string(argv[i]) == "-path" && i + 1 < argc) {
-            path = argv[i + 1];
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-path" && hasValue) {
+            path = argv[++i];
+        }
+        else if (arg == "-batch" && hasValue) {
+            batch = argv[++i];
+        }
+        else if (arg == "-output" && hasValue) {
+            output = argv[++i];
+        }
+        else if (arg == "-threads" && hasValue) {
+            if (!ReadPositive(argv[++i], settings.threads)) {
+                std::cerr << "Error: -threads expects a positive number.\n";
+                return 1;
+            }
+        }
+        else if (arg == "-inflight" && hasValue) {
+            if (!ReadPositive(argv[++i], settings.maxInFlight)) {
+                std::cerr << "Error: -inflight expects a positive number.\n";
+                return 1;
+            }
+        }
+        else if (arg == "-cache") {
+            settings.useCache = true;
+        }
+        else if (arg == "-fill") {
+            settings.fill = true;
+        }
+        else if (arg == "-watch") {
+            watch = true;
+        }
+        else if (arg == "-lowmem") {
+            settings.lowMemory = true;
+        }
+        else if (arg == "-rays" && hasValue) {
+            if (!ReadPositive(argv[++i], settings.rays)) {
+                std::cerr << "Error: -rays expects a positive number.\n";
+                return 1;
+            }
+        }
+        else if (arg == "-rays-hide") {
+            settings.hideRays = true;
+        }
+        else if (arg == "-precision" && hasValue) {
+            if (!ParsePrecision(argv[++i], settings.precision)) {
+                std::cerr << "Error: -precision expects double, float or fixed.\n";
+                return 1;
+            }
+        }
+        else if (arg == "-compare-precision") {
+            settings.comparePrecision = true;
+        }
+        else if (arg == "-region" && i + 6 < argc) {
+            Region::Box box;
+            double* values[6] = { &box.min.x, &box.min.y, &box.min.z, &box.max.x, &box.max.y, &box.max.z };
+            for (double* v : values) {
+                if (!ReadNumber(argv[++i], *v)) {
+                    std::cerr << "Error: -region expects six numbers: minx miny minz maxx maxy maxz.\n";
+                    return 1;
+                }
+            }
+            if (box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z) {
+                std::cerr << "Error: -region: min is above max.\n";
+                return 1;
+            }
+            settings.region.boxes.push_back(box);
+        }
+        else if (arg == "-cordons") {
+            settings.region.useCordons = true;
+        }
+        else if (arg == "-instances") {
+            settings.instances = true;
+        }
+        else if (arg == "-delta") {
+            settings.delta = true;
+        }
+        else if ((arg == "-apply" || arg == "-revert") && hasValue) {
+            patch = argv[++i];
+            revert = arg == "-revert";
+        }
+        else if (arg == "-policy" && hasValue) {
+            policy = argv[++i];
+        }
+        else if (arg == "-report" && hasValue) {
+            settings.report = argv[++i];
+            if (settings.report != "text" && settings.report != "json") {
+                std::cerr << "Error: -report expects text or json.\n";
+                return 1;
+            }
         }
     }
 
-    if (path.empty()) {
+    if (path.empty() && batch.empty()) {
         std::cerr << "Error: VMF path not specified.\n";
         return 1;
     }
+    if (watch && !batch.empty()) {
+        std::cerr << "Error: -watch works on one map (-path), not with -batch.\n";
+        return 1;
+    }
+    if (!patch.empty()) {
+        if (path.empty()) {
+            std::cerr << "Error: -apply / -revert need the map to patch (-path).\n";
+            return 1;
+        }
+        try {
+            Patch::Apply(patch, path, output.empty() ? path : output, revert);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Fatal: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (settings.delta && settings.lowMemory) {
+        std::cerr << "Error: -delta does not work with -lowmem.\n";
+        return 1;
+    }
+    if (settings.hideRays && !settings.rays) {
+        std::cerr << "Error: -rays-hide needs -rays N.\n";
+        return 1;
+    }
+    if (settings.instances && (watch || settings.lowMemory)) {
+        std::cerr << "Error: -instances does not work with -watch or -lowmem.\n";
+        return 1;
+    }
+    if (settings.region.useCordons && !settings.region.boxes.empty()) {
+        std::cerr << "Error: -region and -cordons cannot be combined.\n";
+        return 1;
+    }
+    if (settings.region.Active() && (watch || settings.lowMemory)) {
+        std::cerr << "Error: -region / -cordons do not work with -watch or -lowmem.\n";
+        return 1;
+    }
+    // Le remplissage, les rayons et les caches portent sur toute la map
+    if (settings.region.Active() && (settings.fill || settings.rays || settings.useCache)) {
+        std::cout << "Region: -fill, -rays and -cache need the whole map, skipped.\n";
+        settings.fill = false;
+        settings.rays = 0;
+        settings.useCache = false;
+    }
 
     try {
-        auto brushes = VMFParser::ParseVMF(path);
-        std::cout << "Parsed " << brushes.size() << " brushes.\n";
+        if (!policy.empty()) settings.policy = EntityPolicy::Load(policy);
 
-        // 🧮 Calcul du nombre total de faces
-        int totalFaces = 0;
-        for (const auto& b : brushes)
-            totalFaces += static_cast<int>(b.faces.size());
-        std::cout << "Total faces: " << totalFaces << "\n";
-
-        // 🔍 Détection des faces cachées
-        Visibility::DetectHiddenFaces(brushes);
+        if (!batch.empty()) {
+            const char* pattern = settings.delta ? "{dir}/{name}.vpatch" : "{dir}/{name}_optimized.vmf";
+            auto jobs = Pipeline::CollectJobs(batch, output.empty() ? pattern : output);
+            if (jobs.empty()) {
+                std::cerr << "Error: no VMF found in " << batch << "\n";
+                return 1;
+            }
+            return Pipeline::RunBatch(jobs, settings) == 0 ? 0 : 1;
+        }
 
-        // ✍️ Écriture du VMF optimisé
-        Writer::ApplyNodraw(path, "optimized_map.vmf", brushes);
+        const char* pattern = settings.delta ? "{dir}/{name}.vpatch" : "optimized_map.vmf";
+        Pipeline::Job job{ path, Pipeline::OutputPathFor(path, output.empty() ? pattern : output) };
+        if (watch) Watch::Run(job, settings);
+        else Pipeline::ProcessMap(job, settings);
     }
     catch (const std::exception& e) {
         std::cerr << "Fatal: " << e.what() << "\n";